@@ -83,5 +83,6 @@ copy /y %ObjDir%\src\compiler\silver.* %BinDir%\
 copy /y %ObjDir%\src\runtime\silver_runtime.lib %BinDir%\
 copy /y %ObjDir%\src\test\test_runner.exe %BinDir%\
 copy /y %ObjDir%\src\test\pdb_test.exe %BinDir%\
+copy /y %ObjDir%\src\test\alloc_stats_test.exe %BinDir%\
 copy /y src\compiler\framework\* %FrameworkDir%\
 copy /y src\test\programs\* %ProgramsDir%\
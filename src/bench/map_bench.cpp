@@ -0,0 +1,142 @@
+// Benchmark for HashMap in framework/map.sl
+// Times map_bench.sl compiled by silver against the same workload on std::unordered_map: int keys
+// and runtime strings as keys, inserting half of them and looking up all of them. Checks both find
+// the same values and prints the time of each. Compile the workload first and pass its executable:
+//     silver map_bench.sl -optimize
+//     map_bench map_bench.exe
+// The silver time is for the whole process, which includes starting it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+extern "C" char* silver_float_to_string(double f);
+extern "C" void silver_string_release(const char* s);
+
+using namespace std;
+
+// Must match map_bench.sl
+static const int count = 1048576;
+
+static int key(int i)
+{
+    return (int)((uint32_t)i * 2654435761u);
+}
+
+struct Checksums
+{
+    int ints;
+    int strings;
+};
+
+template<typename F>
+static double milliseconds(F run)
+{
+    auto start = chrono::steady_clock::now();
+    run();
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// The values map_bench.sl finds, added up the same way
+static Checksums runStandard()
+{
+    const int half = count / 2;
+    Checksums found = {};
+
+    unordered_map<int, int> ints;
+    for (int i = 0; i < half; i++)
+    {
+        ints[key(i)] = i;
+    }
+    uint32_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        auto it = ints.find(key(i));
+        sum += (uint32_t)(it == ints.end() ? -1 : it->second);
+    }
+    found.ints = (int)sum;
+
+    // The same strings the silver program makes
+    vector<string> names;
+    for (int i = 0; i < count; i++)
+    {
+        char* name = silver_float_to_string((double)key(i));
+        names.push_back(name);
+        silver_string_release(name);
+    }
+    unordered_map<string, int> strings;
+    for (int i = 0; i < half; i++)
+    {
+        strings[names[i]] = i;
+    }
+    sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        auto it = strings.find(names[i]);
+        sum += (uint32_t)(it == strings.end() ? -1 : it->second);
+    }
+    found.strings = (int)sum;
+    return found;
+}
+
+static bool runSilver(const string& program, Checksums& found)
+{
+    FILE* pipe = popen(("\"" + program + "\"").c_str(), "r");
+    if (pipe == nullptr)
+    {
+        return false;
+    }
+    bool ok = fscanf(pipe, "%d %d", &found.ints, &found.strings) == 2;
+    return pclose(pipe) == 0 && ok;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: map_bench <map_bench.sl compiled by silver>\n");
+        return 1;
+    }
+    const string program = argv[1];
+    const int runs = 3;
+
+    // Best of a few runs
+    Checksums silverFound = {};
+    Checksums standardFound = {};
+    double silverTime = 0;
+    double standardTime = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        bool ok = true;
+        double time = milliseconds([&]() { ok = runSilver(program, silverFound); });
+        if (!ok)
+        {
+            fprintf(stderr, "cannot run %s\n", program.c_str());
+            return 1;
+        }
+        silverTime = run == 0 || time < silverTime ? time : silverTime;
+        time = milliseconds([&]() { standardFound = runStandard(); });
+        standardTime = run == 0 || time < standardTime ? time : standardTime;
+    }
+
+    printf("%d int and %d string keys inserted, %d of each looked up\n", count / 2, count / 2, count);
+    printf("%-20s %10s\n", "map", "ms");
+    printf("%-20s %10.1f\n", "HashMap (silver)", silverTime);
+    printf("%-20s %10.1f\n", "std::unordered_map", standardTime);
+    if (silverFound.ints != standardFound.ints || silverFound.strings != standardFound.strings)
+    {
+        printf("the maps found different values\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+// Benchmark for the buffered print functions
+// Prints millions of integers through silver_print_int and through printf, redirect stdout to a
+// file or the null device and compare the times reported on stderr:
+//     print_bench > /dev/null
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+extern "C" void silver_print_int(int n);
+extern "C" void silver_flush();
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 10000000;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        printf("%d\n", i - count / 2);
+    }
+    fflush(stdout);
+    chrono::duration<double> printfTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        silver_print_int(i - count / 2);
+    }
+    silver_flush();
+    chrono::duration<double> silverTime = chrono::steady_clock::now() - start;
+
+    fprintf(stderr, "%d ints: printf %.3fs (%.1f ns/int), silver_print_int %.3fs (%.1f ns/int)\n", count,
+        printfTime.count(), printfTime.count() * 1e9 / count,
+        silverTime.count(), silverTime.count() * 1e9 / count);
+    return 0;
+}
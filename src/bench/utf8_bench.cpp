@@ -0,0 +1,113 @@
+// Micro-benchmark for the runtime UTF-8 kernels
+// Counts codepoints and validates ASCII, mixed Latin and CJK heavy text with every kernel the CPU
+// supports, checks they agree with the scalar version and prints the throughput of each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "utf8.h"
+
+using namespace std;
+
+struct Kernel
+{
+    const char* name;
+    bool supported;
+    size_t (*count)(const char*, size_t);
+    bool (*validate)(const char*, size_t);
+};
+
+// Repeats sample until the buffer holds about size bytes
+static string makeInput(const string& sample, size_t size)
+{
+    string input;
+    while (input.size() < size)
+    {
+        input += sample;
+    }
+    return input;
+}
+
+template<typename F>
+static double gigabytesPerSecond(const string& input, F run)
+{
+    const int iterations = 200;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        run();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return (double)input.size() * iterations / elapsed.count() / 1e9;
+}
+
+int main()
+{
+    const size_t size = 1 << 20;
+    vector<pair<const char*, string>> inputs = {
+        {"ascii", makeInput("The quick brown fox jumps over the lazy dog. ", size)},
+        {"mixed", makeInput("caf\xC3\xA9 na\xC3\xAFve r\xC3\xA9sum\xC3\xA9 \xE2\x82\xAC" "5 stra\xC3\x9F" "e ", size)},
+        {"cjk", makeInput("\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE\xE6\x96\x87\xE7\xAB\xA0\xE4\xB8\xAD\xE6\x96\x87 ", size)},
+    };
+
+    vector<Kernel> kernels = {
+        {"scalar", true, utf8::countScalar, utf8::validateScalar},
+        {"sse2", utf8::hasSse2(), utf8::countSse2, utf8::validateSse2},
+        {"avx2", utf8::hasAvx2(), utf8::countAvx2, utf8::validateAvx2},
+    };
+
+    printf("dispatching to %s\n", utf8::kernelName());
+    printf("%-8s %-8s %14s %14s\n", "input", "kernel", "count GB/s", "validate GB/s");
+
+    int failures = 0;
+    for (const auto& input : inputs)
+    {
+        const string& text = input.second;
+        size_t expectedCount = utf8::countScalar(text.data(), text.size());
+        for (const Kernel& kernel : kernels)
+        {
+            if (!kernel.supported)
+            {
+                continue;
+            }
+
+            if (kernel.count(text.data(), text.size()) != expectedCount || !kernel.validate(text.data(), text.size()))
+            {
+                printf("%s kernel gives a wrong result on %s input\n", kernel.name, input.first);
+                failures++;
+                continue;
+            }
+
+            volatile size_t sink = 0;
+            double count = gigabytesPerSecond(text, [&]() { sink = sink + kernel.count(text.data(), text.size()); });
+            double validate = gigabytesPerSecond(text, [&]() { sink = sink + kernel.validate(text.data(), text.size()); });
+            printf("%-8s %-8s %14.2f %14.2f\n", input.first, kernel.name, count, validate);
+        }
+    }
+
+    // Every kernel must reject the same malformed sequences, placed across block boundaries
+    const char* malformed[] = {
+        "\x80", "\xC0\xAF", "\xC3", "\xE0\x80\xAF", "\xED\xA0\x80", "\xE2\x82",
+        "\xF0\x80\x80\xAF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\xE2\x82\xAC\x80",
+    };
+    for (const char* bad : malformed)
+    {
+        for (size_t offset = 0; offset < 70; offset++)
+        {
+            string text = string(offset, 'a') + bad + string(offset % 7, 'b');
+            for (const Kernel& kernel : kernels)
+            {
+                if (kernel.supported && kernel.validate(text.data(), text.size()))
+                {
+                    printf("%s kernel accepts malformed input at offset %zu\n", kernel.name, offset);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -5,6 +5,62 @@ using namespace std;
 
 namespace ast
 {
+    bool isIntegerType(const string &type)
+    {
+        return type == "int" || type == "i8" || type == "i16" || type == "i64"
+            || type == "u8" || type == "u16" || type == "u32" || type == "u64";
+    }
+
+    bool isUnsignedType(const string &type)
+    {
+        return isIntegerType(type) && type[0] == 'u';
+    }
+
+    bool isFloatType(const string &type)
+    {
+        return type == "float" || type == "f32";
+    }
+
+    unsigned numericTypeBits(const string &type)
+    {
+        if (type == "int" || type == "f32")
+        {
+            return 32;
+        }
+        else if (type == "float")
+        {
+            return 64;
+        }
+        else if (isIntegerType(type))
+        {
+            return static_cast<unsigned>(stoul(type.substr(1)));
+        }
+        return 0;
+    }
+
+    bool integerFits(int64_t value, const string &type)
+    {
+        unsigned bits = numericTypeBits(type);
+        if (bits == 64)
+        {
+            return !isUnsignedType(type) || value >= 0;
+        }
+        if (isUnsignedType(type))
+        {
+            return value >= 0 && value < (int64_t(1) << bits);
+        }
+        return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+    }
+
+    string taskResultType(const string &type)
+    {
+        if (type.size() < 7 || type.compare(0, 5, "task<") != 0 || type.back() != '>')
+        {
+            return "";
+        }
+        return type.substr(5, type.size() - 6);
+    }
+
     void Node::newLine(ostream &out, size_t indent)
     {
         out << endl;
@@ -56,11 +112,13 @@ namespace ast
 
     Assembly::Assembly(string name, vector<shared_ptr<Function>> functions,
                        vector<shared_ptr<ClassDeclaration>> classes,
-                       vector<shared_ptr<NamespaceDeclaration>> namespaces) :
+                       vector<shared_ptr<NamespaceDeclaration>> namespaces,
+                       vector<string> genericTypes) :
         mName(name),
         mFunctions(functions),
         mClasses(classes),
-        mNamespaces(namespaces)
+        mNamespaces(namespaces),
+        mGenericTypes(genericTypes)
     {
 
     }
@@ -70,16 +128,31 @@ namespace ast
         return mFunctions;
     }
 
+    void Assembly::setFunctions(vector<shared_ptr<Function>> functions)
+    {
+        mFunctions = functions;
+    }
+
     vector<shared_ptr<ClassDeclaration>> Assembly::getClasses()
     {
         return mClasses;
     }
 
+    void Assembly::setClasses(vector<shared_ptr<ClassDeclaration>> classes)
+    {
+        mClasses = classes;
+    }
+
     vector<shared_ptr<NamespaceDeclaration>> Assembly::getNamespaces()
     {
         return mNamespaces;
     }
 
+    vector<string> Assembly::getGenericTypes()
+    {
+        return mGenericTypes;
+    }
+
     size_t Assembly::size()
     {
         return mFunctions.size();
@@ -115,13 +188,17 @@ namespace ast
         newLine(out, 0);
     }
 
-    Function::Function(shared_ptr<BlockNode> block, string name, vector<shared_ptr<Argument>> arguments, string returnType, bool isLocal, Visibility visibility) :
+    Function::Function(shared_ptr<BlockNode> block, string name, vector<shared_ptr<Argument>> arguments, string returnType, bool isLocal, Visibility visibility,
+                       vector<string> typeParameters, Inlining inlining) :
         mBlock(block),
         mName(name),
         mArgs(arguments),
         mReturnType(returnType),
         mIsLocal(isLocal),
-        mVisibility(visibility)
+        mVisibility(visibility),
+        mTypeParameters(typeParameters),
+        mInlining(inlining),
+        mIsImported(false)
     {
         ASSERT(mBlock != nullptr);
     }
@@ -146,6 +223,31 @@ namespace ast
         return mVisibility;
     }
 
+    bool Function::isGeneric() const
+    {
+        return !mTypeParameters.empty();
+    }
+
+    vector<string> Function::getTypeParameters() const
+    {
+        return mTypeParameters;
+    }
+
+    Inlining Function::getInlining() const
+    {
+        return mInlining;
+    }
+
+    bool Function::isImported() const
+    {
+        return mIsImported;
+    }
+
+    void Function::setImported(bool imported)
+    {
+        mIsImported = imported;
+    }
+
     size_t Function::argCount()
     {
         return mArgs.size();
@@ -170,9 +272,25 @@ namespace ast
         out << "Name:" << mName;
         newLine(out, indent);
 
+        if (isGeneric())
+        {
+            out << "Type parameters:";
+            for (const string &param : mTypeParameters)
+            {
+                out << " " << param;
+            }
+            newLine(out, indent);
+        }
+
         out << "Return type: " << mReturnType;
         newLine(out, indent);
 
+        if (mInlining != Inlining::Default)
+        {
+            out << "Inlining: " << (mInlining == Inlining::Always ? "inline" : "noinline");
+            newLine(out, indent);
+        }
+
         out << "Arguments:";
 
         ++indent;
@@ -230,6 +348,11 @@ namespace ast
         return mExpression;
     }
 
+    void DeclarationNode::setExpression(shared_ptr<Expression> expression)
+    {
+        mExpression = expression;
+    }
+
     void DeclarationNode::clearExpression()
     {
         mExpression = nullptr;
@@ -259,6 +382,11 @@ namespace ast
         return mExpression;
     }
 
+    void ReturnNode::setExpression(shared_ptr<Expression> expression)
+    {
+        mExpression = expression;
+    }
+
     void ReturnNode::prettyPrint(ostream &out, size_t indent)
     {
         UNREFERENCED(indent);
@@ -292,14 +420,30 @@ namespace ast
         return mExpression;
     }
 
+    void CastNode::setExpression(shared_ptr<Expression> expression)
+    {
+        mExpression = expression;
+    }
+
     string CastNode::getCastType()
     {
         return mCastType;
     }
 
-    IntegerLiteralNode::IntegerLiteralNode(int val, int line, int col) :
+    string CastNode::getSourceType()
+    {
+        return mSourceType;
+    }
+
+    void CastNode::setSourceType(string type)
+    {
+        mSourceType = type;
+    }
+
+    IntegerLiteralNode::IntegerLiteralNode(int64_t val, int line, int col, string type) :
         Expression(line, col),
-        mValue(val)
+        mValue(val),
+        mType(type)
     {
 
     }
@@ -309,16 +453,35 @@ namespace ast
         return ExpressionType::IntegerLiteral;
     }
 
-    int IntegerLiteralNode::getValue()
+    int64_t IntegerLiteralNode::getValue()
     {
         return mValue;
     }
 
+    string IntegerLiteralNode::getType()
+    {
+        return mType.empty() ? "int" : mType;
+    }
+
+    void IntegerLiteralNode::setType(string type)
+    {
+        mType = type;
+    }
+
+    bool IntegerLiteralNode::hasExplicitType()
+    {
+        return !mType.empty();
+    }
+
     void IntegerLiteralNode::prettyPrint(ostream &out, size_t indent)
     {
         UNREFERENCED(indent);
 
         out << mValue;
+        if (!mType.empty() && mType != "int")
+        {
+            out << mType;
+        }
     }
 
 
@@ -362,11 +525,31 @@ namespace ast
         return mRhs;
     }
 
+    void BinaryExpressionNode::setLhs(shared_ptr<Expression> lhs)
+    {
+        mLhs = lhs;
+    }
+
+    void BinaryExpressionNode::setRhs(shared_ptr<Expression> rhs)
+    {
+        mRhs = rhs;
+    }
+
     string BinaryExpressionNode::getOperator()
     {
         return mOp;
     }
 
+    string BinaryExpressionNode::getOperandType()
+    {
+        return mOperandType;
+    }
+
+    void BinaryExpressionNode::setOperandType(string type)
+    {
+        mOperandType = type;
+    }
+
     void BinaryExpressionNode::prettyPrint(ostream &out, size_t indent)
     {
         UNREFERENCED(indent);
@@ -401,9 +584,10 @@ namespace ast
         out << "\"" << mValue << "\"";
     }
 
-    FloatLiteralNode::FloatLiteralNode(double val, int line, int col) :
+    FloatLiteralNode::FloatLiteralNode(double val, int line, int col, string type) :
         Expression(line, col),
-        mValue(val)
+        mValue(val),
+        mType(type)
     {
     }
 
@@ -417,11 +601,26 @@ namespace ast
         return mValue;
     }
 
+    string FloatLiteralNode::getType()
+    {
+        return mType.empty() ? "float" : mType;
+    }
+
+    void FloatLiteralNode::setType(string type)
+    {
+        mType = type;
+    }
+
+    bool FloatLiteralNode::hasExplicitType()
+    {
+        return !mType.empty();
+    }
+
     void FloatLiteralNode::prettyPrint(ostream &out, size_t indent)
     {
         UNREFERENCED(indent);
 
-        out << mValue << "f";
+        out << mValue << (mType == "f32" ? "f32" : "f");
     }
 
     IdentifierNode::IdentifierNode(string val, int line, int col) :
@@ -467,7 +666,8 @@ namespace ast
     FunctionCallNode::FunctionCallNode(string name, vector<shared_ptr<Expression>> args, int line, int col) :
         Expression(line, col),
         mName(name),
-        mArgs(args)
+        mArgs(args),
+        mSpawned(false)
     {
 
     }
@@ -477,6 +677,31 @@ namespace ast
         return mName;
     }
 
+    void FunctionCallNode::setName(string name)
+    {
+        mName = name;
+    }
+
+    bool FunctionCallNode::isSpawned()
+    {
+        return mSpawned;
+    }
+
+    void FunctionCallNode::setSpawned(bool spawned)
+    {
+        mSpawned = spawned;
+    }
+
+    string FunctionCallNode::getTaskType()
+    {
+        return mTaskType;
+    }
+
+    void FunctionCallNode::setTaskType(string type)
+    {
+        mTaskType = type;
+    }
+
     size_t FunctionCallNode::argCount()
     {
         return mArgs.size();
@@ -487,6 +712,11 @@ namespace ast
         return mArgs;
     }
 
+    void FunctionCallNode::setArg(size_t index, shared_ptr<Expression> arg)
+    {
+        mArgs[index] = arg;
+    }
+
     ExpressionType FunctionCallNode::getExpressionType()
     {
         return ExpressionType::FunctionCall;
@@ -494,7 +724,7 @@ namespace ast
 
     void FunctionCallNode::prettyPrint(ostream &out, size_t indent)
     {
-        out << "Function call";
+        out << (mSpawned ? "Spawned function call" : "Function call");
         newLine(out, indent);
         out << "name: [" << mName << "] ";
         newLine(out, indent);
@@ -519,6 +749,11 @@ namespace ast
         return mCondition;
     }
 
+    void IfNode::setCondition(shared_ptr<Expression> condition)
+    {
+        mCondition = condition;
+    }
+
     shared_ptr<BlockNode> IfNode::getBlock()
     {
         return mBlock;
@@ -593,6 +828,11 @@ namespace ast
         return mCondition;
     }
 
+    void WhileNode::setCondition(shared_ptr<Expression> condition)
+    {
+        mCondition = condition;
+    }
+
     shared_ptr<BlockNode> WhileNode::getBlock()
     {
         return mBlock;
@@ -614,6 +854,115 @@ namespace ast
         mBlock->prettyPrint(out, indent);
     }
 
+    ForNode::ForNode(string variable, shared_ptr<Expression> start, shared_ptr<Expression> end,
+                     shared_ptr<BlockNode> block, int line, int col) :
+        Expression(line, col),
+        mVariable(variable),
+        mVariableType(),
+        mStart(start),
+        mEnd(end),
+        mBlock(block),
+        mParallel(false),
+        mCaptures(),
+        mReductions()
+    {
+
+    }
+
+    string ForNode::getVariable() const
+    {
+        return mVariable;
+    }
+
+    string ForNode::getVariableType() const
+    {
+        return mVariableType;
+    }
+
+    void ForNode::setVariableType(string type)
+    {
+        mVariableType = type;
+    }
+
+    bool ForNode::isRange() const
+    {
+        return mEnd != nullptr;
+    }
+
+    shared_ptr<Expression> ForNode::getStart() const
+    {
+        return mStart;
+    }
+
+    void ForNode::setStart(shared_ptr<Expression> start)
+    {
+        mStart = start;
+    }
+
+    shared_ptr<Expression> ForNode::getEnd() const
+    {
+        return mEnd;
+    }
+
+    void ForNode::setEnd(shared_ptr<Expression> end)
+    {
+        mEnd = end;
+    }
+
+    shared_ptr<BlockNode> ForNode::getBlock() const
+    {
+        return mBlock;
+    }
+
+    bool ForNode::isParallel() const
+    {
+        return mParallel;
+    }
+
+    void ForNode::setParallel(bool parallel)
+    {
+        mParallel = parallel;
+    }
+
+    vector<string> ForNode::getCaptures() const
+    {
+        return mCaptures;
+    }
+
+    void ForNode::setCaptures(vector<string> captures)
+    {
+        mCaptures = captures;
+    }
+
+    vector<string> ForNode::getReductions() const
+    {
+        return mReductions;
+    }
+
+    void ForNode::setReductions(vector<string> reductions)
+    {
+        mReductions = reductions;
+    }
+
+    ExpressionType ForNode::getExpressionType()
+    {
+        return ExpressionType::For;
+    }
+
+    void ForNode::prettyPrint(ostream &out, size_t indent)
+    {
+        out << (mParallel ? "Parallel For Node " : "For Node ") << mVariable << " in ";
+        mStart->prettyPrint(out, indent);
+        if (mEnd != nullptr)
+        {
+            out << "..";
+            mEnd->prettyPrint(out, indent);
+        }
+        newLine(out, indent);
+        out << "Block: ";
+        mBlock->prettyPrint(out, indent);
+    }
+
     // Field implementation
     Field::Field(string name, string type, Visibility visibility) :
         mName(name),
@@ -647,10 +996,13 @@ namespace ast
 
     // ClassDeclaration implementation
     ClassDeclaration::ClassDeclaration(string name, vector<shared_ptr<Field>> fields,
-                                       vector<shared_ptr<Function>> methods) :
+                                       vector<shared_ptr<Function>> methods, bool valueType,
+                                       vector<string> typeParameters) :
         mName(name),
         mFields(fields),
-        mMethods(methods)
+        mMethods(methods),
+        mValueType(valueType),
+        mTypeParameters(typeParameters)
     {
     }
 
@@ -659,6 +1011,21 @@ namespace ast
         return mName;
     }
 
+    bool ClassDeclaration::isValueType() const
+    {
+        return mValueType;
+    }
+
+    bool ClassDeclaration::isGeneric() const
+    {
+        return !mTypeParameters.empty();
+    }
+
+    vector<string> ClassDeclaration::getTypeParameters() const
+    {
+        return mTypeParameters;
+    }
+
     vector<shared_ptr<Field>> ClassDeclaration::getFields() const
     {
         return mFields;
@@ -669,6 +1036,11 @@ namespace ast
         return mMethods;
     }
 
+    void ClassDeclaration::setMethods(vector<shared_ptr<Function>> methods)
+    {
+        mMethods = methods;
+    }
+
     size_t ClassDeclaration::getFieldIndex(const string& fieldName) const
     {
         for (size_t i = 0; i < mFields.size(); ++i)
@@ -683,7 +1055,15 @@ namespace ast
 
     void ClassDeclaration::prettyPrint(ostream &out, size_t indent)
     {
-        out << "Class: " << mName;
+        out << (mValueType ? "Struct: " : "Class: ") << mName;
+        for (size_t i = 0; i < mTypeParameters.size(); ++i)
+        {
+            out << (i == 0 ? "<" : ", ") << mTypeParameters[i];
+        }
+        if (isGeneric())
+        {
+            out << ">";
+        }
         ++indent;
         newLine(out, indent);
         out << "Fields:";
@@ -725,6 +1105,11 @@ namespace ast
         return mArgs;
     }
 
+    void AllocNode::setArg(size_t index, shared_ptr<Expression> arg)
+    {
+        mArgs[index] = arg;
+    }
+
     ExpressionType AllocNode::getExpressionType()
     {
         return ExpressionType::Alloc;
@@ -772,6 +1157,53 @@ namespace ast
         out << "." << mMemberName;
     }
 
+    // IndexNode implementation
+    IndexNode::IndexNode(shared_ptr<Expression> array, shared_ptr<Expression> index, int line, int col) :
+        Expression(line, col),
+        mArray(array),
+        mIndex(index),
+        mBoundsChecked(true)
+    {
+    }
+
+    shared_ptr<Expression> IndexNode::getArray() const
+    {
+        return mArray;
+    }
+
+    shared_ptr<Expression> IndexNode::getIndex() const
+    {
+        return mIndex;
+    }
+
+    void IndexNode::setIndex(shared_ptr<Expression> index)
+    {
+        mIndex = index;
+    }
+
+    bool IndexNode::isBoundsChecked() const
+    {
+        return mBoundsChecked;
+    }
+
+    void IndexNode::setBoundsChecked(bool checked)
+    {
+        mBoundsChecked = checked;
+    }
+
+    ExpressionType IndexNode::getExpressionType()
+    {
+        return ExpressionType::Index;
+    }
+
+    void IndexNode::prettyPrint(ostream &out, size_t indent)
+    {
+        mArray->prettyPrint(out, indent);
+        out << "[";
+        mIndex->prettyPrint(out, indent);
+        out << "]";
+    }
+
     // MethodCallNode implementation
     MethodCallNode::MethodCallNode(shared_ptr<Expression> object, string methodName,
                                    vector<shared_ptr<Expression>> args, int line, int col) :
@@ -797,6 +1229,11 @@ namespace ast
         return mArgs;
     }
 
+    void MethodCallNode::setArg(size_t index, shared_ptr<Expression> arg)
+    {
+        mArgs[index] = arg;
+    }
+
     size_t MethodCallNode::argCount() const
     {
         return mArgs.size();
@@ -851,6 +1288,11 @@ namespace ast
         return mArgs;
     }
 
+    void QualifiedCallNode::setArg(size_t index, shared_ptr<Expression> arg)
+    {
+        mArgs[index] = arg;
+    }
+
     size_t QualifiedCallNode::argCount() const
     {
         return mArgs.size();
@@ -896,6 +1338,11 @@ namespace ast
         return mFunctions;
     }
 
+    void NamespaceDeclaration::setFunctions(vector<shared_ptr<Function>> functions)
+    {
+        mFunctions = functions;
+    }
+
     vector<shared_ptr<ClassDeclaration>> NamespaceDeclaration::getClasses() const
     {
         return mClasses;
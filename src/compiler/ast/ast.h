@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <string>
@@ -37,9 +38,25 @@ namespace ast
         Alloc,
         MemberAccess,
         QualifiedCall,
-        MethodCall
+        MethodCall,
+        Index,
+        For
     };
 
+    // Numeric types: "int" and "float" are the 32-bit signed integer and the 64-bit float, i8 to i64
+    // and u8 to u64 signed and unsigned integers of that width, and f32 a single precision float.
+    // The parser spells i32 and f64 as int and float.
+    bool isIntegerType(const std::string &type);
+    bool isUnsignedType(const std::string &type);
+    bool isFloatType(const std::string &type);
+    unsigned numericTypeBits(const std::string &type);
+    // Whether an integer type can hold the value. u64 literals above INT64_MAX are stored wrapped
+    // around and only checked by the parser.
+    bool integerFits(int64_t value, const std::string &type);
+    // "task<int>" -> "int", the handle "spawn f()" returns for an f returning int. Empty for anything
+    // that isn't a task type.
+    std::string taskResultType(const std::string &type);
+
     // Visibility for class fields
     enum class Visibility
     {
@@ -47,6 +64,14 @@ namespace ast
         Private
     };
 
+    // "inline fn" is always inlined, "noinline fn" never, others when they are small enough
+    enum class Inlining
+    {
+        Default,
+        Always,
+        Never
+    };
+
     class Node
     {
     protected:
@@ -65,19 +90,24 @@ namespace ast
         std::vector<std::shared_ptr<Function>> mFunctions;
         std::vector<std::shared_ptr<ClassDeclaration>> mClasses;
         std::vector<std::shared_ptr<NamespaceDeclaration>> mNamespaces;
+        std::vector<std::string> mGenericTypes;  // Uses of generic classes with concrete arguments, "Box<int>"
         std::string mName;
 
     public:
         Assembly(std::string name,
                  std::vector<std::shared_ptr<Function>> functions,
                  std::vector<std::shared_ptr<ClassDeclaration>> classes = {},
-                 std::vector<std::shared_ptr<NamespaceDeclaration>> namespaces = {});
+                 std::vector<std::shared_ptr<NamespaceDeclaration>> namespaces = {},
+                 std::vector<std::string> genericTypes = {});
         virtual ~Assembly() = default;
 
         size_t size();
         std::vector<std::shared_ptr<Function>> getFunctions();
+        void setFunctions(std::vector<std::shared_ptr<Function>> functions);
         std::vector<std::shared_ptr<ClassDeclaration>> getClasses();
+        void setClasses(std::vector<std::shared_ptr<ClassDeclaration>> classes);
         std::vector<std::shared_ptr<NamespaceDeclaration>> getNamespaces();
+        std::vector<std::string> getGenericTypes();
         std::string getName();
         void prettyPrint(std::ostream &out);
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
@@ -137,6 +167,9 @@ namespace ast
         std::string mReturnType;
         bool mIsLocal;
         Visibility mVisibility;
+        std::vector<std::string> mTypeParameters;
+        Inlining mInlining;
+        bool mIsImported;
 
     public:
         Function(std::shared_ptr<BlockNode> block,
@@ -144,7 +177,9 @@ namespace ast
                  std::vector<std::shared_ptr<Argument>> arguments,
                  std::string returnType,
                  bool isLocal = false,
-                 Visibility visibility = Visibility::Public);
+                 Visibility visibility = Visibility::Public,
+                 std::vector<std::string> typeParameters = {},
+                 Inlining inlining = Inlining::Default);
         virtual ~Function() = default;
 
         std::shared_ptr<BlockNode> getBlock();
@@ -152,6 +187,13 @@ namespace ast
         std::string getReturnType() const;
         bool isLocal() const;
         Visibility getVisibility() const;
+        // "fn max<T>(...)" is a template, only its instantiations are checked and compiled
+        bool isGeneric() const;
+        std::vector<std::string> getTypeParameters() const;
+        Inlining getInlining() const;
+        // Defined by an imported module, only the importing program can call it
+        bool isImported() const;
+        void setImported(bool imported);
         size_t argCount();
         std::vector<std::shared_ptr<Argument>> getArguments();
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
@@ -173,6 +215,7 @@ namespace ast
         std::string getTypeName();
         void setTypeName(std::string type);
         std::shared_ptr<Expression> getExpression();
+        void setExpression(std::shared_ptr<Expression> expression);
         void clearExpression();
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
@@ -189,12 +232,14 @@ namespace ast
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
         std::shared_ptr<Expression> getExpression();
+        void setExpression(std::shared_ptr<Expression> expression);
     };
 
     class CastNode : public Expression
     {
     private:
         std::string mCastType;
+        std::string mSourceType;  // Set by the type inference, decides between signed and unsigned conversions
         std::shared_ptr<Expression> mExpression;
 
     public:
@@ -204,20 +249,27 @@ namespace ast
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
         std::string getCastType();
+        std::string getSourceType();
+        void setSourceType(std::string type);
         std::shared_ptr<Expression> getExpression();
+        void setExpression(std::shared_ptr<Expression> expression);
     };
 
     class IntegerLiteralNode : public Expression
     {
     private:
-        int mValue;
+        int64_t mValue;
+        std::string mType;  // Empty until a suffix or the context gives the literal a type, an int meanwhile
 
     public:
-        IntegerLiteralNode(int val, int line = 0, int col = 0);
+        IntegerLiteralNode(int64_t val, int line = 0, int col = 0, std::string type = "");
         virtual ~IntegerLiteralNode() = default;
 
         virtual ExpressionType getExpressionType() override;
-        int getValue();
+        int64_t getValue();
+        std::string getType();
+        void setType(std::string type);
+        bool hasExplicitType();
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
 
@@ -239,13 +291,17 @@ namespace ast
     {
     private:
         double mValue;
+        std::string mType;  // Empty until a suffix or the context gives the literal a type, a float meanwhile
 
     public:
-        FloatLiteralNode(double val, int line = 0, int col = 0);
+        FloatLiteralNode(double val, int line = 0, int col = 0, std::string type = "");
         virtual ~FloatLiteralNode() = default;
 
         virtual ExpressionType getExpressionType() override;
         double getValue();
+        std::string getType();
+        void setType(std::string type);
+        bool hasExplicitType();
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
 
@@ -269,6 +325,7 @@ namespace ast
         std::shared_ptr<Expression> mLhs;
         std::shared_ptr<Expression> mRhs;
         std::string mOp;
+        std::string mOperandType;  // Set by the type inference, decides between signed and unsigned operations
 
     public:
         BinaryExpressionNode(std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs, std::string op, int line = 0, int col = 0);
@@ -277,7 +334,11 @@ namespace ast
         virtual ExpressionType getExpressionType() override;
         std::shared_ptr<Expression> getLhs();
         std::shared_ptr<Expression> getRhs();
+        void setLhs(std::shared_ptr<Expression> lhs);
+        void setRhs(std::shared_ptr<Expression> rhs);
         std::string getOperator();
+        std::string getOperandType();
+        void setOperandType(std::string type);
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
 
@@ -296,14 +357,22 @@ namespace ast
     private:
         std::vector<std::shared_ptr<Expression>> mArgs;
         std::string mName;
+        bool mSpawned;         // "spawn f(x)" runs the call on the thread pool and gives a task handle
+        std::string mTaskType; // Set by the type inference for spawn and join, "task<int>"
 
     public:
         FunctionCallNode(std::string name, std::vector<std::shared_ptr<Expression>> args, int line = 0, int col = 0);
         virtual ~FunctionCallNode() = default;
 
         std::string getName();
+        void setName(std::string name);
+        bool isSpawned();
+        void setSpawned(bool spawned);
+        std::string getTaskType();
+        void setTaskType(std::string type);
         size_t argCount();
         std::vector<std::shared_ptr<Expression>> getArgs();
+        void setArg(size_t index, std::shared_ptr<Expression> arg);
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
@@ -319,6 +388,7 @@ namespace ast
         virtual ~IfNode() = default;
 
         std::shared_ptr<Expression> getCondition();
+        void setCondition(std::shared_ptr<Expression> condition);
         std::shared_ptr<BlockNode> getBlock();
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
@@ -351,11 +421,49 @@ namespace ast
         virtual ~WhileNode() = default;
 
         std::shared_ptr<Expression> getCondition();
+        void setCondition(std::shared_ptr<Expression> condition);
         std::shared_ptr<BlockNode> getBlock();
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
 
+    // Counted loop: "for i in 0..n" over a range of ints, or "for x in values" over the elements of an array
+    class ForNode : public Expression
+    {
+    private:
+        std::string mVariable;
+        std::string mVariableType;  // Set by TypeInferencePass
+        std::shared_ptr<Expression> mStart;  // Start of the range, or the array
+        std::shared_ptr<Expression> mEnd;  // End of the range (exclusive), nullptr for arrays
+        std::shared_ptr<BlockNode> mBlock;
+        bool mParallel;  // "parallel for", the iterations are split across the thread pool
+        std::vector<std::string> mCaptures;  // Set by ParallelForPass, outer variables the body reads
+        std::vector<std::string> mReductions;  // Set by ParallelForPass, outer variables the body sums into
+
+    public:
+        ForNode(std::string variable, std::shared_ptr<Expression> start, std::shared_ptr<Expression> end,
+                std::shared_ptr<BlockNode> block, int line = 0, int col = 0);
+        virtual ~ForNode() = default;
+
+        std::string getVariable() const;
+        std::string getVariableType() const;
+        void setVariableType(std::string type);
+        bool isRange() const;
+        std::shared_ptr<Expression> getStart() const;
+        void setStart(std::shared_ptr<Expression> start);
+        std::shared_ptr<Expression> getEnd() const;
+        void setEnd(std::shared_ptr<Expression> end);
+        std::shared_ptr<BlockNode> getBlock() const;
+        bool isParallel() const;
+        void setParallel(bool parallel);
+        std::vector<std::string> getCaptures() const;
+        void setCaptures(std::vector<std::string> captures);
+        std::vector<std::string> getReductions() const;
+        void setReductions(std::vector<std::string> reductions);
+        virtual ExpressionType getExpressionType() override;
+        virtual void prettyPrint(std::ostream &out, size_t indent) override;
+    };
+
     // Represents a field in a class: "x: public int"
     class Field : public Node
     {
@@ -381,16 +489,26 @@ namespace ast
         std::string mName;
         std::vector<std::shared_ptr<Field>> mFields;
         std::vector<std::shared_ptr<Function>> mMethods;
+        bool mValueType;
+        std::vector<std::string> mTypeParameters;
 
     public:
         ClassDeclaration(std::string name,
                          std::vector<std::shared_ptr<Field>> fields,
-                         std::vector<std::shared_ptr<Function>> methods = {});
+                         std::vector<std::shared_ptr<Function>> methods = {},
+                         bool valueType = false,
+                         std::vector<std::string> typeParameters = {});
         virtual ~ClassDeclaration() = default;
 
         std::string getName() const;
+        // A struct: stored inline and copied on assignment, never allocated or reference counted
+        bool isValueType() const;
+        // "class Box<T>" is a template, "Box<int>" names one of its instantiations
+        bool isGeneric() const;
+        std::vector<std::string> getTypeParameters() const;
         std::vector<std::shared_ptr<Field>> getFields() const;
         std::vector<std::shared_ptr<Function>> getMethods() const;
+        void setMethods(std::vector<std::shared_ptr<Function>> methods);
         size_t getFieldIndex(const std::string& fieldName) const;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
@@ -408,6 +526,7 @@ namespace ast
 
         std::string getTypeName() const;
         std::vector<std::shared_ptr<Expression>> getArgs() const;
+        void setArg(size_t index, std::shared_ptr<Expression> arg);
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
@@ -445,11 +564,33 @@ namespace ast
         std::shared_ptr<Expression> getObject() const;
         std::string getMethodName() const;
         std::vector<std::shared_ptr<Expression>> getArgs() const;
+        void setArg(size_t index, std::shared_ptr<Expression> arg);
         size_t argCount() const;
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
     };
 
+    // Represents array indexing: "values[i]"
+    class IndexNode : public Expression
+    {
+    private:
+        std::shared_ptr<Expression> mArray;
+        std::shared_ptr<Expression> mIndex;
+        bool mBoundsChecked;  // Cleared by BoundsCheckPass when the index is known to be in range
+
+    public:
+        IndexNode(std::shared_ptr<Expression> array, std::shared_ptr<Expression> index, int line = 0, int col = 0);
+        virtual ~IndexNode() = default;
+
+        std::shared_ptr<Expression> getArray() const;
+        std::shared_ptr<Expression> getIndex() const;
+        void setIndex(std::shared_ptr<Expression> index);
+        bool isBoundsChecked() const;
+        void setBoundsChecked(bool checked);
+        virtual ExpressionType getExpressionType() override;
+        virtual void prettyPrint(std::ostream &out, size_t indent) override;
+    };
+
     // Represents a namespace-qualified function call: "Math.add(1, 2)"
     class QualifiedCallNode : public Expression
     {
@@ -467,6 +608,7 @@ namespace ast
         std::string getFunctionName() const;
         std::string getFullyQualifiedName() const;  // Returns "Math.add" or "Math.Advanced.add"
         std::vector<std::shared_ptr<Expression>> getArgs() const;
+        void setArg(size_t index, std::shared_ptr<Expression> arg);
         size_t argCount() const;
         virtual ExpressionType getExpressionType() override;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
@@ -490,6 +632,7 @@ namespace ast
 
         std::string getName() const;
         std::vector<std::shared_ptr<Function>> getFunctions() const;
+        void setFunctions(std::vector<std::shared_ptr<Function>> functions);
         std::vector<std::shared_ptr<ClassDeclaration>> getClasses() const;
         std::vector<std::shared_ptr<NamespaceDeclaration>> getNestedNamespaces() const;
         virtual void prettyPrint(std::ostream &out, size_t indent) override;
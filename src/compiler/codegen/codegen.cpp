@@ -3,11 +3,18 @@
 #include "codegen.h"
 
 #include <string>
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
 #include "logger.h"
 #include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/ADT/SCCIterator.h"
 
 #pragma warning(push)
 #pragma warning(disable:4244)
@@ -17,6 +24,14 @@
 #include "llvm/Transforms/Utils.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LCSSA.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
 #pragma warning(pop)
 
 using namespace std;
@@ -74,6 +89,19 @@ namespace codegen
             printFloatTy, llvm::Function::ExternalLinkage, "silver_print_float", mModule);
         putFunc("print_float", printFloatFunc);
 
+        // float_to_string(double f) -> char* (shortest round-trip form, owned by the caller)
+        llvm::FunctionType *floatToStringTy = llvm::FunctionType::get(i8PtrTy, {doubleTy}, false);
+        llvm::Function *floatToStringFunc = llvm::Function::Create(
+            floatToStringTy, llvm::Function::ExternalLinkage, "silver_float_to_string", mModule);
+        putFunc("float_to_string", floatToStringFunc);
+        mFunctionReturnTypes["silver_float_to_string"] = "string";
+
+        // flush() -> void (write buffered output to stdout)
+        llvm::FunctionType *flushTy = llvm::FunctionType::get(voidTy, false);
+        llvm::Function *flushFunc = llvm::Function::Create(
+            flushTy, llvm::Function::ExternalLinkage, "silver_flush", mModule);
+        putFunc("flush", flushFunc);
+
         // strcmp(const char* a, const char* b) -> int (1 if equal, 0 if not)
         llvm::FunctionType *strcmpTy = llvm::FunctionType::get(i32Ty, {i8PtrTy, i8PtrTy}, false);
         llvm::Function *strcmpFunc = llvm::Function::Create(
@@ -92,13 +120,37 @@ namespace codegen
             releaseTy, llvm::Function::ExternalLinkage, "silver_release", mModule);
         putFunc("release", releaseFunc);
 
-        // alloc(size_t size) -> void* (allocate memory with ref count header)
+        // string_retain(const char* s) -> void (no-op for immortal literals)
+        llvm::FunctionType *stringRetainTy = llvm::FunctionType::get(voidTy, {i8PtrTy}, false);
+        llvm::Function *stringRetainFunc = llvm::Function::Create(
+            stringRetainTy, llvm::Function::ExternalLinkage, "silver_string_retain", mModule);
+        putFunc("string_retain", stringRetainFunc);
+
+        // string_release(const char* s) -> void (frees heap strings at zero)
+        llvm::FunctionType *stringReleaseTy = llvm::FunctionType::get(voidTy, {i8PtrTy}, false);
+        llvm::Function *stringReleaseFunc = llvm::Function::Create(
+            stringReleaseTy, llvm::Function::ExternalLinkage, "silver_string_release", mModule);
+        putFunc("string_release", stringReleaseFunc);
+
+        // alloc(size_t size, SilverTypeInfo* type) -> void* (allocate an object, size includes the ref count header)
         llvm::Type *i64Ty = llvm::Type::getInt64Ty(mContext);
-        llvm::FunctionType *allocTy = llvm::FunctionType::get(i8PtrTy, {i64Ty}, false);
+        llvm::FunctionType *allocTy = llvm::FunctionType::get(i8PtrTy, {i64Ty, i8PtrTy}, false);
         llvm::Function *allocFunc = llvm::Function::Create(
             allocTy, llvm::Function::ExternalLinkage, "silver_alloc", mModule);
         putFunc("alloc", allocFunc);
 
+        // array_new(int length, size_t elementSize, SilverTypeInfo* type) -> void* (header followed by zeroed elements)
+        llvm::FunctionType *arrayNewTy = llvm::FunctionType::get(i8PtrTy, {i32Ty, i64Ty, i8PtrTy}, false);
+        llvm::Function *arrayNewFunc = llvm::Function::Create(
+            arrayNewTy, llvm::Function::ExternalLinkage, "silver_array_new", mModule);
+        putFunc("array_new", arrayNewFunc);
+
+        // array_bounds_fail(int index, int length) -> never returns (reports the access and aborts)
+        llvm::FunctionType *boundsFailTy = llvm::FunctionType::get(voidTy, {i32Ty, i32Ty}, false);
+        llvm::Function *boundsFailFunc = llvm::Function::Create(
+            boundsFailTy, llvm::Function::ExternalLinkage, "silver_array_bounds_fail", mModule);
+        putFunc("array_bounds_fail", boundsFailFunc);
+
         // refcount(void* ptr) -> int (get current ref count for debugging/testing)
         llvm::FunctionType *refcountTy = llvm::FunctionType::get(i32Ty, {i8PtrTy}, false);
         llvm::Function *refcountFunc = llvm::Function::Create(
@@ -116,6 +168,125 @@ namespace codegen
         llvm::Function *stringBytesFunc = llvm::Function::Create(
             stringBytesTy, llvm::Function::ExternalLinkage, "silver_string_bytes", mModule);
         putFunc("string_bytes", stringBytesFunc);
+
+        // utf8_valid(const char* s) -> int (1 if the string is well formed UTF-8)
+        llvm::FunctionType *utf8ValidTy = llvm::FunctionType::get(i32Ty, {i8PtrTy}, false);
+        llvm::Function *utf8ValidFunc = llvm::Function::Create(
+            utf8ValidTy, llvm::Function::ExternalLinkage, "silver_utf8_valid", mModule);
+        putFunc("utf8_valid", utf8ValidFunc);
+
+        // map_probe(u8* ctrl, int base, int tag, int from) -> int (next slot in a hash map group whose control byte matches)
+        llvm::FunctionType *mapProbeTy = llvm::FunctionType::get(i32Ty, {i8PtrTy, i32Ty, i32Ty, i32Ty}, false);
+        llvm::Function *mapProbeFunc = llvm::Function::Create(
+            mapProbeTy, llvm::Function::ExternalLinkage, "silver_map_probe", mModule);
+        putFunc("map_probe", mapProbeFunc);
+
+        // task_new(size_t frameSize, void (*run)(void*), void (*drop)(void*)) -> void* (a task with a zeroed frame, not yet scheduled)
+        llvm::FunctionType *taskNewTy = llvm::FunctionType::get(i8PtrTy, {i64Ty, i8PtrTy, i8PtrTy}, false);
+        llvm::Function *taskNewFunc = llvm::Function::Create(
+            taskNewTy, llvm::Function::ExternalLinkage, "silver_task_new", mModule);
+        putFunc("task_new", taskNewFunc);
+
+        // task_frame(void* task) -> void* (where the result and the arguments go)
+        llvm::FunctionType *taskFrameTy = llvm::FunctionType::get(i8PtrTy, {i8PtrTy}, false);
+        llvm::Function *taskFrameFunc = llvm::Function::Create(
+            taskFrameTy, llvm::Function::ExternalLinkage, "silver_task_frame", mModule);
+        putFunc("task_frame", taskFrameFunc);
+
+        // task_spawn(void* task) -> void (queue the task on the thread pool)
+        llvm::FunctionType *taskSpawnTy = llvm::FunctionType::get(voidTy, {i8PtrTy}, false);
+        llvm::Function *taskSpawnFunc = llvm::Function::Create(
+            taskSpawnTy, llvm::Function::ExternalLinkage, "silver_task_spawn", mModule);
+        putFunc("task_spawn", taskSpawnFunc);
+
+        // task_join(void* task) -> void* (wait for the task to finish, returns its frame)
+        llvm::FunctionType *taskJoinTy = llvm::FunctionType::get(i8PtrTy, {i8PtrTy}, false);
+        llvm::Function *taskJoinFunc = llvm::Function::Create(
+            taskJoinTy, llvm::Function::ExternalLinkage, "silver_task_join", mModule);
+        putFunc("task_join", taskJoinFunc);
+
+        // parallel_for(int start, int end, void* body, void* context) -> void (run body(context, from, to)
+        // over pieces of [start, end) on the thread pool, returns when all of them are done)
+        llvm::FunctionType *parallelForTy = llvm::FunctionType::get(voidTy, {i32Ty, i32Ty, i8PtrTy, i8PtrTy}, false);
+        llvm::Function *parallelForFunc = llvm::Function::Create(
+            parallelForTy, llvm::Function::ExternalLinkage, "silver_parallel_for", mModule);
+        putFunc("parallel_for", parallelForFunc);
+
+        addRuntimeAttributes();
+    }
+
+    void CodeGen::addRuntimeAttributes()
+    {
+        // Nothing in the runtime throws. The rest returns unless noted below, the allocators abort
+        // when memory runs out (array_new also on a negative length), so they can't promise to.
+        for (auto &entry : mFunctions)
+        {
+            entry.second->setDoesNotThrow();
+            entry.second->setWillReturn();
+        }
+        for (const char *name : {"alloc", "array_new", "float_to_string", "task_new"})
+        {
+            getFunc(name)->removeFnAttr(llvm::Attribute::WillReturn);
+        }
+
+        // Fresh memory, the runtime aborts instead of returning null
+        llvm::Function *allocFunc = getFunc("alloc");
+        allocFunc->addRetAttr(llvm::Attribute::NoAlias);
+        allocFunc->addRetAttr(llvm::Attribute::NonNull);
+        allocFunc->addFnAttr(llvm::Attribute::getWithAllocSizeArgs(mContext, 0, {}));
+        llvm::Function *arrayNewFunc = getFunc("array_new");
+        arrayNewFunc->addRetAttr(llvm::Attribute::NoAlias);
+        arrayNewFunc->addRetAttr(llvm::Attribute::NonNull);
+        llvm::Function *floatToStringFunc = getFunc("float_to_string");
+        floatToStringFunc->addRetAttr(llvm::Attribute::NoAlias);
+        floatToStringFunc->addRetAttr(llvm::Attribute::NonNull);
+        floatToStringFunc->setOnlyAccessesInaccessibleMemory();
+
+        // Pure reads of their arguments (a string's header sits in front of the pointer)
+        for (const char *name : {"strcmp", "strlen_utf8", "string_bytes", "refcount", "map_probe"})
+        {
+            llvm::Function *func = getFunc(name);
+            func->setOnlyReadsMemory();
+            func->setOnlyAccessesArgMemory();
+            for (unsigned i = 0; i < func->arg_size(); ++i)
+            {
+                func->addParamAttr(i, llvm::Attribute::NoCapture);
+            }
+        }
+
+        // Output goes to a buffer the program can't see. utf8_valid caches the kernel it picked.
+        for (const char *name : {"print_string", "print_int", "print_float", "utf8_valid"})
+        {
+            getFunc(name)->setOnlyAccessesInaccessibleMemOrArgMem();
+        }
+        for (const char *name : {"print_string", "utf8_valid"})
+        {
+            getFunc(name)->addParamAttr(0, llvm::Attribute::ReadOnly);
+            getFunc(name)->addParamAttr(0, llvm::Attribute::NoCapture);
+        }
+        getFunc("flush")->setOnlyAccessesInaccessibleMemory();
+
+        // Failed bounds checks end the program, the paths leading there are never hot
+        llvm::Function *boundsFailFunc = getFunc("array_bounds_fail");
+        boundsFailFunc->removeFnAttr(llvm::Attribute::WillReturn);
+        boundsFailFunc->setDoesNotReturn();
+        boundsFailFunc->addFnAttr(llvm::Attribute::Cold);
+        boundsFailFunc->setOnlyAccessesInaccessibleMemory();
+
+        // The frame sits at a fixed offset in the task. A join waits for code that may never finish,
+        // and the task it waits for can write to anything.
+        getFunc("task_new")->addRetAttr(llvm::Attribute::NonNull);
+        getFunc("task_frame")->setDoesNotAccessMemory();
+        getFunc("task_frame")->addRetAttr(llvm::Attribute::NonNull);
+        getFunc("task_join")->removeFnAttr(llvm::Attribute::WillReturn);
+        getFunc("parallel_for")->removeFnAttr(llvm::Attribute::WillReturn);
+
+        // Reference counting only touches the header (and the allocation statistics)
+        getFunc("string_retain")->setOnlyAccessesArgMemory();
+        for (const char *name : {"retain", "release", "string_retain", "string_release"})
+        {
+            getFunc(name)->addParamAttr(0, llvm::Attribute::NoCapture);
+        }
     }
 
     void CodeGen::reportFatalError(string message)
@@ -162,199 +333,1442 @@ namespace codegen
         auto it = mFunctions.find(name);
         if (it == mFunctions.end())
         {
-            return nullptr;
+            return nullptr;
+        }
+
+        return (*it).second;
+    }
+
+    unsigned CodeGen::getFieldSlot(const string& className, size_t fieldIndex)
+    {
+        // Fields are reordered for packing, map the declaration index to the struct element
+        return mFieldSlots[className][fieldIndex];
+    }
+
+    llvm::MDNode *CodeGen::getTbaaType(const string& typeName)
+    {
+        // Field types are disjoint: an int store can't change a float or a string pointer.
+        // "object header" covers the type descriptor and ref count the runtime manages.
+        auto it = mTbaaTypes.find(typeName);
+        if (it != mTbaaTypes.end())
+        {
+            return it->second;
+        }
+
+        llvm::MDBuilder mdBuilder(mContext);
+        llvm::MDNode *node;
+        if (typeName == "root")
+        {
+            node = mdBuilder.createTBAARoot("Silver TBAA");
+        }
+        else
+        {
+            node = mdBuilder.createTBAAScalarTypeNode(typeName, getTbaaType("root"));
+        }
+        mTbaaTypes[typeName] = node;
+        return node;
+    }
+
+    void CodeGen::generateTbaaTypes(const string& className)
+    {
+        // A struct type node per class, so that the same field of two objects may alias but
+        // different fields never do, even when the object pointers can't be told apart.
+        // Struct values are copied whole and their fields reached through any enclosing object,
+        // so their accesses stay untagged, and so do class fields holding one.
+        llvm::MDBuilder mdBuilder(mContext);
+        const llvm::StructLayout *layout = mModule->getDataLayout().getStructLayout(mStructTypes[className]);
+        vector<shared_ptr<Field>> fields = mClasses[className]->getFields();
+        if (mClasses[className]->isValueType())
+        {
+            mFieldAccessTags[className] = vector<llvm::MDNode *>(fields.size(), nullptr);
+            return;
+        }
+
+        vector<pair<llvm::MDNode *, uint64_t>> members = {
+            {getTbaaType("object header"), layout->getElementOffset(0)},
+            {getTbaaType("object header"), layout->getElementOffset(1)}};
+        vector<size_t> bySlot(fields.size());
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            bySlot[getFieldSlot(className, i) - 2] = i;
+        }
+        for (size_t i : bySlot)
+        {
+            if (!isValueType(fields[i]->getType()))
+            {
+                members.push_back({getTbaaType(fields[i]->getType()), layout->getElementOffset(getFieldSlot(className, i))});
+            }
+        }
+        llvm::MDNode *structNode = mdBuilder.createTBAAStructTypeNode(className, members);
+
+        vector<llvm::MDNode *> tags;
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            tags.push_back(isValueType(fields[i]->getType()) ? nullptr : mdBuilder.createTBAAStructTagNode(structNode,
+                getTbaaType(fields[i]->getType()), layout->getElementOffset(getFieldSlot(className, i))));
+        }
+        mFieldAccessTags[className] = tags;
+    }
+
+    void CodeGen::tagFieldAccess(llvm::Instruction *inst, const string& className, size_t fieldIndex)
+    {
+        inst->setMetadata(llvm::LLVMContext::MD_tbaa, mFieldAccessTags[className][fieldIndex]);
+    }
+
+    llvm::MDNode *CodeGen::getElementAccessTag(const string& elementType)
+    {
+        // Array elements aren't part of a struct, only their type tells them apart. Struct elements
+        // are untagged like struct fields.
+        if (isValueType(elementType))
+        {
+            return nullptr;
+        }
+        llvm::MDNode *type = getTbaaType(elementType);
+        return llvm::MDBuilder(mContext).createTBAAStructTagNode(type, type, 0);
+    }
+
+    void CodeGen::markInvariantFieldLoads()
+    {
+        // A field that is only ever written by alloc keeps its value for the object's lifetime, so
+        // its loads can be shared across any store or call. The memory of a freed object is reused
+        // by later allocations with other values, which rules out !invariant.load: it promises the
+        // same value at the address for the whole run. !invariant.group only promises it for
+        // accesses through the same pointer, and a reallocated object comes back as a new pointer.
+        llvm::MDNode *empty = llvm::MDNode::get(mContext, {});
+        set<llvm::MDNode *> invariantTags;
+        for (auto &classTags : mFieldAccessTags)
+        {
+            for (llvm::MDNode *tag : classTags.second)
+            {
+                if (tag != nullptr && mAssignedFields.count(tag) == 0)
+                {
+                    invariantTags.insert(tag);
+                }
+            }
+        }
+
+        for (llvm::Function &func : *mModule)
+        {
+            for (llvm::BasicBlock &block : func)
+            {
+                for (llvm::Instruction &inst : block)
+                {
+                    // Includes the stores of alloc, which give the group its value
+                    if ((llvm::isa<llvm::LoadInst>(inst) || llvm::isa<llvm::StoreInst>(inst))
+                        && invariantTags.count(inst.getMetadata(llvm::LLVMContext::MD_tbaa)) > 0)
+                    {
+                        inst.setMetadata(llvm::LLVMContext::MD_invariant_group, empty);
+                    }
+                }
+            }
+        }
+    }
+
+    void CodeGen::alignVectorAccesses(llvm::Function &func)
+    {
+        // Objects and arrays are only 16-byte aligned by the runtime, so a wider vector in a field
+        // or an element can't be loaded or stored with its natural alignment. Locals keep theirs.
+        const llvm::Align heapAlign(16);
+        for (llvm::BasicBlock &block : func)
+        {
+            for (llvm::Instruction &inst : block)
+            {
+                if (llvm::LoadInst *load = llvm::dyn_cast<llvm::LoadInst>(&inst))
+                {
+                    if (load->getType()->isVectorTy() && !llvm::isa<llvm::AllocaInst>(load->getPointerOperand())
+                        && load->getAlign() > heapAlign)
+                    {
+                        load->setAlignment(heapAlign);
+                    }
+                }
+                else if (llvm::StoreInst *store = llvm::dyn_cast<llvm::StoreInst>(&inst))
+                {
+                    if (store->getValueOperand()->getType()->isVectorTy() && !llvm::isa<llvm::AllocaInst>(store->getPointerOperand())
+                        && store->getAlign() > heapAlign)
+                    {
+                        store->setAlignment(heapAlign);
+                    }
+                }
+            }
+        }
+    }
+
+    // "[int]" -> "int", empty for anything that isn't an array type
+    static string arrayElementType(const string& typeName)
+    {
+        if (typeName.size() < 3 || typeName.front() != '[' || typeName.back() != ']')
+        {
+            return "";
+        }
+        return typeName.substr(1, typeName.size() - 2);
+    }
+
+    // "f64x4" -> "f64" with 4 lanes, empty for anything that isn't a vector type
+    static string vectorLaneType(const string& typeName, unsigned &lanes)
+    {
+        if (typeName.size() < 5 || typeName[3] != 'x')
+        {
+            return "";
+        }
+        string lane = typeName.substr(0, 3);
+        string count = typeName.substr(4);
+        if ((lane != "i32" && lane != "f32" && lane != "f64") || (count != "2" && count != "4" && count != "8" && count != "16"))
+        {
+            return "";
+        }
+        lanes = static_cast<unsigned>(stoul(count));
+        return lane;
+    }
+
+    bool CodeGen::isRefCountedType(const string& typeName)
+    {
+        // User-defined class types, arrays, tasks and strings are ref-counted (string literals are immortal)
+        return typeName == "string" || !arrayElementType(typeName).empty() || !taskResultType(typeName).empty()
+            || (mStructTypes.find(typeName) != mStructTypes.end() && !isValueType(typeName));
+    }
+
+    bool CodeGen::isValueType(const string& typeName)
+    {
+        auto it = mClasses.find(typeName);
+        return it != mClasses.end() && it->second->isValueType();
+    }
+
+    bool CodeGen::isVectorType(const string& typeName)
+    {
+        unsigned lanes;
+        return !vectorLaneType(typeName, lanes).empty();
+    }
+
+    void CodeGen::generateRetain(llvm::Value* ptr, const string& typeName)
+    {
+        llvm::Function* retainFunc = getFunc(typeName == "string" ? "string_retain" : "retain");
+        if (retainFunc)
+        {
+            // Cast to i8* if needed
+            llvm::Value* castedPtr = mBuilder.CreateBitCast(ptr,
+                llvm::PointerType::get(mContext, 0));
+            mBuilder.CreateCall(retainFunc, {castedPtr});
+        }
+    }
+
+    void CodeGen::generateRelease(llvm::Value* ptr, const string& typeName)
+    {
+        llvm::Function* releaseFunc = getFunc(typeName == "string" ? "string_release" : "release");
+        if (releaseFunc)
+        {
+            // Cast to i8* if needed
+            llvm::Value* castedPtr = mBuilder.CreateBitCast(ptr,
+                llvm::PointerType::get(mContext, 0));
+            mBuilder.CreateCall(releaseFunc, {castedPtr});
+        }
+    }
+
+    void CodeGen::enterRefCountScope()
+    {
+        mRefCountedVarsStack.push_back(vector<string>());
+    }
+
+    void CodeGen::leaveRefCountScope()
+    {
+        // Only generate release calls if the current block doesn't already have a terminator
+        // (e.g., a return statement already handled releases via releaseAllScopes)
+        llvm::BasicBlock *currentBlock = mBuilder.GetInsertBlock();
+        if (currentBlock && !currentBlock->getTerminator())
+        {
+            releaseAllInCurrentScope();
+        }
+        mRefCountedVarsStack.pop_back();
+    }
+
+    void CodeGen::releaseAllInCurrentScope()
+    {
+        if (mRefCountedVarsStack.empty()) return;
+
+        // Make sure we have a valid insert point
+        llvm::BasicBlock* block = mBuilder.GetInsertBlock();
+        if (!block) return;
+
+        vector<string>& currentScope = mRefCountedVarsStack.back();
+        for (const string& varName : currentScope)
+        {
+            llvm::AllocaInst* inst = mTable.get(varName);
+            if (inst)
+            {
+                // Load the pointer and release it
+                llvm::Value* ptr = mBuilder.CreateLoad(inst->getAllocatedType(), inst);
+                generateRelease(ptr, mVariableTypes.get(varName));
+            }
+        }
+    }
+
+    void CodeGen::releaseAllScopes(const string& movedVar)
+    {
+        // Release all ref-counted variables in all active scopes (for return statements),
+        // except a variable whose value is being returned to the caller
+        llvm::BasicBlock* block = mBuilder.GetInsertBlock();
+        if (!block) return;
+
+        for (auto it = mRefCountedVarsStack.rbegin(); it != mRefCountedVarsStack.rend(); ++it)
+        {
+            for (const string& varName : *it)
+            {
+                if (varName == movedVar)
+                {
+                    continue;
+                }
+
+                llvm::AllocaInst* inst = mTable.get(varName);
+                if (inst)
+                {
+                    llvm::Value* ptr = mBuilder.CreateLoad(inst->getAllocatedType(), inst);
+                    generateRelease(ptr, mVariableTypes.get(varName));
+                }
+            }
+        }
+    }
+
+    void CodeGen::generateTailCall(llvm::CallInst *call)
+    {
+        // Scope releases were emitted after the call. When no argument is a pointer the callee can't
+        // be using anything they free, so the call moves after them and nothing is left pending.
+        llvm::BasicBlock *block = call->getParent();
+        if (&block->back() != call)
+        {
+            for (llvm::Value *arg : call->args())
+            {
+                if (arg->getType()->isPointerTy())
+                {
+                    return;
+                }
+            }
+            call->moveAfter(&block->back());
+        }
+
+        // A struct method gets the address of the struct as this, which is a local or a temporary
+        // of the caller when the struct isn't in an object or array. The callee reads it after the
+        // caller's frame would be gone, so such a call stays a plain call.
+        for (llvm::Value *arg : call->args())
+        {
+            if (arg->getType()->isPointerTy() && llvm::isa<llvm::AllocaInst>(llvm::getUnderlyingObject(arg)))
+            {
+                return;
+            }
+        }
+
+        // Any other call can be a tail call. When the signatures match (self and mutual recursion)
+        // LLVM guarantees it with musttail.
+        llvm::Function *callee = call->getCalledFunction();
+        bool sameSignature = callee != nullptr && callee->getFunctionType() == block->getParent()->getFunctionType();
+        call->setTailCallKind(sameSignature ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+        LOG("Codegen: %s call to %s\n", sameSignature ? "Guaranteed tail" : "Tail",
+            callee != nullptr ? callee->getName().str().c_str() : "<indirect>");
+    }
+
+    int CodeGen::findRefCountScope(const string& varName)
+    {
+        for (size_t i = mRefCountedVarsStack.size(); i > 0; --i)
+        {
+            const vector<string>& scope = mRefCountedVarsStack[i - 1];
+            if (find(scope.begin(), scope.end(), varName) != scope.end())
+            {
+                return static_cast<int>(i - 1);
+            }
+        }
+
+        return -1;
+    }
+
+    bool CodeGen::expressionReferences(shared_ptr<Expression> expr, const string& varName, bool assignmentsOnly)
+    {
+        if (expr == nullptr)
+        {
+            return false;
+        }
+
+        switch (expr->getExpressionType())
+        {
+        case ExpressionType::IntegerLiteral:
+        case ExpressionType::FloatLiteral:
+        case ExpressionType::StringLiteral:
+        case ExpressionType::Empty:
+            return false;
+        case ExpressionType::Identifier:
+            return !assignmentsOnly && dynamic_pointer_cast<IdentifierNode>(expr)->getValue() == varName;
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> ben = dynamic_pointer_cast<BinaryExpressionNode>(expr);
+            shared_ptr<IdentifierNode> target = dynamic_pointer_cast<IdentifierNode>(ben->getLhs());
+            if (assignmentsOnly && ben->getOperator() == "=" && target != nullptr && target->getValue() == varName)
+            {
+                return true;
+            }
+            return expressionReferences(ben->getLhs(), varName, assignmentsOnly) || expressionReferences(ben->getRhs(), varName, assignmentsOnly);
+        }
+        case ExpressionType::Declaration:
+            return expressionReferences(dynamic_pointer_cast<DeclarationNode>(expr)->getExpression(), varName, assignmentsOnly);
+        case ExpressionType::Return:
+            return expressionReferences(dynamic_pointer_cast<ReturnNode>(expr)->getExpression(), varName, assignmentsOnly);
+        case ExpressionType::Cast:
+            return expressionReferences(dynamic_pointer_cast<CastNode>(expr)->getExpression(), varName, assignmentsOnly);
+        case ExpressionType::FunctionCall:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<FunctionCallNode>(expr)->getArgs())
+            {
+                if (expressionReferences(arg, varName, assignmentsOnly)) return true;
+            }
+            return false;
+        }
+        case ExpressionType::QualifiedCall:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<QualifiedCallNode>(expr)->getArgs())
+            {
+                if (expressionReferences(arg, varName, assignmentsOnly)) return true;
+            }
+            return false;
+        }
+        case ExpressionType::Alloc:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<AllocNode>(expr)->getArgs())
+            {
+                if (expressionReferences(arg, varName, assignmentsOnly)) return true;
+            }
+            return false;
+        }
+        case ExpressionType::MemberAccess:
+            return expressionReferences(dynamic_pointer_cast<MemberAccessNode>(expr)->getObject(), varName, assignmentsOnly);
+        case ExpressionType::Index:
+        {
+            // Storing to an element doesn't change which array the variable holds
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expr);
+            return expressionReferences(index->getArray(), varName, assignmentsOnly)
+                || expressionReferences(index->getIndex(), varName, assignmentsOnly);
+        }
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expr);
+            if (expressionReferences(call->getObject(), varName, assignmentsOnly)) return true;
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                if (expressionReferences(arg, varName, assignmentsOnly)) return true;
+            }
+            return false;
+        }
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expr);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                if (expressionReferences(ifNode->getCondition(), varName, assignmentsOnly)
+                    || expressionReferences(ifNode->getBlock(), varName, assignmentsOnly))
+                {
+                    return true;
+                }
+            }
+            return expressionReferences(ifBlock->getElseBlock(), varName, assignmentsOnly);
+        }
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expr);
+            return expressionReferences(whileNode->getCondition(), varName, assignmentsOnly)
+                || expressionReferences(whileNode->getBlock(), varName, assignmentsOnly);
+        }
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expr);
+            return expressionReferences(forNode->getStart(), varName, assignmentsOnly)
+                || expressionReferences(forNode->getEnd(), varName, assignmentsOnly)
+                || expressionReferences(forNode->getBlock(), varName, assignmentsOnly);
+        }
+        case ExpressionType::Block:
+        {
+            for (shared_ptr<Expression> child : dynamic_pointer_cast<BlockNode>(expr)->getExpressions())
+            {
+                if (expressionReferences(child, varName, assignmentsOnly)) return true;
+            }
+            return false;
+        }
+        default:
+            // Be conservative for anything we don't know how to walk
+            return true;
+        }
+    }
+
+    bool CodeGen::isLastUse(const string& varName, size_t declScope)
+    {
+        // Walk outwards from the statement being generated to the block that declared the variable.
+        // The current use is the last one if no later statement in any of those blocks mentions it.
+        for (auto it = mStatementCursors.rbegin(); it != mStatementCursors.rend(); ++it)
+        {
+            if (it->statements == nullptr)
+            {
+                // The variable outlives this loop body, so the next iteration may read it again
+                return false;
+            }
+
+            for (size_t i = it->index + 1; i < it->statements->size(); ++i)
+            {
+                if (expressionReferences((*it->statements)[i], varName))
+                {
+                    return false;
+                }
+            }
+
+            if (it->scopeDepth == declScope + 1)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    llvm::Value *CodeGen::generateOwnedValue(shared_ptr<Expression> expr, const string& typeName)
+    {
+        // Produces a value the receiver owns (+1). Allocations and calls already return owned
+        // references; reading a variable either moves out of it at its last use or retains.
+        if (!isRefCountedType(typeName))
+        {
+            return generateExpression(expr);
+        }
+
+        if (expr->getExpressionType() != ExpressionType::Identifier)
+        {
+            llvm::Value *value = generateExpression(expr);
+            if (expr->getExpressionType() != ExpressionType::StringLiteral && getOwnedTemporaryType(value).empty())
+            {
+                // Borrowed from somewhere else, e.g. a field
+                generateRetain(value, typeName);
+            }
+            return value;
+        }
+
+        shared_ptr<IdentifierNode> ident = dynamic_pointer_cast<IdentifierNode>(expr);
+        llvm::Value *value = generateExpression(expr);
+        int declScope = findRefCountScope(ident->getValue());
+        if (declScope >= 0 && isLastUse(ident->getValue(), declScope))
+        {
+            if (declScope == static_cast<int>(mRefCountedVarsStack.size()) - 1)
+            {
+                // Moved in the declaring block, so there is nothing left to release at scope exit
+                vector<string>& scope = mRefCountedVarsStack[declScope];
+                scope.erase(find(scope.begin(), scope.end(), ident->getValue()));
+            }
+            else
+            {
+                // Moved on a conditional path, clear the variable so the scope exit release is a no-op
+                mBuilder.CreateStore(llvm::ConstantPointerNull::get(llvm::PointerType::get(mContext, 0)),
+                    mTable.get(ident->getValue()));
+            }
+
+            LOG("Codegen: Moving ref-counted variable %s at its last use\n", ident->getValue().c_str());
+            return value;
+        }
+
+        generateRetain(value, typeName);
+        return value;
+    }
+
+    string CodeGen::getOwnedTemporaryType(llvm::Value *value)
+    {
+        // Allocations and calls to functions returning an object or string hand the caller a +1
+        // reference. Returns the type of such a value, or an empty string for anything else.
+        llvm::CallInst *call = llvm::dyn_cast_or_null<llvm::CallInst>(value);
+        if (call == nullptr || call->getCalledFunction() == nullptr)
+        {
+            return "";
+        }
+
+        llvm::Function *callee = call->getCalledFunction();
+        if (callee == getFunc("alloc"))
+        {
+            for (auto &typeInfo : mTypeInfos)
+            {
+                if (typeInfo.second == call->getArgOperand(1))
+                {
+                    return typeInfo.first;
+                }
+            }
+            return "";
+        }
+        if (callee == getFunc("task_new"))
+        {
+            auto it = mTaskTypes.find(llvm::dyn_cast<llvm::Function>(call->getArgOperand(1)));
+            return it == mTaskTypes.end() ? "" : it->second;
+        }
+        if (callee == getFunc("array_new"))
+        {
+            for (auto &typeInfo : mTypeInfos)
+            {
+                if (typeInfo.second == call->getArgOperand(2))
+                {
+                    return typeInfo.first;
+                }
+            }
+            return "";
+        }
+
+        auto it = mFunctionReturnTypes.find(callee->getName().str());
+        if (it == mFunctionReturnTypes.end() || !isRefCountedType(it->second))
+        {
+            return "";
+        }
+        return it->second;
+    }
+
+    void CodeGen::releaseOwnedTemporaries(const vector<llvm::Value *> &args)
+    {
+        // Arguments are borrowed by the callee, so temporaries created for the call die after it
+        for (llvm::Value *arg : args)
+        {
+            string typeName = getOwnedTemporaryType(arg);
+            if (!typeName.empty())
+            {
+                generateRelease(arg, typeName);
+            }
+        }
+    }
+
+    void CodeGen::retainReassignedParameters(shared_ptr<Function> function)
+    {
+        // Parameters are borrowed from the caller. One that the body assigns to becomes an owned
+        // local instead: retain the incoming value so the assignment can release it like any other.
+        for (shared_ptr<Argument> arg : function->getArguments())
+        {
+            if (isRefCountedType(arg->getType()) && expressionReferences(function->getBlock(), arg->getName(), true))
+            {
+                llvm::AllocaInst *inst = mTable.get(arg->getName());
+                generateRetain(mBuilder.CreateLoad(inst->getAllocatedType(), inst), arg->getType());
+                mRefCountedVarsStack.back().push_back(arg->getName());
+                LOG("Codegen: Parameter %s is reassigned, retaining it\n", arg->getName().c_str());
+            }
+        }
+    }
+
+    llvm::Constant *CodeGen::generateStringLiteral(const string& value)
+    {
+        // Strings point at null terminated bytes preceded by a header, this must match
+        // SilverStringHeader in the runtime: { refCount, byteLength, codepoints, hash }.
+        // Literals are immortal constants, so their header is filled in here. Each distinct literal
+        // is emitted once per module, which lets equality on literals compare pointers.
+        auto interned = mStringLiterals.find(value);
+        if (interned != mStringLiterals.end())
+        {
+            return interned->second;
+        }
+
+        uint32_t hash = 2166136261u;  // FNV-1a, same as the runtime
+        int32_t codepoints = 0;
+        for (unsigned char c : value)
+        {
+            hash ^= c;
+            hash *= 16777619u;
+            if ((c & 0xC0) != 0x80)
+            {
+                codepoints++;
+            }
+        }
+
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::Constant *bytes = llvm::ConstantDataArray::getString(mContext, value, true);
+        vector<llvm::Type *> fieldTypes = {int32Ty, int32Ty, int32Ty, int32Ty, bytes->getType()};
+        llvm::StructType *literalType = llvm::StructType::get(mContext, fieldTypes);
+        llvm::Constant *literal = llvm::ConstantStruct::get(literalType, {
+            llvm::ConstantInt::get(int32Ty, -1, true),  // SILVER_STRING_IMMORTAL
+            llvm::ConstantInt::get(int32Ty, value.size()),
+            llvm::ConstantInt::get(int32Ty, codepoints),
+            llvm::ConstantInt::get(int32Ty, hash),
+            bytes});
+
+        llvm::GlobalVariable *global = new llvm::GlobalVariable(*mModule, literalType, true,
+            llvm::GlobalValue::PrivateLinkage, literal, "str");
+        global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        global->setAlignment(llvm::Align(8));
+
+        // The string value points at the bytes, after the header
+        llvm::Constant *indices[] = {llvm::ConstantInt::get(int32Ty, 0), llvm::ConstantInt::get(int32Ty, 4)};
+        llvm::Constant *str = llvm::ConstantExpr::getInBoundsGetElementPtr(literalType, global, indices);
+        mStringLiterals[value] = str;
+        mInternedStrings.insert(str);
+        return str;
+    }
+
+    llvm::Value *CodeGen::generateStringEquals(llvm::Value *lhs, llvm::Value *rhs)
+    {
+        // Interned literals are equal exactly when they are the same constant, so comparisons
+        // between them fold. Otherwise identical pointers skip the call into the runtime.
+        llvm::Type *int1Ty = llvm::Type::getInt1Ty(mContext);
+        if (lhs == rhs)
+        {
+            LOG("Codegen: Folding comparison of a string with itself\n");
+            return llvm::ConstantInt::getTrue(int1Ty);
+        }
+        if (mInternedStrings.count(lhs) > 0 && mInternedStrings.count(rhs) > 0)
+        {
+            LOG("Codegen: Folding comparison of two different string literals\n");
+            return llvm::ConstantInt::getFalse(int1Ty);
+        }
+
+        llvm::Function *strcmpFunc = getFunc("strcmp");
+        if (strcmpFunc == nullptr)
+        {
+            reportFatalError("strcmp function not found");
+            return nullptr;
+        }
+
+        llvm::BasicBlock *startBlock = mBuilder.GetInsertBlock();
+        llvm::Function *function = startBlock->getParent();
+        llvm::BasicBlock *compareBlock = llvm::BasicBlock::Create(mContext, "strcmp call", function);
+        llvm::BasicBlock *end = llvm::BasicBlock::Create(mContext, "strcmp end", function);
+
+        llvm::Value *identical = mBuilder.CreateICmpEQ(lhs, rhs, "same_string");
+        mBuilder.CreateCondBr(identical, end, compareBlock);
+
+        // Call strcmp(lhs, rhs) - returns i32 (1 if equal, 0 if not)
+        mBuilder.SetInsertPoint(compareBlock);
+        llvm::Value *intResult = mBuilder.CreateCall(strcmpFunc, {lhs, rhs}, "strcmp_result");
+        llvm::Value *equal = mBuilder.CreateICmpNE(intResult,
+            llvm::ConstantInt::get(llvm::Type::getInt32Ty(mContext), 0), "streq");
+        mBuilder.CreateBr(end);
+
+        mBuilder.SetInsertPoint(end);
+        llvm::PHINode *phi = mBuilder.CreatePHI(int1Ty, 2, "streq");
+        phi->addIncoming(llvm::ConstantInt::getTrue(int1Ty), startBlock);
+        phi->addIncoming(equal, compareBlock);
+        return phi;
+    }
+
+    llvm::Type *CodeGen::stringToType(string str)
+    {
+        if (isIntegerType(str))
+        {
+            // Signedness is in the operations, not the type
+            return llvm::Type::getIntNTy(mContext, numericTypeBits(str));
+        }
+        else if (str == "float")
+        {
+            return llvm::Type::getDoubleTy(mContext);
+        }
+        else if (str == "f32")
+        {
+            return llvm::Type::getFloatTy(mContext);
+        }
+        else if (str == "string")
+        {
+            return llvm::PointerType::get(mContext, 0);
+        }
+        else if (str == "void" || str.empty())
+        {
+            return llvm::Type::getVoidTy(mContext);
+        }
+        else if (!arrayElementType(str).empty())
+        {
+            // Arrays are pointers to their header, the element type only has to exist
+            if (stringToType(arrayElementType(str))->isVoidTy())
+            {
+                reportFatalError("Unknown type: " + str);
+            }
+            return llvm::PointerType::get(mContext, 0);
+        }
+        else if (!taskResultType(str).empty())
+        {
+            // Tasks are pointers to the runtime's task, which holds the result once it is done
+            stringToType(taskResultType(str));
+            return llvm::PointerType::get(mContext, 0);
+        }
+        else if (isVectorType(str))
+        {
+            // Vectors are plain values, like ints and floats
+            unsigned lanes;
+            string lane = vectorLaneType(str, lanes);
+            llvm::Type *laneType = lane == "i32" ? llvm::Type::getInt32Ty(mContext)
+                : lane == "f32" ? llvm::Type::getFloatTy(mContext) : llvm::Type::getDoubleTy(mContext);
+            return llvm::FixedVectorType::get(laneType, lanes);
+        }
+        else
+        {
+            // Check if it's a user-defined class type
+            auto it = mStructTypes.find(str);
+            if (it != mStructTypes.end())
+            {
+                // Structs are held by value, objects by pointer
+                if (isValueType(str))
+                {
+                    return it->second;
+                }
+                return llvm::PointerType::get(mContext, 0);
+            }
+            reportFatalError("Unknown type: " + str);
+            return nullptr;
+        }
+    }
+
+    vector<llvm::Type *> CodeGen::getFunctionArgumentTypes(shared_ptr<Function> function)
+    {
+        vector<llvm::Type *> types;
+        for (size_t i = 0; i < function->argCount(); ++i)
+        {
+            string typeName = ((*function).getArguments()[i])->getType();
+            llvm::Type *t = stringToType(typeName);
+
+            types.push_back(t);
+        }
+
+        return types;
+    }
+
+    void CodeGen::generateClassTypes(shared_ptr<Assembly> assembly)
+    {
+        vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
+
+        // Store the class declarations first, struct fields may name a type declared further down
+        for (shared_ptr<ClassDeclaration> classDecl : classes)
+        {
+            mClasses[classDecl->getName()] = classDecl;
+        }
+
+        for (shared_ptr<ClassDeclaration> classDecl : classes)
+        {
+            generateClassType(classDecl);
+        }
+    }
+
+    llvm::StructType *CodeGen::generateClassType(shared_ptr<ClassDeclaration> classDecl)
+    {
+        string className = classDecl->getName();
+        auto existing = mStructTypes.find(className);
+        if (existing != mStructTypes.end())
+        {
+            // Still opaque while its own fields are laid out
+            if (existing->second->isOpaque())
+            {
+                reportFatalError("Struct " + className + " contains itself");
+            }
+            return existing->second;
+        }
+
+        bool valueType = classDecl->isValueType();
+        llvm::StructType *structType = llvm::StructType::create(mContext, className);
+        mStructTypes[className] = structType;
+
+        // Create field types
+        vector<llvm::Type *> fieldTypes;
+        vector<shared_ptr<Field>> fields = classDecl->getFields();
+        for (auto fieldIt = fields.begin(); fieldIt != fields.end(); ++fieldIt)
+        {
+            string fieldTypeName = (*fieldIt)->getType();
+            llvm::Type *fieldType;
+
+            // Handle primitive types directly (can't use stringToType yet for class types)
+            if (isIntegerType(fieldTypeName) || isFloatType(fieldTypeName))
+            {
+                fieldType = stringToType(fieldTypeName);
+            }
+            else if ((fieldTypeName == "string" || !arrayElementType(fieldTypeName).empty()) && !valueType)
+            {
+                fieldType = llvm::PointerType::get(mContext, 0);
+            }
+            else if (isVectorType(fieldTypeName) && !valueType)
+            {
+                fieldType = stringToType(fieldTypeName);
+            }
+            else if (isValueType(fieldTypeName))
+            {
+                // Stored inline
+                fieldType = generateClassType(mClasses[fieldTypeName]);
+            }
+            else if (valueType)
+            {
+                reportFatalError("Field " + (*fieldIt)->getName() + " of struct " + className
+                    + " must be a number or a struct but is " + fieldTypeName);
+                return nullptr;
+            }
+            else
+            {
+                reportFatalError("Unsupported field type: " + fieldTypeName);
+                return nullptr;
+            }
+            fieldTypes.push_back(fieldType);
+        }
+
+        // Lay out the object: the runtime header (type descriptor, then the 32-bit ref count)
+        // followed by the fields. Fields are reordered to fill alignment holes, starting with the
+        // padding after the ref count, so declaration order doesn't cost extra bytes per object.
+        // Structs have no header.
+        const llvm::DataLayout &dataLayout = mModule->getDataLayout();
+        vector<llvm::Type *> slotTypes;
+        if (!valueType)
+        {
+            slotTypes = {llvm::PointerType::get(mContext, 0), llvm::Type::getInt32Ty(mContext)};
+        }
+        uint64_t offset = 0;
+        for (llvm::Type *headerType : slotTypes)
+        {
+            offset += dataLayout.getTypeAllocSize(headerType);
+        }
+        unsigned headerSlots = static_cast<unsigned>(slotTypes.size());
+        vector<unsigned> fieldSlots(fields.size());
+        vector<bool> placed(fields.size(), false);
+        for (size_t n = 0; n < fields.size(); ++n)
+        {
+            // Prefer the most aligned field that needs no padding here, declaration order breaks ties
+            size_t best = fields.size();
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (placed[i])
+                {
+                    continue;
+                }
+
+                uint64_t align = dataLayout.getABITypeAlign(fieldTypes[i]).value();
+                bool fits = offset % align == 0;
+                if (best == fields.size())
+                {
+                    best = i;
+                    continue;
+                }
+
+                uint64_t bestAlign = dataLayout.getABITypeAlign(fieldTypes[best]).value();
+                bool bestFits = offset % bestAlign == 0;
+                if ((fits && !bestFits) || (fits == bestFits && align > bestAlign))
+                {
+                    best = i;
+                }
+            }
+
+            uint64_t align = dataLayout.getABITypeAlign(fieldTypes[best]).value();
+            offset = (offset + align - 1) / align * align + dataLayout.getTypeAllocSize(fieldTypes[best]);
+            placed[best] = true;
+            fieldSlots[best] = static_cast<unsigned>(slotTypes.size());
+            slotTypes.push_back(fieldTypes[best]);
+        }
+
+        // Fill in the struct type
+        structType->setBody(slotTypes);
+        mFieldSlots[className] = fieldSlots;
+        generateTbaaTypes(className);
+
+        if (logging::Logger::isEnabled())
+        {
+            const llvm::StructLayout *layout = dataLayout.getStructLayout(structType);
+            LOG("Codegen: Layout of %s %s (%llu bytes)\n", valueType ? "struct" : "class", className.c_str(),
+                (unsigned long long)layout->getSizeInBytes());
+            if (!valueType)
+            {
+                LOG("Codegen:   offset %2llu  header type\n", (unsigned long long)layout->getElementOffset(0));
+                LOG("Codegen:   offset %2llu  header refcount\n", (unsigned long long)layout->getElementOffset(1));
+            }
+            for (unsigned slot = headerSlots; slot < slotTypes.size(); ++slot)
+            {
+                size_t fieldIndex = find(fieldSlots.begin(), fieldSlots.end(), slot) - fieldSlots.begin();
+                LOG("Codegen:   offset %2llu  %s: %s\n", (unsigned long long)layout->getElementOffset(slot),
+                    fields[fieldIndex]->getName().c_str(), fields[fieldIndex]->getType().c_str());
+            }
+        }
+
+        if (valueType)
+        {
+            // Never allocated, so no type descriptor or destructor
+            LOG("Codegen: Created value type for struct %s with %zu fields\n", className.c_str(), fieldTypes.size());
+            return structType;
+        }
+
+        // Objects with string or array fields get a destructor that releases them, its body is
+        // generated by generateClassDestructors once the runtime functions are declared
+        llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+        llvm::Constant *destroy = llvm::ConstantPointerNull::get(llvm::PointerType::get(mContext, 0));
+        bool hasOwnedFields = any_of(fields.begin(), fields.end(), [](const shared_ptr<Field> &field)
+            { return field->getType() == "string" || !arrayElementType(field->getType()).empty(); });
+        if (hasOwnedFields)
+        {
+            llvm::FunctionType *destroyTy = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {ptrTy}, false);
+            destroy = llvm::Function::Create(destroyTy, llvm::Function::InternalLinkage, className + ".destroy", mModule);
         }
 
-        return (*it).second;
-    }
+        // Create the type descriptor passed to silver_alloc, must match SilverTypeInfo in the runtime
+        llvm::Constant *typeName = mBuilder.CreateGlobalString(className, className + ".name", 0, mModule);
+        vector<llvm::Type *> typeInfoFields = {ptrTy, ptrTy};
+        llvm::StructType *typeInfoType = llvm::StructType::get(mContext, typeInfoFields);
+        llvm::GlobalVariable *typeInfo = new llvm::GlobalVariable(*mModule, typeInfoType, true,
+            llvm::GlobalValue::PrivateLinkage, llvm::ConstantStruct::get(typeInfoType, {typeName, destroy}),
+            className + ".typeinfo");
+        mTypeInfos[className] = typeInfo;
 
-    bool CodeGen::isRefCountedType(const string& typeName)
-    {
-        // User-defined class types are ref-counted
-        return mStructTypes.find(typeName) != mStructTypes.end();
+        LOG("Codegen: Created struct type for class %s with %zu fields\n",
+                className.c_str(), fieldTypes.size());
+        return structType;
     }
 
-    void CodeGen::generateRetain(llvm::Value* ptr)
+    void CodeGen::generateClassDestructors()
     {
-        llvm::Function* retainFunc = getFunc("retain");
-        if (retainFunc)
+        // Called by silver_release just before an object is freed, releases the strings and arrays it owns
+        llvm::IRBuilderBase::InsertPointGuard guard(mBuilder);
+        for (auto &classEntry : mClasses)
         {
-            // Cast to i8* if needed
-            llvm::Value* castedPtr = mBuilder.CreateBitCast(ptr,
-                llvm::PointerType::get(mContext, 0));
-            mBuilder.CreateCall(retainFunc, {castedPtr});
+            string className = classEntry.first;
+            llvm::Function *destroy = mModule->getFunction(className + ".destroy");
+            if (destroy == nullptr)
+            {
+                continue;
+            }
+
+            llvm::BasicBlock *entry = llvm::BasicBlock::Create(mContext, "entry", destroy);
+            mBuilder.SetInsertPoint(entry);
+            mBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+            vector<shared_ptr<Field>> fields = classEntry.second->getFields();
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (!isRefCountedType(fields[i]->getType()))
+                {
+                    continue;
+                }
+
+                llvm::Value *fieldPtr = mBuilder.CreateStructGEP(mStructTypes[className], destroy->getArg(0),
+                    getFieldSlot(className, i), fields[i]->getName() + "_ptr");
+                llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+                llvm::LoadInst *field = mBuilder.CreateLoad(ptrTy, fieldPtr);
+                tagFieldAccess(field, className, i);
+                generateRelease(field, fields[i]->getType());
+            }
+            mBuilder.CreateRetVoid();
         }
     }
 
-    void CodeGen::generateRelease(llvm::Value* ptr)
+    static bool hasCycle(llvm::BasicBlock *block, set<llvm::BasicBlock *> &active, set<llvm::BasicBlock *> &done)
     {
-        llvm::Function* releaseFunc = getFunc("release");
-        if (releaseFunc)
+        if (done.count(block) > 0)
         {
-            // Cast to i8* if needed
-            llvm::Value* castedPtr = mBuilder.CreateBitCast(ptr,
-                llvm::PointerType::get(mContext, 0));
-            mBuilder.CreateCall(releaseFunc, {castedPtr});
+            return false;
         }
-    }
-
-    void CodeGen::enterRefCountScope()
-    {
-        mRefCountedVarsStack.push_back(vector<string>());
-    }
-
-    void CodeGen::leaveRefCountScope()
-    {
-        // Only generate release calls if the current block doesn't already have a terminator
-        // (e.g., a return statement already handled releases via releaseAllScopes)
-        llvm::BasicBlock *currentBlock = mBuilder.GetInsertBlock();
-        if (currentBlock && !currentBlock->getTerminator())
+        if (!active.insert(block).second)
         {
-            releaseAllInCurrentScope();
+            return true;
         }
-        mRefCountedVarsStack.pop_back();
+        for (llvm::BasicBlock *successor : llvm::successors(block))
+        {
+            if (hasCycle(successor, active, done))
+            {
+                return true;
+            }
+        }
+        active.erase(block);
+        done.insert(block);
+        return false;
     }
 
-    void CodeGen::releaseAllInCurrentScope()
+    // A fresh allocation that the function hands back without storing it anywhere
+    static bool isUncapturedAllocation(llvm::Value *value)
     {
-        if (mRefCountedVarsStack.empty()) return;
-
-        // Make sure we have a valid insert point
-        llvm::BasicBlock* block = mBuilder.GetInsertBlock();
-        if (!block) return;
+        llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(value);
+        if (call == nullptr || !call->hasRetAttr(llvm::Attribute::NoAlias))
+        {
+            return false;
+        }
 
-        vector<string>& currentScope = mRefCountedVarsStack.back();
-        for (const string& varName : currentScope)
+        for (llvm::User *user : call->users())
         {
-            llvm::AllocaInst* inst = mTable.get(varName);
-            if (inst)
+            if (llvm::isa<llvm::ReturnInst>(user))
             {
-                // Load the pointer and release it
-                llvm::Value* ptr = mBuilder.CreateLoad(inst->getAllocatedType(), inst);
-                generateRelease(ptr);
+                continue;
+            }
+
+            // Field initialization: stores into the object and loads from it are fine
+            llvm::GetElementPtrInst *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user);
+            if (gep == nullptr || gep->getPointerOperand() != call)
+            {
+                return false;
+            }
+            for (llvm::User *gepUser : gep->users())
+            {
+                llvm::StoreInst *store = llvm::dyn_cast<llvm::StoreInst>(gepUser);
+                if (!llvm::isa<llvm::LoadInst>(gepUser) && (store == nullptr || store->getValueOperand() == gep))
+                {
+                    return false;
+                }
             }
         }
+        return true;
     }
 
-    void CodeGen::releaseAllScopes()
+    void CodeGen::optimizeLoops(llvm::TargetMachine *tm)
     {
-        // Release all ref-counted variables in all active scopes (for return statements)
-        llvm::BasicBlock* block = mBuilder.GetInsertBlock();
-        if (!block) return;
-
-        for (auto it = mRefCountedVarsStack.rbegin(); it != mRefCountedVarsStack.rend(); ++it)
-        {
-            for (const string& varName : *it)
+        // The legacy pass manager no longer has the vectorizer or unroller, so these run on the
+        // new one. Loops are already in canonical form after mem2reg, LoopSimplify and LCSSA only
+        // restore it after CFGSimplify.
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        llvm::PassBuilder pb(tm);
+        pb.registerModuleAnalyses(mam);
+        pb.registerCGSCCAnalyses(cgam);
+        pb.registerFunctionAnalyses(fam);
+        pb.registerLoopAnalyses(lam);
+        pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+        llvm::FunctionPassManager fpm;
+        fpm.addPass(llvm::LoopSimplifyPass());
+        fpm.addPass(llvm::LCSSAPass());
+        fpm.addPass(llvm::LoopVectorizePass());
+        fpm.addPass(llvm::LoopUnrollPass(llvm::LoopUnrollOptions(2)));
+        // Clean up the vector and unrolled bodies
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::SimplifyCFGPass());
+
+        for (llvm::Function &func : *mModule)
+        {
+            if (func.isDeclaration())
             {
-                llvm::AllocaInst* inst = mTable.get(varName);
-                if (inst)
+                continue;
+            }
+            fpm.run(func, fam);
+            for (llvm::BasicBlock &block : func)
+            {
+                llvm::MDNode *loopID = block.getTerminator()->getMetadata(llvm::LLVMContext::MD_loop);
+                if (loopID == nullptr)
                 {
-                    llvm::Value* ptr = mBuilder.CreateLoad(inst->getAllocatedType(), inst);
-                    generateRelease(ptr);
+                    continue;
+                }
+                for (const llvm::MDOperand &op : loopID->operands())
+                {
+                    llvm::MDNode *hint = llvm::dyn_cast_or_null<llvm::MDNode>(op.get());
+                    llvm::MDString *name = hint != nullptr ? llvm::dyn_cast<llvm::MDString>(hint->getOperand(0)) : nullptr;
+                    if (name != nullptr && name->getString() == "llvm.loop.isvectorized")
+                    {
+                        LOG("Codegen: Vectorized loop in %s\n", func.getName().str().c_str());
+                    }
                 }
             }
         }
     }
 
-    llvm::Type *CodeGen::stringToType(string str)
+    void CodeGen::setInlining(llvm::Function *llvmFunc, shared_ptr<Function> function)
     {
-        if (str == "int")
+        if (function->getInlining() == Inlining::Always)
         {
-            return llvm::Type::getInt32Ty(mContext);
+            llvmFunc->addFnAttr(llvm::Attribute::AlwaysInline);
         }
-        else if (str == "float")
+        else if (function->getInlining() == Inlining::Never)
         {
-            return llvm::Type::getDoubleTy(mContext);
+            llvmFunc->addFnAttr(llvm::Attribute::NoInline);
         }
-        else if (str == "string")
+
+        // Imports are compiled into every program that uses them, nothing outside calls this copy,
+        // so once every call is inlined it can be dropped
+        if (function->isImported())
         {
-            return llvm::PointerType::get(mContext, 0);
+            llvmFunc->setLinkage(llvm::GlobalValue::InternalLinkage);
         }
-        else if (str == "void" || str.empty())
+    }
+
+    // Largest function body, in instructions, inlined without an "inline" modifier
+    static const size_t INLINE_THRESHOLD = 20;
+
+    vector<llvm::Function *> CodeGen::inlineCalls()
+    {
+        // Callees are visited before their callers, so a caller sees them after their own calls
+        // were inlined. Calls copied in by inlining were already decided in the callee.
+        vector<llvm::Function *> changed;
+        llvm::CallGraph callGraph(*mModule);
+        for (llvm::scc_iterator<llvm::CallGraph *> scc = llvm::scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
         {
-            return llvm::Type::getVoidTy(mContext);
+            for (llvm::CallGraphNode *node : *scc)
+            {
+                llvm::Function *caller = node->getFunction();
+                if (caller == nullptr || caller->isDeclaration())
+                {
+                    continue;
+                }
+
+                vector<llvm::CallInst *> calls;
+                for (llvm::Instruction &inst : llvm::instructions(*caller))
+                {
+                    llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                    if (call != nullptr && call->getCalledFunction() != nullptr && !call->getCalledFunction()->isDeclaration())
+                    {
+                        calls.push_back(call);
+                    }
+                }
+
+                bool inlined = false;
+                for (llvm::CallInst *call : calls)
+                {
+                    llvm::Function *callee = call->getCalledFunction();
+                    string callerName = caller->getName().str();
+                    string calleeName = callee->getName().str();
+
+                    size_t size = callee->getInstructionCount();
+                    bool makesMustTailCalls = false;
+                    for (llvm::Instruction &inst : llvm::instructions(*callee))
+                    {
+                        llvm::CallInst *inner = llvm::dyn_cast<llvm::CallInst>(&inst);
+                        makesMustTailCalls = makesMustTailCalls || (inner != nullptr && inner->isMustTailCall());
+                    }
+
+                    const char *reason = nullptr;
+                    if (callee->hasFnAttribute(llvm::Attribute::NoInline))
+                    {
+                        reason = "it is noinline";
+                    }
+                    else if (std::find(scc->begin(), scc->end(), callGraph[callee]) != scc->end())
+                    {
+                        reason = "it is recursive";
+                    }
+                    else if (call->isMustTailCall() || makesMustTailCalls)
+                    {
+                        // Inlining would turn guaranteed tail calls into ones that use stack
+                        reason = "it is part of a guaranteed tail call";
+                    }
+                    else if (callee->getSubprogram() != nullptr && !call->getDebugLoc())
+                    {
+                        reason = "the call has no debug location";
+                    }
+                    else if (!callee->hasFnAttribute(llvm::Attribute::AlwaysInline) && (!mOptimize || size > INLINE_THRESHOLD))
+                    {
+                        reason = mOptimize ? "it is too large" : "it isn't marked inline";
+                    }
+
+                    if (reason != nullptr)
+                    {
+                        LOG("Codegen: Not inlining %s into %s, %s (%zu instructions)\n", calleeName.c_str(), callerName.c_str(), reason, size);
+                        continue;
+                    }
+
+                    llvm::InlineFunctionInfo info;
+                    llvm::InlineResult result = llvm::InlineFunction(*call, info);
+                    if (!result.isSuccess())
+                    {
+                        LOG("Codegen: Not inlining %s into %s, %s\n", calleeName.c_str(), callerName.c_str(), result.getFailureReason());
+                        continue;
+                    }
+                    LOG("Codegen: Inlined %s into %s (%zu instructions)\n", calleeName.c_str(), callerName.c_str(), size);
+                    inlined = true;
+                }
+
+                if (inlined)
+                {
+                    changed.push_back(caller);
+                }
+            }
         }
-        else
+
+        // Imported functions whose every call was inlined
+        vector<llvm::Function *> unused;
+        for (llvm::Function &func : *mModule)
         {
-            // Check if it's a user-defined class type
-            auto it = mStructTypes.find(str);
-            if (it != mStructTypes.end())
+            if (func.hasInternalLinkage() && !func.isDeclaration() && func.use_empty())
             {
-                // Return pointer to struct type
-                return llvm::PointerType::get(mContext, 0);
+                unused.push_back(&func);
             }
-            reportFatalError("Unknown type: " + str);
-            return nullptr;
         }
+        for (llvm::Function *func : unused)
+        {
+            LOG("Codegen: Removed %s, every call to it was inlined\n", func->getName().str().c_str());
+            changed.erase(std::remove(changed.begin(), changed.end(), func), changed.end());
+            func->eraseFromParent();
+        }
+        return changed;
     }
 
-    vector<llvm::Type *> CodeGen::getFunctionArgumentTypes(shared_ptr<Function> function)
+    void CodeGen::inferFunctionAttributes()
     {
-        vector<llvm::Type *> types;
-        for (size_t i = 0; i < function->argCount(); ++i)
+        // Attributes for the functions we generated, so the optimizer can reason across calls.
+        // Locals live in allocas whose address never escapes, so accessing them isn't a side effect.
+        vector<llvm::Function *> functions;
+        for (llvm::Function &func : *mModule)
         {
-            string typeName = ((*function).getArguments()[i])->getType();
-            llvm::Type *t = stringToType(typeName);
-
-            types.push_back(t);
+            if (!func.isDeclaration())
+            {
+                functions.push_back(&func);
+                // Silver has no exceptions
+                func.setDoesNotThrow();
+            }
         }
 
-        return types;
-    }
+        // 'this' always points at a whole object
+        for (auto &classEntry : mClasses)
+        {
+            const llvm::DataLayout &dataLayout = mModule->getDataLayout();
+            uint64_t size = dataLayout.getTypeAllocSize(mStructTypes[classEntry.first]);
+            for (shared_ptr<Function> method : classEntry.second->getMethods())
+            {
+                llvm::Function *func = mModule->getFunction(classEntry.first + "_" + method->getName());
+                if (func != nullptr && !func->isDeclaration())
+                {
+                    func->addParamAttr(0, llvm::Attribute::NonNull);
+                    func->addParamAttr(0, llvm::Attribute::NoUndef);
+                    func->addDereferenceableParamAttr(0, size);
+                }
+            }
+        }
 
-    void CodeGen::generateClassTypes(shared_ptr<Assembly> assembly)
-    {
-        vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
+        // Memory effects, optimistically: start with every function touching nothing and raise
+        // that to reading or writing memory until nothing changes, which handles recursion.
+        enum Effect { None, Reads, Writes };
+        map<llvm::Function *, Effect> effects;
+        for (llvm::Function *func : functions)
+        {
+            effects[func] = None;
+        }
 
-        for (auto it = classes.begin(); it != classes.end(); ++it)
+        bool changed = true;
+        while (changed)
         {
-            shared_ptr<ClassDeclaration> classDecl = *it;
-            string className = classDecl->getName();
+            changed = false;
+            for (llvm::Function *func : functions)
+            {
+                Effect effect = None;
+                for (llvm::BasicBlock &block : *func)
+                {
+                    for (llvm::Instruction &inst : block)
+                    {
+                        Effect instEffect = None;
+                        if (llvm::LoadInst *load = llvm::dyn_cast<llvm::LoadInst>(&inst))
+                        {
+                            instEffect = llvm::isa<llvm::AllocaInst>(load->getPointerOperand()) ? None : Reads;
+                        }
+                        else if (llvm::StoreInst *store = llvm::dyn_cast<llvm::StoreInst>(&inst))
+                        {
+                            instEffect = llvm::isa<llvm::AllocaInst>(store->getPointerOperand()) ? None : Writes;
+                        }
+                        else if (llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst))
+                        {
+                            llvm::Function *callee = call->getCalledFunction();
+                            if (callee != nullptr && effects.count(callee) > 0)
+                            {
+                                instEffect = effects[callee];
+                            }
+                            else if (callee != nullptr && callee->doesNotAccessMemory())
+                            {
+                                instEffect = None;
+                            }
+                            else if (callee != nullptr && callee->onlyReadsMemory())
+                            {
+                                instEffect = Reads;
+                            }
+                            else
+                            {
+                                instEffect = Writes;
+                            }
+                        }
+                        else if (inst.mayReadOrWriteMemory())
+                        {
+                            instEffect = Writes;
+                        }
+                        effect = max(effect, instEffect);
+                    }
+                }
 
-            // Store the class declaration for later lookup
-            mClasses[className] = classDecl;
+                if (effect != effects[func])
+                {
+                    effects[func] = effect;
+                    changed = true;
+                }
+            }
+        }
 
-            // Create field types
-            vector<llvm::Type *> fieldTypes;
-            vector<shared_ptr<Field>> fields = classDecl->getFields();
-            for (auto fieldIt = fields.begin(); fieldIt != fields.end(); ++fieldIt)
+        // Termination, pessimistically: no loops, and only calls to functions known to return.
+        // Recursive functions never qualify because their own call isn't known to return yet.
+        set<llvm::Function *> willReturn;
+        changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (llvm::Function *func : functions)
             {
-                string fieldTypeName = (*fieldIt)->getType();
-                llvm::Type *fieldType;
+                if (willReturn.count(func) > 0)
+                {
+                    continue;
+                }
 
-                // Handle primitive types directly (can't use stringToType yet for class types)
-                if (fieldTypeName == "int")
+                set<llvm::BasicBlock *> active, done;
+                bool returns = !hasCycle(&func->getEntryBlock(), active, done);
+                for (llvm::BasicBlock &block : *func)
                 {
-                    fieldType = llvm::Type::getInt32Ty(mContext);
+                    for (llvm::Instruction &inst : block)
+                    {
+                        llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                        if (call != nullptr && (call->getCalledFunction() == nullptr || !call->getCalledFunction()->willReturn()))
+                        {
+                            returns = false;
+                        }
+                    }
                 }
-                else if (fieldTypeName == "float")
+
+                if (returns)
                 {
-                    fieldType = llvm::Type::getDoubleTy(mContext);
+                    func->setWillReturn();
+                    willReturn.insert(func);
+                    changed = true;
                 }
-                else if (fieldTypeName == "string")
+            }
+        }
+
+        // Returned pointers: non-null when every return is (a literal, 'this', or a call returning
+        // non-null), noalias when every return is a fresh allocation that wasn't stored anywhere
+        changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (llvm::Function *func : functions)
+            {
+                if (!func->getReturnType()->isPointerTy())
                 {
-                    fieldType = llvm::PointerType::get(mContext, 0);
+                    continue;
                 }
-                else
+
+                bool nonNull = !func->hasRetAttribute(llvm::Attribute::NonNull);
+                bool noAlias = !func->hasRetAttribute(llvm::Attribute::NoAlias);
+                for (llvm::BasicBlock &block : *func)
                 {
-                    reportFatalError("Unsupported field type: " + fieldTypeName);
-                    return;
+                    llvm::ReturnInst *ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+                    if (ret == nullptr)
+                    {
+                        continue;
+                    }
+
+                    llvm::Value *value = ret->getReturnValue();
+                    llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(value);
+                    llvm::Argument *arg = llvm::dyn_cast<llvm::Argument>(value);
+                    nonNull = nonNull && (llvm::isa<llvm::ConstantExpr>(value) || llvm::isa<llvm::GlobalValue>(value)
+                        || (call != nullptr && call->hasRetAttr(llvm::Attribute::NonNull))
+                        || (arg != nullptr && arg->hasNonNullAttr()));
+                    noAlias = noAlias && isUncapturedAllocation(value);
+                }
+
+                if (nonNull)
+                {
+                    func->addRetAttr(llvm::Attribute::NonNull);
+                    changed = true;
+                }
+                if (noAlias)
+                {
+                    func->addRetAttr(llvm::Attribute::NoAlias);
+                    changed = true;
                 }
-                fieldTypes.push_back(fieldType);
             }
+        }
 
-            // Create the struct type
-            llvm::StructType *structType = llvm::StructType::create(mContext, fieldTypes, className);
-            mStructTypes[className] = structType;
+        for (llvm::Function *func : functions)
+        {
+            if (effects[func] == None)
+            {
+                func->setDoesNotAccessMemory();
+            }
+            else if (effects[func] == Reads)
+            {
+                func->setOnlyReadsMemory();
+            }
 
-            LOG("Codegen: Created struct type for class %s with %zu fields\n",
-                    className.c_str(), fieldTypes.size());
+            LOG("Codegen: Attributes of %s: %s\n", func->getName().str().c_str(),
+                func->getAttributes().getAsString(llvm::AttributeList::FunctionIndex).c_str());
         }
     }
 
     void CodeGen::generateAssembly(shared_ptr<Assembly> assembly)
     {
         addSystemCalls();
+        generateClassDestructors();
 
         // Generate all prototypes first (regular functions)
         vector<shared_ptr<Function>> functions = assembly->getFunctions();
@@ -371,9 +1785,13 @@ namespace codegen
             generateNamespacePrototypes(*it, "");
         }
 
-        // Generate class method prototypes and bodies
+        // Generate class method prototypes, so methods can call methods declared after them, then their bodies
         vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
         for (auto it = classes.begin(); it != classes.end(); ++it)
+        {
+            generateClassMethodPrototypes(*it);
+        }
+        for (auto it = classes.begin(); it != classes.end(); ++it)
         {
             generateClassMethods(*it);
         }
@@ -400,7 +1818,15 @@ namespace codegen
 
         llvm::Value *funcVal = mModule->getOrInsertFunction(function->getName(), type).getCallee();
         llvm::Function *llvmFunc = llvm::cast<llvm::Function>(funcVal);
+        setInlining(llvmFunc, function);
         putFunc(function->getName(), llvmFunc);
+        mFunctionReturnTypes[function->getName()] = function->getReturnType();
+        vector<string> &argumentTypes = mFunctionArgumentTypes[function->getName()];
+        argumentTypes.clear();
+        for (shared_ptr<Argument> arg : function->getArguments())
+        {
+            argumentTypes.push_back(arg->getType());
+        }
 
         if (function->getName() == "main")
         {
@@ -438,7 +1864,15 @@ namespace codegen
 
         llvm::Value *funcVal = mModule->getOrInsertFunction(mangledName, type).getCallee();
         llvm::Function *llvmFunc = llvm::cast<llvm::Function>(funcVal);
+        setInlining(llvmFunc, function);
         putFunc(mangledName, llvmFunc);
+        mFunctionReturnTypes[mangledName] = function->getReturnType();
+        vector<string> &argumentTypes = mFunctionArgumentTypes[mangledName];
+        argumentTypes.clear();
+        for (shared_ptr<Argument> arg : function->getArguments())
+        {
+            argumentTypes.push_back(arg->getType());
+        }
 
         return llvmFunc;
     }
@@ -493,15 +1927,23 @@ namespace codegen
             mVariableTypes.put(a->getName(), a->getType());
         }
 
+        // Class-typed parameters are borrowed (+0): the caller's reference keeps them alive for the
+        // duration of the call, so the callee only retains a parameter it copies, returns or reassigns
+        enterRefCountScope();
+        mBuilder.SetInsertPoint(&llvmFunc->getEntryBlock());
+        retainReassignedParameters(function);
+
         generateBlock(function->getBlock(), llvmFunc);
 
-        // For void functions without explicit return, add implicit ret void
-        llvm::BasicBlock *lastBlock = &llvmFunc->back();
+        // For void functions without explicit return, add implicit ret void where the body falls through
+        // (blocks like failed bounds checks can come after it)
+        llvm::BasicBlock *lastBlock = mBuilder.GetInsertBlock();
         if (lastBlock->getTerminator() == nullptr)
         {
             if (function->getReturnType() == "void" || function->getReturnType().empty())
             {
                 mBuilder.SetInsertPoint(lastBlock);
+                releaseAllInCurrentScope();
                 mBuilder.CreateRetVoid();
             }
             else
@@ -509,6 +1951,8 @@ namespace codegen
                 reportFatalError("Non-void function " + mangledName + " missing return statement");
             }
         }
+        leaveRefCountScope();
+        alignVectorAccesses(*llvmFunc);
 
         if (mOptimize)
         {
@@ -622,15 +2066,23 @@ namespace codegen
             mVariableTypes.put(a->getName(), a->getType());
         }
 
+        // Class-typed parameters are borrowed (+0): the caller's reference keeps them alive for the
+        // duration of the call, so the callee only retains a parameter it copies, returns or reassigns
+        enterRefCountScope();
+        mBuilder.SetInsertPoint(&llvmFunc->getEntryBlock());
+        retainReassignedParameters(function);
+
         generateBlock(function->getBlock(), llvmFunc);
 
-        // For void functions without explicit return, add implicit ret void
-        llvm::BasicBlock *lastBlock = &llvmFunc->back();
+        // For void functions without explicit return, add implicit ret void where the body falls through
+        // (blocks like failed bounds checks can come after it)
+        llvm::BasicBlock *lastBlock = mBuilder.GetInsertBlock();
         if (lastBlock->getTerminator() == nullptr)
         {
             if (function->getReturnType() == "void" || function->getReturnType().empty())
             {
                 mBuilder.SetInsertPoint(lastBlock);
+                releaseAllInCurrentScope();
                 mBuilder.CreateRetVoid();
             }
             else
@@ -638,6 +2090,7 @@ namespace codegen
                 reportFatalError("Non-void function " + function->getName() + " missing return statement");
             }
         }
+        leaveRefCountScope();
 
         LOG("Codegen: Running optimization passes on %s\n", function->getName().c_str());
 
@@ -650,6 +2103,7 @@ namespace codegen
             llvmFunc->print(llvm::errs());
         }
 
+        alignVectorAccesses(*llvmFunc);
         if (mOptimize)
         {
             mFpm->run(*llvmFunc);
@@ -661,145 +2115,215 @@ namespace codegen
         return llvmFunc;
     }
 
-    llvm::Value *CodeGen::generateBinaryExpression(shared_ptr<BinaryExpressionNode> expression)
+    llvm::Value *CodeGen::generateAssignment(shared_ptr<BinaryExpressionNode> expression)
     {
-        string op = expression->getOperator();
+        shared_ptr<Expression> binLhs = expression->getLhs();
 
-        llvm::Value *rhs = generateExpression(expression->getRhs());
+        if (binLhs == nullptr)
+        {
+            // only can store to variable.
+            reportFatalError("Found a store with a null assignment", expression);
+            return nullptr;
+        }
 
-        if (op == "=")
+        if (binLhs->getExpressionType() != Identifier && binLhs->getExpressionType() != Declaration
+            && binLhs->getExpressionType() != MemberAccess && binLhs->getExpressionType() != ExpressionType::Index)
         {
-            shared_ptr<Expression> binLhs = expression->getLhs();
+            reportFatalError("Cannot assign a value to a non-identifier type.", expression);
+            return nullptr;
+        }
 
-            if (binLhs == nullptr)
+        if (binLhs->getExpressionType() == Identifier)
+        {
+            shared_ptr<IdentifierNode> castLhs = dynamic_pointer_cast<IdentifierNode>(binLhs);
+            string varName = castLhs->getValue();
+            llvm::AllocaInst *alloca = mTable.get(varName);
+            string typeName = mVariableTypes.get(varName);
+            if (!isRefCountedType(typeName))
             {
-                // only can store to variable.
-                reportFatalError("Found a store with a null assignment", expression);
-                return nullptr;
+                llvm::Value *rhs = generateExpression(expression->getRhs());
+                return mBuilder.CreateStore(rhs, alloca);
             }
 
-            if (binLhs->getExpressionType() != Identifier && binLhs->getExpressionType() != Declaration
-                && binLhs->getExpressionType() != MemberAccess)
+            // Assigning a variable to itself leaves its reference count unchanged
+            shared_ptr<IdentifierNode> rhsIdent = dynamic_pointer_cast<IdentifierNode>(expression->getRhs());
+            if (rhsIdent != nullptr && rhsIdent->getValue() == varName)
             {
-                reportFatalError("Cannot assign a value to a non-identifier type.", expression);
-                return nullptr;
+                return alloca;
             }
 
-            llvm::Value *inst;
-            if (binLhs->getExpressionType() == Identifier)
+            llvm::Value *rhs = generateOwnedValue(expression->getRhs(), typeName);
+
+            // The variable owns its new value. The old one is released unless it is known to still
+            // be null (first assignment in the declaring block) or the variable is a borrowed parameter.
+            int declScope = findRefCountScope(varName);
+            bool unassigned = mUnassignedRefCountedVars.erase(alloca) > 0
+                && declScope == static_cast<int>(mRefCountedVarsStack.size()) - 1;
+            if (declScope < 0 || unassigned)
             {
-                shared_ptr<IdentifierNode> castLhs = dynamic_pointer_cast<IdentifierNode>(binLhs);
-                inst = mTable.get(castLhs->getValue());
+                return mBuilder.CreateStore(rhs, alloca);
             }
-            else if (binLhs->getExpressionType() == MemberAccess)
-            {
-                // Generate pointer to member field for assignment
-                shared_ptr<MemberAccessNode> memberNode = dynamic_pointer_cast<MemberAccessNode>(binLhs);
-                shared_ptr<Expression> objectExpr = memberNode->getObject();
-
-                string typeName;
-                llvm::Value *objectPtr;
 
-                if (objectExpr->getExpressionType() == ExpressionType::Identifier)
-                {
-                    shared_ptr<IdentifierNode> ident = dynamic_pointer_cast<IdentifierNode>(objectExpr);
-                    string varName = ident->getValue();
+            llvm::Value *oldValue = mBuilder.CreateLoad(alloca->getAllocatedType(), alloca);
+            llvm::Value *store = mBuilder.CreateStore(rhs, alloca);
+            generateRelease(oldValue, typeName);
+            return store;
+        }
 
-                    // Handle 'this' specially
-                    if (varName == "this" && mThisPtr != nullptr)
-                    {
-                        objectPtr = mThisPtr;
-                        typeName = mCurrentClass;
-                    }
-                    else
-                    {
-                        typeName = mVariableTypes.get(varName);
-                        llvm::AllocaInst *alloca = mTable.get(varName);
-                        objectPtr = mBuilder.CreateLoad(alloca->getAllocatedType(), alloca);
-                    }
-                }
-                else
-                {
-                    reportFatalError("Member assignment on non-identifier expression not yet supported", expression);
-                    return nullptr;
-                }
+        if (binLhs->getExpressionType() == MemberAccess)
+        {
+            // Generate pointer to member field for assignment
+            shared_ptr<MemberAccessNode> memberNode = dynamic_pointer_cast<MemberAccessNode>(binLhs);
+            string typeName;
+            size_t fieldIndex;
+            llvm::Value *fieldPtr = generateFieldPointer(memberNode, typeName, fieldIndex);
 
-                // Look up struct type and field index
-                auto structIt = mStructTypes.find(typeName);
-                if (structIt == mStructTypes.end())
-                {
-                    reportFatalError("Unknown struct type in member assignment: " + typeName, expression);
-                    return nullptr;
-                }
-                llvm::StructType *structType = structIt->second;
+            // The object owns its string and array fields: store the new value, then release the old one
+            string fieldType = mClasses[typeName]->getFields()[fieldIndex]->getType();
+            llvm::Value *rhs = generateOwnedValue(expression->getRhs(), fieldType);
+            mAssignedFields.insert(mFieldAccessTags[typeName][fieldIndex]);
+            if (!isRefCountedType(fieldType))
+            {
+                llvm::StoreInst *store = mBuilder.CreateStore(rhs, fieldPtr);
+                tagFieldAccess(store, typeName, fieldIndex);
+                return store;
+            }
 
-                auto classIt = mClasses.find(typeName);
-                if (classIt == mClasses.end())
-                {
-                    reportFatalError("Unknown class in member assignment: " + typeName, expression);
-                    return nullptr;
-                }
+            llvm::LoadInst *oldValue = mBuilder.CreateLoad(rhs->getType(), fieldPtr);
+            tagFieldAccess(oldValue, typeName, fieldIndex);
+            llvm::StoreInst *store = mBuilder.CreateStore(rhs, fieldPtr);
+            tagFieldAccess(store, typeName, fieldIndex);
+            generateRelease(oldValue, fieldType);
+            return store;
+        }
 
-                string memberName = memberNode->getMemberName();
-                size_t fieldIndex = classIt->second->getFieldIndex(memberName);
-                if (fieldIndex == (size_t)-1)
-                {
-                    reportFatalError("Unknown field: " + memberName + " in class " + typeName, expression);
-                    return nullptr;
-                }
+        if (binLhs->getExpressionType() == ExpressionType::Index)
+        {
+            // The array owns its elements, like an object owns its fields
+            shared_ptr<IndexNode> indexNode = dynamic_pointer_cast<IndexNode>(binLhs);
+            if (isVectorType(getValueTypeName(indexNode->getArray(), nullptr)))
+            {
+                return generateLaneAssignment(indexNode, expression->getRhs());
+            }
+
+            llvm::Value *array = generateExpression(indexNode->getArray());
+            string elementType = arrayElementType(getValueTypeName(indexNode->getArray(), array));
+            llvm::Value *elementPtr = generateElementPointer(indexNode, array, elementType);
+            llvm::Value *rhs = generateOwnedValue(expression->getRhs(), elementType);
 
-                // Generate GEP to get pointer to field
-                inst = mBuilder.CreateStructGEP(structType, objectPtr, static_cast<unsigned>(fieldIndex), memberName + "_ptr");
+            llvm::MDNode *tbaaTag = getElementAccessTag(elementType);
+            llvm::StoreInst *store;
+            if (!isRefCountedType(elementType))
+            {
+                store = mBuilder.CreateStore(rhs, elementPtr);
+                store->setMetadata(llvm::LLVMContext::MD_tbaa, tbaaTag);
             }
-            else // if(binLhs->getType() == Declaration)
+            else
             {
-                llvm::Value *exp = generateExpression(binLhs);
-                inst = exp;
+                llvm::LoadInst *oldValue = mBuilder.CreateLoad(rhs->getType(), elementPtr);
+                oldValue->setMetadata(llvm::LLVMContext::MD_tbaa, tbaaTag);
+                store = mBuilder.CreateStore(rhs, elementPtr);
+                store->setMetadata(llvm::LLVMContext::MD_tbaa, tbaaTag);
+                generateRelease(oldValue, elementType);
             }
 
-            return mBuilder.CreateStore(rhs, inst);
+            releaseOwnedTemporaries({array});
+            return store;
         }
 
-        llvm::Value *lhs = generateExpression(expression->getLhs());
+        // A declaration on the left owns the value it is initialized with
+        shared_ptr<DeclarationNode> declaration = dynamic_pointer_cast<DeclarationNode>(binLhs);
+        llvm::Value *rhs = generateOwnedValue(expression->getRhs(), declaration->getTypeName());
+        llvm::Value *inst = generateExpression(binLhs);
+        mUnassignedRefCountedVars.erase(mTable.get(declaration->getName()));
+
+        return mBuilder.CreateStore(rhs, inst);
+    }
+
+    llvm::Value *CodeGen::generateCondition(shared_ptr<Expression> condition)
+    {
+        // Comparisons produce an i1. An int, e.g. a comparison the analysis folded to 0 or 1, is true when non-zero.
+        llvm::Value *value = generateExpression(condition);
+        if (value->getType()->isIntegerTy() && !value->getType()->isIntegerTy(1))
+        {
+            return mBuilder.CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0), "tobool");
+        }
+        return value;
+    }
+
+    llvm::Value *CodeGen::generateLogicalExpression(shared_ptr<BinaryExpressionNode> expression)
+    {
+        // Lower "a && b" / "a || b" (boolean/i1 values from comparisons) to a conditional branch
+        // around b, merging the short-circuit constant and b's value with a phi
+        bool isAnd = expression->getOperator() == "&&";
+        string prefix = isAnd ? "and" : "or";
+
+        llvm::Value *lhs = generateCondition(expression->getLhs());
+        llvm::BasicBlock *lhsBlock = mBuilder.GetInsertBlock();
+        llvm::Function *function = lhsBlock->getParent();
+        llvm::BasicBlock *rhsBlock = llvm::BasicBlock::Create(mContext, prefix + " rhs", function);
+        llvm::BasicBlock *end = llvm::BasicBlock::Create(mContext, prefix + " end", function);
+
+        if (isAnd)
+        {
+            mBuilder.CreateCondBr(lhs, rhsBlock, end);
+        }
+        else
+        {
+            mBuilder.CreateCondBr(lhs, end, rhsBlock);
+        }
+
+        mBuilder.SetInsertPoint(rhsBlock);
+        llvm::Value *rhs = generateCondition(expression->getRhs());
+        // The right hand side may have branched itself (nested && / ||)
+        llvm::BasicBlock *rhsExitBlock = mBuilder.GetInsertBlock();
+        mBuilder.CreateBr(end);
+
+        mBuilder.SetInsertPoint(end);
+        llvm::PHINode *phi = mBuilder.CreatePHI(llvm::Type::getInt1Ty(mContext), 2, prefix);
+        phi->addIncoming(llvm::ConstantInt::get(llvm::Type::getInt1Ty(mContext), isAnd ? 0 : 1), lhsBlock);
+        phi->addIncoming(rhs, rhsExitBlock);
+        return phi;
+    }
+
+    llvm::Value *CodeGen::generateBinaryExpression(shared_ptr<BinaryExpressionNode> expression)
+    {
+        string op = expression->getOperator();
 
-        // Handle logical operators (work with boolean/i1 values from comparisons)
-        if (op == "&&")
+        if (op == "=")
         {
-            return mBuilder.CreateAnd(lhs, rhs, "and");
+            return generateAssignment(expression);
         }
-        else if (op == "||")
+
+        // Logical operators only evaluate the right hand side when it decides the result
+        if (op == "&&" || op == "||")
         {
-            return mBuilder.CreateOr(lhs, rhs, "or");
+            return generateLogicalExpression(expression);
         }
 
-        if (lhs->getType() == llvm::Type::getDoubleTy(mContext) || rhs->getType() == llvm::Type::getDoubleTy(mContext))
+        llvm::Value *rhs = generateExpression(expression->getRhs());
+
+        llvm::Value *lhs = generateExpression(expression->getLhs());
+
+        if (lhs->getType()->isVectorTy() || rhs->getType()->isVectorTy())
+        {
+            return generateVectorMath(op, lhs, rhs);
+        }
+        else if (lhs->getType()->isFloatingPointTy() || rhs->getType()->isFloatingPointTy())
         {
             return generateFloatingPointMath(op, lhs, rhs);
         }
-        else if (lhs->getType() == llvm::Type::getInt32Ty(mContext) && rhs->getType() == llvm::Type::getInt32Ty(mContext))
+        else if (lhs->getType()->isIntegerTy() && lhs->getType() == rhs->getType())
         {
-            return generateIntegerMath(op, lhs, rhs);
+            return generateIntegerMath(op, lhs, rhs, isUnsignedType(expression->getOperandType()));
         }
         else if (lhs->getType()->isPointerTy() && rhs->getType()->isPointerTy())
         {
             // String comparison - call runtime strcmp function
             if (op == "==" || op == "!=")
             {
-                llvm::Function *strcmpFunc = getFunc("strcmp");
-                if (strcmpFunc == nullptr)
-                {
-                    reportFatalError("strcmp function not found");
-                    return nullptr;
-                }
-
-                // Call strcmp(lhs, rhs) - returns i32 (1 if equal, 0 if not)
-                std::vector<llvm::Value*> args;
-                args.push_back(lhs);
-                args.push_back(rhs);
-                llvm::Value *intResult = mBuilder.CreateCall(strcmpFunc, args, "strcmp_result");
-                // Convert i32 to i1 for boolean operations
-                llvm::Value *result = mBuilder.CreateICmpNE(intResult,
-                    llvm::ConstantInt::get(llvm::Type::getInt32Ty(mContext), 0), "streq");
+                llvm::Value *result = generateStringEquals(lhs, rhs);
+                releaseOwnedTemporaries({lhs, rhs});
 
                 if (op == "==")
                 {
@@ -816,6 +2340,11 @@ namespace codegen
                 return nullptr;
             }
         }
+        else if (lhs->getType()->isStructTy() && lhs->getType() == rhs->getType())
+        {
+            reportFatalError("Operator " + op + " is not defined for struct " + lhs->getType()->getStructName().str(), expression);
+            return nullptr;
+        }
         else
         {
             reportFatalError("Type mismatch in binary expression", expression);
@@ -824,10 +2353,10 @@ namespace codegen
 
     }
 
-    llvm::Value *CodeGen::generateIntegerMath(string op, llvm::Value *lhs, llvm::Value *rhs)
+    llvm::Value *CodeGen::generateIntegerMath(string op, llvm::Value *lhs, llvm::Value *rhs, bool isUnsigned)
     {
-        ASSERT(lhs->getType() == llvm::Type::getInt32Ty(mContext));
-        ASSERT(rhs->getType() == llvm::Type::getInt32Ty(mContext));
+        ASSERT(lhs->getType()->isIntOrIntVectorTy());
+        ASSERT(rhs->getType() == lhs->getType());
 
         if (op == "+")
         {
@@ -843,19 +2372,19 @@ namespace codegen
         }
         else if (op == "/")
         {
-            return mBuilder.CreateSDiv(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateUDiv(lhs, rhs) : mBuilder.CreateSDiv(lhs, rhs);
         }
         else if (op == "%")
         {
-            return mBuilder.CreateSRem(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateURem(lhs, rhs) : mBuilder.CreateSRem(lhs, rhs);
         }
         else if (op == "<")
         {
-            return mBuilder.CreateICmpSLT(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateICmpULT(lhs, rhs) : mBuilder.CreateICmpSLT(lhs, rhs);
         }
         else if (op == ">")
         {
-            return mBuilder.CreateICmpSGT(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateICmpUGT(lhs, rhs) : mBuilder.CreateICmpSGT(lhs, rhs);
         }
         else if (op == "==")
         {
@@ -867,11 +2396,11 @@ namespace codegen
         }
         else if (op == ">=")
         {
-            return mBuilder.CreateICmpSGE(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateICmpUGE(lhs, rhs) : mBuilder.CreateICmpSGE(lhs, rhs);
         }
         else if (op == "<=")
         {
-            return mBuilder.CreateICmpSLE(lhs, rhs);
+            return isUnsigned ? mBuilder.CreateICmpULE(lhs, rhs) : mBuilder.CreateICmpSLE(lhs, rhs);
         }
         else
         {
@@ -882,8 +2411,8 @@ namespace codegen
 
     llvm::Value *CodeGen::generateFloatingPointMath(string op, llvm::Value *lhs, llvm::Value *rhs)
     {
-        ASSERT(lhs->getType() == llvm::Type::getInt32Ty(mContext) || lhs->getType() == llvm::Type::getDoubleTy(mContext));
-        ASSERT(rhs->getType() == llvm::Type::getInt32Ty(mContext) || rhs->getType() == llvm::Type::getDoubleTy(mContext));
+        ASSERT(lhs->getType() == llvm::Type::getInt32Ty(mContext) || lhs->getType()->getScalarType()->isFloatingPointTy());
+        ASSERT(rhs->getType() == llvm::Type::getInt32Ty(mContext) || rhs->getType()->getScalarType()->isFloatingPointTy());
 
         // Promotion for floats and ints to work together -- very fragile. Need to do better type checking.
         if (lhs->getType() == llvm::Type::getInt32Ty(mContext))
@@ -947,6 +2476,140 @@ namespace codegen
         }
     }
 
+    llvm::Value *CodeGen::generateVectorMath(string op, llvm::Value *lhs, llvm::Value *rhs)
+    {
+        // Lane by lane, a scalar operand is used in every lane. Comparisons give an i32 mask
+        // holding -1 in the lanes where they hold and 0 elsewhere.
+        llvm::FixedVectorType *vectorType = llvm::cast<llvm::FixedVectorType>(lhs->getType()->isVectorTy() ? lhs->getType() : rhs->getType());
+        unsigned lanes = vectorType->getNumElements();
+        if (!lhs->getType()->isVectorTy())
+        {
+            lhs = mBuilder.CreateVectorSplat(lanes, lhs, "splat");
+        }
+        if (!rhs->getType()->isVectorTy())
+        {
+            rhs = mBuilder.CreateVectorSplat(lanes, rhs, "splat");
+        }
+
+        llvm::Value *result = vectorType->getElementType()->isFloatingPointTy()
+            ? generateFloatingPointMath(op, lhs, rhs) : generateIntegerMath(op, lhs, rhs);
+        if (result->getType()->getScalarType()->isIntegerTy(1))
+        {
+            result = mBuilder.CreateSExt(result, llvm::FixedVectorType::get(llvm::Type::getInt32Ty(mContext), lanes), "mask");
+        }
+        return result;
+    }
+
+    llvm::Value *CodeGen::generateLaneIndex(shared_ptr<Expression> index, llvm::FixedVectorType *vectorType)
+    {
+        // The lane count is a power of two, an index past it wraps around instead of reading
+        // past the vector. Literal indices are checked by the type inference.
+        llvm::Value *value = generateExpression(index);
+        return mBuilder.CreateAnd(value, llvm::ConstantInt::get(value->getType(), vectorType->getNumElements() - 1), "lane_index");
+    }
+
+    llvm::Value *CodeGen::generateLaneAssignment(shared_ptr<IndexNode> indexNode, shared_ptr<Expression> rhsExpr)
+    {
+        // "v[i] = x" replaces one lane of the vector where it is stored
+        string vectorTypeName;
+        llvm::Value *vectorPtr = generateValueAddress(indexNode->getArray(), vectorTypeName);
+        if (vectorPtr == nullptr)
+        {
+            reportFatalError("Cannot assign to a lane of a temporary vector", indexNode);
+            return nullptr;
+        }
+
+        llvm::FixedVectorType *vectorType = llvm::cast<llvm::FixedVectorType>(stringToType(vectorTypeName));
+        llvm::Value *lane = generateLaneIndex(indexNode->getIndex(), vectorType);
+        llvm::Value *value = generateExpression(rhsExpr);
+        llvm::Value *vector = mBuilder.CreateLoad(vectorType, vectorPtr, "vector");
+        return mBuilder.CreateStore(mBuilder.CreateInsertElement(vector, value, lane), vectorPtr);
+    }
+
+    llvm::Value *CodeGen::generateVectorBuiltin(shared_ptr<FunctionCallNode> call)
+    {
+        // Vector constructors, shuffles, selects and reductions. The type inference checked the
+        // arguments, null when the call isn't one of these.
+        string name = call->getName();
+        vector<shared_ptr<Expression>> args = call->getArgs();
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+
+        if (isVectorType(name))
+        {
+            // "f64x4(x)" puts x in every lane, "f64x4(a, b, c, d)" gives each lane its own value
+            llvm::FixedVectorType *vectorType = llvm::cast<llvm::FixedVectorType>(stringToType(name));
+            if (args.size() == 1)
+            {
+                return mBuilder.CreateVectorSplat(vectorType->getNumElements(), generateExpression(args[0]), "splat");
+            }
+
+            llvm::Value *vector = llvm::PoisonValue::get(vectorType);
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                vector = mBuilder.CreateInsertElement(vector, generateExpression(args[i]), static_cast<uint64_t>(i));
+            }
+            return vector;
+        }
+        else if (name == "shuffle")
+        {
+            // "shuffle(v, 3, 2, 1, 0)" picks lanes of v, "shuffle(a, b, 0, 4, 1, 5)" numbers the lanes of b after those of a
+            llvm::Value *first = generateExpression(args[0]);
+            llvm::Value *second = llvm::PoisonValue::get(first->getType());
+            size_t firstIndex = 1;
+            if (args[1]->getExpressionType() != ExpressionType::IntegerLiteral)
+            {
+                second = generateExpression(args[1]);
+                firstIndex = 2;
+            }
+
+            vector<int> mask;
+            for (size_t i = firstIndex; i < args.size(); ++i)
+            {
+                mask.push_back(static_cast<int>(dynamic_pointer_cast<IntegerLiteralNode>(args[i])->getValue()));
+            }
+            return mBuilder.CreateShuffleVector(first, second, mask, "shuffle");
+        }
+        else if (name == "select")
+        {
+            // Lanes of a where the mask is set, of b elsewhere
+            llvm::Value *mask = generateExpression(args[0]);
+            llvm::Value *condition = mBuilder.CreateICmpNE(mask, llvm::Constant::getNullValue(mask->getType()), "mask");
+            return mBuilder.CreateSelect(condition, generateExpression(args[1]), generateExpression(args[2]), "select");
+        }
+        else if (name == "reduce_add" || name == "reduce_min" || name == "reduce_max")
+        {
+            llvm::Value *vector = generateExpression(args[0]);
+            llvm::Type *laneType = llvm::cast<llvm::FixedVectorType>(vector->getType())->getElementType();
+            llvm::Value *result;
+            if (!laneType->isFloatingPointTy())
+            {
+                result = name == "reduce_add" ? mBuilder.CreateAddReduce(vector)
+                    : name == "reduce_min" ? mBuilder.CreateIntMinReduce(vector, true) : mBuilder.CreateIntMaxReduce(vector, true);
+            }
+            else if (name == "reduce_add")
+            {
+                // The lanes are added in whatever order is fastest, a tree of shuffles rather than a chain
+                llvm::CallInst *sum = mBuilder.CreateFAddReduce(llvm::ConstantFP::getNegativeZero(laneType), vector);
+                sum->setHasAllowReassoc(true);
+                result = sum;
+            }
+            else
+            {
+                result = name == "reduce_min" ? mBuilder.CreateFPMinReduce(vector) : mBuilder.CreateFPMaxReduce(vector);
+            }
+            return result;
+        }
+        else if (name == "any" || name == "all")
+        {
+            // Whether some or every lane of a mask is set
+            llvm::Value *mask = generateExpression(args[0]);
+            llvm::Value *set = mBuilder.CreateICmpNE(mask, llvm::Constant::getNullValue(mask->getType()), "set");
+            llvm::Value *result = name == "any" ? mBuilder.CreateOrReduce(set) : mBuilder.CreateAndReduce(set);
+            return mBuilder.CreateZExt(result, int32Ty, name);
+        }
+        return nullptr;
+    }
+
     llvm::Value *CodeGen::generateFunctionCall(shared_ptr<FunctionCallNode> expression)
     {
         shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
@@ -966,8 +2629,58 @@ namespace codegen
             func = getFunc(call->getName());
         }
 
+        // Built-in len reads the array header, unless the program defines its own
+        if (func == nullptr && call->getName() == "len" && call->argCount() == 1)
+        {
+            llvm::Value *array = generateExpression(call->getArgs()[0]);
+            llvm::Value *length = generateArrayLength(array);
+            releaseOwnedTemporaries({array});
+            return length;
+        }
+
+        if (call->isSpawned())
+        {
+            return generateSpawn(call, func);
+        }
+
+        // Built-in join waits for a task, unless the program defines its own
+        if (func == nullptr && call->getName() == "join" && call->argCount() == 1)
+        {
+            return generateJoin(call);
+        }
+
+        // Built-in hash of a HashMap key, unless the program defines its own
+        if (func == nullptr && call->getName() == "hash" && call->argCount() == 1)
+        {
+            return generateHash(call->getArgs()[0]);
+        }
+
+        // "Point(1, 2)" builds a struct from its fields in declaration order, nothing is allocated
+        if (func == nullptr && isValueType(call->getName()))
+        {
+            string typeName = call->getName();
+            vector<shared_ptr<Field>> fields = mClasses[typeName]->getFields();
+            if (call->argCount() != fields.size())
+            {
+                reportFatalError("Struct " + typeName + " expects " + to_string(fields.size()) + " field value(s)", call);
+                return nullptr;
+            }
+
+            llvm::Value *value = llvm::UndefValue::get(mStructTypes[typeName]);
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                value = mBuilder.CreateInsertValue(value, generateExpression(call->getArgs()[i]), {getFieldSlot(typeName, i)});
+            }
+            return value;
+        }
+
         if (func == nullptr)
         {
+            llvm::Value *value = generateVectorBuiltin(call);
+            if (value != nullptr)
+            {
+                return value;
+            }
             reportFatalError("Function " + call->getName() + " is not defined.", call);
             return nullptr;
         }
@@ -988,7 +2701,18 @@ namespace codegen
             args.push_back(arg);
         }
 
-        return mBuilder.CreateCall(func, args);
+        llvm::Value *result;
+        if (func == getFunc("strcmp") && args.size() == 2)
+        {
+            // Same fast paths and folding as ==
+            result = mBuilder.CreateZExt(generateStringEquals(args[0], args[1]), llvm::Type::getInt32Ty(mContext));
+        }
+        else
+        {
+            result = mBuilder.CreateCall(func, args);
+        }
+        releaseOwnedTemporaries(args);
+        return result;
     }
 
     llvm::Value *CodeGen::generateQualifiedCall(shared_ptr<QualifiedCallNode> expression)
@@ -1019,12 +2743,30 @@ namespace codegen
             args.push_back(arg);
         }
 
-        return mBuilder.CreateCall(func, args);
+        llvm::Value *result = mBuilder.CreateCall(func, args);
+        releaseOwnedTemporaries(args);
+        return result;
     }
 
     llvm::Value *CodeGen::generateAlloc(shared_ptr<AllocNode> allocNode)
     {
         string typeName = allocNode->getTypeName();
+        if (!arrayElementType(typeName).empty())
+        {
+            // alloc [T](length): one allocation holding the header and the zeroed elements
+            vector<shared_ptr<Expression>> args = allocNode->getArgs();
+            if (args.size() != 1)
+            {
+                reportFatalError("Array allocation expects a length", allocNode);
+                return nullptr;
+            }
+
+            llvm::Type *elementType = stringToType(arrayElementType(typeName));
+            uint64_t elementSize = mModule->getDataLayout().getTypeAllocSize(elementType);
+            llvm::Value *length = generateExpression(args[0]);
+            llvm::Value *sizeVal = llvm::ConstantInt::get(llvm::Type::getInt64Ty(mContext), elementSize);
+            return mBuilder.CreateCall(getFunc("array_new"), {length, sizeVal, getArrayTypeInfo(typeName)}, "array");
+        }
 
         // Look up the struct type
         auto structIt = mStructTypes.find(typeName);
@@ -1045,11 +2787,11 @@ namespace codegen
         shared_ptr<ClassDeclaration> classDecl = classIt->second;
         vector<shared_ptr<Field>> fields = classDecl->getFields();
 
-        // Get the size of the struct
+        // Get the size of the struct, the header is part of it
         const llvm::DataLayout& dataLayout = mModule->getDataLayout();
         uint64_t structSize = dataLayout.getTypeAllocSize(structType);
 
-        // Allocate memory on the heap via silver_alloc (includes ref count header, starts at refcount=1)
+        // Allocate memory on the heap via silver_alloc (fills in the header, starts at refcount=1)
         llvm::Function *allocFunc = getFunc("alloc");
         if (allocFunc == nullptr)
         {
@@ -1058,14 +2800,24 @@ namespace codegen
         }
 
         llvm::Value *sizeVal = llvm::ConstantInt::get(llvm::Type::getInt64Ty(mContext), structSize);
-        llvm::Value *rawPtr = mBuilder.CreateCall(allocFunc, {sizeVal}, "alloc_raw");
+        llvm::Value *typeInfo = mTypeInfos[typeName];
+        llvm::Value *rawPtr = mBuilder.CreateCall(allocFunc, {sizeVal, typeInfo}, "alloc_raw");
 
         // Cast the i8* to the struct pointer type
         llvm::Type *structPtrType = llvm::PointerType::get(mContext, 0);
         llvm::Value *structPtr = mBuilder.CreateBitCast(rawPtr, structPtrType, typeName + "_ptr");
 
-        // Initialize fields with provided arguments
+        // Initialize fields with provided arguments, "alloc C()" zeroes them instead (null strings,
+        // arrays and objects, which release ignores)
         vector<shared_ptr<Expression>> args = allocNode->getArgs();
+        if (args.empty() && !fields.empty())
+        {
+            uint64_t fieldsStart = dataLayout.getStructLayout(structType)->getElementOffset(1) + 4;
+            llvm::Value *fieldsPtr = mBuilder.CreateInBoundsGEP(llvm::Type::getInt8Ty(mContext), structPtr,
+                {llvm::ConstantInt::get(llvm::Type::getInt64Ty(mContext), fieldsStart)}, "fields_ptr");
+            mBuilder.CreateMemSet(fieldsPtr, llvm::ConstantInt::get(llvm::Type::getInt8Ty(mContext), 0), structSize - fieldsStart, llvm::MaybeAlign(4));
+            return structPtr;
+        }
         if (args.size() != fields.size())
         {
             reportFatalError("Alloc argument count doesn't match field count for " + typeName, allocNode);
@@ -1074,44 +2826,126 @@ namespace codegen
 
         for (size_t i = 0; i < args.size(); ++i)
         {
-            // Generate the value for this field
-            llvm::Value *fieldValue = generateExpression(args[i]);
+            // Generate the value for this field, the object owns it
+            llvm::Value *fieldValue = generateOwnedValue(args[i], fields[i]->getType());
 
             // Get pointer to the field using GEP
-            llvm::Value *fieldPtr = mBuilder.CreateStructGEP(structType, structPtr, static_cast<unsigned>(i), fields[i]->getName() + "_ptr");
+            llvm::Value *fieldPtr = mBuilder.CreateStructGEP(structType, structPtr, getFieldSlot(typeName, i), fields[i]->getName() + "_ptr");
 
             // Store the value
-            mBuilder.CreateStore(fieldValue, fieldPtr);
+            tagFieldAccess(mBuilder.CreateStore(fieldValue, fieldPtr), typeName, i);
         }
 
         return structPtr;
     }
 
-    llvm::Value *CodeGen::generateMemberAccess(shared_ptr<MemberAccessNode> memberNode)
+    llvm::Value *CodeGen::generateValueAddress(shared_ptr<Expression> expr, string &typeName)
     {
-        // Get the object expression - should be an identifier for a struct variable
-        shared_ptr<Expression> objectExpr = memberNode->getObject();
+        // Where a struct or vector is stored: a local, 'this' in a struct method, a field or an array
+        // element. Other struct values, like the result of a call, are copied to a temporary. Null
+        // when the expression isn't a struct.
+        switch (expr->getExpressionType())
+        {
+        case ExpressionType::Identifier:
+        {
+            string varName = dynamic_pointer_cast<IdentifierNode>(expr)->getValue();
+            if (varName == "this" && mThisPtr != nullptr)
+            {
+                if (!isValueType(mCurrentClass))
+                {
+                    return nullptr;
+                }
+                typeName = mCurrentClass;
+                return mThisPtr;
+            }
+            if (!isValueType(mVariableTypes.get(varName)) && !isVectorType(mVariableTypes.get(varName)))
+            {
+                return nullptr;
+            }
+            typeName = mVariableTypes.get(varName);
+            return mTable.get(varName);
+        }
+        case ExpressionType::MemberAccess:
+        {
+            string fieldType = getValueTypeName(expr, nullptr);
+            if (!isValueType(fieldType) && !isVectorType(fieldType))
+            {
+                return nullptr;
+            }
+            string className;
+            size_t fieldIndex;
+            llvm::Value *fieldPtr = generateFieldPointer(dynamic_pointer_cast<MemberAccessNode>(expr), className, fieldIndex);
+            // The field can be updated through its address, its loads aren't invariant
+            mAssignedFields.insert(mFieldAccessTags[className][fieldIndex]);
+            typeName = fieldType;
+            return fieldPtr;
+        }
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> indexNode = dynamic_pointer_cast<IndexNode>(expr);
+            string elementType = getValueTypeName(expr, nullptr);
+            if (!isValueType(elementType) && !isVectorType(elementType))
+            {
+                return nullptr;
+            }
+            llvm::Value *array = generateExpression(indexNode->getArray());
+            llvm::Value *elementPtr = generateElementPointer(indexNode, array, elementType);
+            typeName = elementType;
+            if (getOwnedTemporaryType(array).empty())
+            {
+                return elementPtr;
+            }
 
-        // We need to find the type name of the object
-        string typeName;
-        llvm::Value *objectPtr;
+            // The array dies with this expression, work on a copy of the element
+            llvm::Value *element = mBuilder.CreateLoad(stringToType(elementType), elementPtr, "element");
+            releaseOwnedTemporaries({array});
+            llvm::AllocaInst *copy = createEntryAlloca(element->getType(), "element");
+            mBuilder.CreateStore(element, copy);
+            return copy;
+        }
+        default:
+        {
+            llvm::Value *value = generateExpression(expr);
+            llvm::StructType *structType = llvm::dyn_cast<llvm::StructType>(value->getType());
+            if (structType == nullptr || !structType->hasName() || !isValueType(structType->getName().str()))
+            {
+                return nullptr;
+            }
+            typeName = structType->getName().str();
+            llvm::AllocaInst *temporary = createEntryAlloca(structType, "temporary");
+            mBuilder.CreateStore(value, temporary);
+            return temporary;
+        }
+        }
+    }
 
-        if (objectExpr->getExpressionType() == ExpressionType::Identifier)
+    llvm::Value *CodeGen::generateFieldPointer(shared_ptr<MemberAccessNode> memberNode, string &className, size_t &fieldIndex)
+    {
+        // The object is a class instance held in a variable or 'this', or a struct stored anywhere
+        shared_ptr<Expression> objectExpr = memberNode->getObject();
+        llvm::Value *objectPtr = generateValueAddress(objectExpr, className);
+        if (objectPtr == nullptr)
         {
             shared_ptr<IdentifierNode> ident = dynamic_pointer_cast<IdentifierNode>(objectExpr);
+            if (ident == nullptr)
+            {
+                reportFatalError("Member access on non-identifier expression not yet supported", memberNode);
+                return nullptr;
+            }
+
             string varName = ident->getValue();
 
             // Handle 'this' specially - it's already a pointer, not an alloca
             if (varName == "this" && mThisPtr != nullptr)
             {
                 objectPtr = mThisPtr;
-                typeName = mCurrentClass;
+                className = mCurrentClass;
             }
             else
             {
                 // Look up the type from our tracking table
-                typeName = mVariableTypes.get(varName);
-                if (typeName.empty())
+                className = mVariableTypes.get(varName);
+                if (className.empty())
                 {
                     reportFatalError("Unknown variable in member access: " + varName, memberNode);
                     return nullptr;
@@ -1122,81 +2956,366 @@ namespace codegen
                 objectPtr = mBuilder.CreateLoad(inst->getAllocatedType(), inst);
             }
         }
-        else
+
+        // Look up the class declaration
+        auto classIt = mClasses.find(className);
+        if (classIt == mClasses.end())
         {
-            reportFatalError("Member access on non-identifier expression not yet supported", memberNode);
+            reportFatalError("Unknown class in member access: " + className, memberNode);
             return nullptr;
         }
 
-        // Look up the struct type
-        auto structIt = mStructTypes.find(typeName);
-        if (structIt == mStructTypes.end())
+        // Find the field index
+        string memberName = memberNode->getMemberName();
+        fieldIndex = classIt->second->getFieldIndex(memberName);
+        if (fieldIndex == (size_t)-1)
+        {
+            reportFatalError("Unknown field: " + memberName + " in class " + className, memberNode);
+            return nullptr;
+        }
+
+        // Generate GEP to get pointer to field
+        return mBuilder.CreateStructGEP(mStructTypes[className], objectPtr, getFieldSlot(className, fieldIndex), memberName + "_ptr");
+    }
+
+    llvm::Value *CodeGen::generateMemberAccess(shared_ptr<MemberAccessNode> memberNode)
+    {
+        string typeName;
+        size_t fieldIndex;
+        llvm::Value *fieldPtr = generateFieldPointer(memberNode, typeName, fieldIndex);
+
+        // Load the field value
+        string fieldTypeName = mClasses[typeName]->getFields()[fieldIndex]->getType();
+        llvm::LoadInst *value = mBuilder.CreateLoad(stringToType(fieldTypeName), fieldPtr, memberNode->getMemberName());
+        tagFieldAccess(value, typeName, fieldIndex);
+        return value;
+    }
+
+    llvm::GlobalVariable *CodeGen::getArrayTypeInfo(const string& typeName)
+    {
+        // Array type descriptors are emitted on first use. Arrays of strings, objects or arrays
+        // get a destructor that releases every element before silver_release frees the buffer.
+        auto it = mTypeInfos.find(typeName);
+        if (it != mTypeInfos.end())
+        {
+            return it->second;
+        }
+
+        string elementType = arrayElementType(typeName);
+        llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::Constant *destroy = llvm::ConstantPointerNull::get(llvm::PointerType::get(mContext, 0));
+        if (isRefCountedType(elementType))
+        {
+            llvm::FunctionType *destroyTy = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {ptrTy}, false);
+            llvm::Function *destroyFunc = llvm::Function::Create(destroyTy, llvm::Function::InternalLinkage,
+                typeName + ".destroy", mModule);
+            llvm::Value *array = destroyFunc->getArg(0);
+
+            llvm::IRBuilderBase::InsertPointGuard guard(mBuilder);
+            llvm::BasicBlock *entry = llvm::BasicBlock::Create(mContext, "entry", destroyFunc);
+            llvm::BasicBlock *loop = llvm::BasicBlock::Create(mContext, "release element", destroyFunc);
+            llvm::BasicBlock *end = llvm::BasicBlock::Create(mContext, "end", destroyFunc);
+            mBuilder.SetInsertPoint(entry);
+            mBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
+            llvm::Value *zero = llvm::ConstantInt::get(int32Ty, 0);
+            llvm::Value *length = generateArrayLength(array);
+            mBuilder.CreateCondBr(mBuilder.CreateICmpSGT(length, zero), loop, end);
+
+            mBuilder.SetInsertPoint(loop);
+            llvm::PHINode *index = mBuilder.CreatePHI(int32Ty, 2, "i");
+            index->addIncoming(zero, entry);
+            llvm::LoadInst *element = mBuilder.CreateLoad(ptrTy, generateElementAddress(array, index, elementType));
+            element->setMetadata(llvm::LLVMContext::MD_tbaa, getElementAccessTag(elementType));
+            generateRelease(element, elementType);
+            llvm::Value *next = mBuilder.CreateNSWAdd(index, llvm::ConstantInt::get(int32Ty, 1), "next");
+            index->addIncoming(next, loop);
+            mBuilder.CreateCondBr(mBuilder.CreateICmpSLT(next, length), loop, end);
+
+            mBuilder.SetInsertPoint(end);
+            mBuilder.CreateRetVoid();
+            destroy = destroyFunc;
+        }
+
+        // Same shape as the class descriptors, must match SilverTypeInfo in the runtime
+        llvm::Constant *name = mBuilder.CreateGlobalString(typeName, typeName + ".name", 0, mModule);
+        llvm::StructType *typeInfoType = llvm::StructType::get(mContext, {ptrTy, ptrTy});
+        llvm::GlobalVariable *typeInfo = new llvm::GlobalVariable(*mModule, typeInfoType, true,
+            llvm::GlobalValue::PrivateLinkage, llvm::ConstantStruct::get(typeInfoType, {name, destroy}),
+            typeName + ".typeinfo");
+        mTypeInfos[typeName] = typeInfo;
+
+        LOG("Codegen: Created type descriptor for array type %s\n", typeName.c_str());
+        return typeInfo;
+    }
+
+    string CodeGen::getValueTypeName(shared_ptr<Expression> expr, llvm::Value *value)
+    {
+        // The Silver type of a variable, a field or an element, found without generating code, or of
+        // a new reference handed over by an allocation or a call.
+        string ownedType = getOwnedTemporaryType(value);
+        if (!ownedType.empty())
+        {
+            return ownedType;
+        }
+
+        switch (expr->getExpressionType())
+        {
+        case ExpressionType::Identifier:
+            return mVariableTypes.get(dynamic_pointer_cast<IdentifierNode>(expr)->getValue());
+        case ExpressionType::MemberAccess:
+        {
+            // Fields of fields are structs stored inline
+            shared_ptr<MemberAccessNode> member = dynamic_pointer_cast<MemberAccessNode>(expr);
+            auto classIt = mClasses.find(getValueTypeName(member->getObject(), nullptr));
+            if (classIt == mClasses.end())
+            {
+                return "";
+            }
+
+            size_t fieldIndex = classIt->second->getFieldIndex(member->getMemberName());
+            return fieldIndex == (size_t)-1 ? "" : classIt->second->getFields()[fieldIndex]->getType();
+        }
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> inner = dynamic_pointer_cast<IndexNode>(expr);
+            return arrayElementType(getValueTypeName(inner->getArray(), nullptr));
+        }
+        default:
+            return "";
+        }
+    }
+
+    llvm::Value *CodeGen::generateHash(shared_ptr<Expression> key)
+    {
+        llvm::Type *i32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::Type *i64Ty = llvm::Type::getInt64Ty(mContext);
+        llvm::Value *value = generateExpression(key);
+
+        // Strings carry their hash in the last word of the header
+        if (value->getType()->isPointerTy())
+        {
+            llvm::Value *hashPtr = mBuilder.CreateInBoundsGEP(i32Ty, value, {llvm::ConstantInt::get(i32Ty, -1, true)}, "hash_ptr");
+            llvm::Value *hash = mBuilder.CreateLoad(i32Ty, hashPtr, "hash");
+            releaseOwnedTemporaries({value});
+            return hash;
+        }
+
+        // Fibonacci hashing: the high half of the product by 2^64 / golden ratio depends on every
+        // bit of the key, so keys that only differ in their high bits still spread out
+        llvm::Value *wide = mBuilder.CreateSExtOrTrunc(value, i64Ty);
+        llvm::Value *product = mBuilder.CreateMul(wide, llvm::ConstantInt::get(i64Ty, 0x9E3779B97F4A7C15ull));
+        return mBuilder.CreateTrunc(mBuilder.CreateLShr(product, 32), i32Ty, "hash");
+    }
+
+    llvm::Function *CodeGen::getTaskEntry(llvm::Function *func, const string& taskType, llvm::StructType *&frameType)
+    {
+        // A task's frame holds the result of the spawned function followed by its arguments.
+        // "<f>.task" runs f on the arguments in the frame, stores the result and releases the
+        // arguments; "<f>.task.drop" releases a result that is a reference when the task is freed.
+        string resultType = taskResultType(taskType);
+        const vector<string> &argTypes = mFunctionArgumentTypes[func->getName().str()];
+        vector<llvm::Type *> slots;
+        if (!func->getReturnType()->isVoidTy())
+        {
+            slots.push_back(func->getReturnType());
+        }
+        unsigned firstArg = static_cast<unsigned>(slots.size());
+        for (llvm::Argument &arg : func->args())
+        {
+            slots.push_back(arg.getType());
+        }
+        frameType = llvm::StructType::get(mContext, slots);
+
+        string entryName = func->getName().str() + ".task";
+        if (llvm::Function *existing = mModule->getFunction(entryName))
+        {
+            return existing;
+        }
+
+        llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+        llvm::FunctionType *entryTy = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {ptrTy}, false);
+        llvm::Function *entry = llvm::Function::Create(entryTy, llvm::Function::InternalLinkage, entryName, mModule);
+        llvm::IRBuilderBase::InsertPointGuard guard(mBuilder);
+        mBuilder.SetInsertPoint(llvm::BasicBlock::Create(mContext, "entry", entry));
+        mBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+        vector<llvm::Value *> args;
+        for (unsigned i = 0; i < func->arg_size(); ++i)
+        {
+            llvm::Value *argPtr = mBuilder.CreateStructGEP(frameType, entry->getArg(0), firstArg + i);
+            args.push_back(mBuilder.CreateLoad(slots[firstArg + i], argPtr, func->getArg(i)->getName()));
+        }
+        llvm::Value *result = mBuilder.CreateCall(func, args);
+        if (firstArg > 0)
+        {
+            mBuilder.CreateStore(result, mBuilder.CreateStructGEP(frameType, entry->getArg(0), 0));
+        }
+        for (size_t i = 0; i < args.size(); ++i)
         {
-            reportFatalError("Unknown struct type in member access: " + typeName, memberNode);
-            return nullptr;
+            if (isRefCountedType(argTypes[i]))
+            {
+                generateRelease(args[i], argTypes[i]);
+            }
         }
-        llvm::StructType *structType = structIt->second;
+        mBuilder.CreateRetVoid();
+        alignVectorAccesses(*entry);
 
-        // Look up the class declaration
-        auto classIt = mClasses.find(typeName);
-        if (classIt == mClasses.end())
+        if (isRefCountedType(resultType))
         {
-            reportFatalError("Unknown class in member access: " + typeName, memberNode);
-            return nullptr;
+            llvm::Function *drop = llvm::Function::Create(entryTy, llvm::Function::InternalLinkage, entryName + ".drop", mModule);
+            mBuilder.SetInsertPoint(llvm::BasicBlock::Create(mContext, "entry", drop));
+            generateRelease(mBuilder.CreateLoad(ptrTy, drop->getArg(0), "result"), resultType);
+            mBuilder.CreateRetVoid();
         }
-        shared_ptr<ClassDeclaration> classDecl = classIt->second;
 
-        // Find the field index
-        string memberName = memberNode->getMemberName();
-        size_t fieldIndex = classDecl->getFieldIndex(memberName);
-        if (fieldIndex == (size_t)-1)
+        mTaskTypes[entry] = taskType;
+        LOG("Codegen: Created task entry for %s\n", func->getName().str().c_str());
+        return entry;
+    }
+
+    llvm::Value *CodeGen::generateSpawn(shared_ptr<FunctionCallNode> call, llvm::Function *func)
+    {
+        // Only functions generated from Silver code have parameter types to hand over
+        if (func == nullptr || mFunctionArgumentTypes.find(func->getName().str()) == mFunctionArgumentTypes.end())
         {
-            reportFatalError("Unknown field: " + memberName + " in class " + typeName, memberNode);
+            reportFatalError("Cannot spawn " + call->getName() + ", only functions can be spawned", call);
             return nullptr;
         }
 
-        // Get field type
-        vector<shared_ptr<Field>> fields = classDecl->getFields();
-        string fieldTypeName = fields[fieldIndex]->getType();
-        llvm::Type *fieldType;
-        if (fieldTypeName == "int")
+        llvm::StructType *frameType;
+        llvm::Function *entry = getTaskEntry(func, call->getTaskType(), frameType);
+        llvm::Function *drop = mModule->getFunction(entry->getName().str() + ".drop");
+        llvm::Constant *dropVal = drop != nullptr ? static_cast<llvm::Constant *>(drop)
+            : llvm::ConstantPointerNull::get(llvm::PointerType::get(mContext, 0));
+
+        uint64_t frameSize = mModule->getDataLayout().getTypeAllocSize(frameType);
+        llvm::Value *sizeVal = llvm::ConstantInt::get(llvm::Type::getInt64Ty(mContext), frameSize);
+        llvm::Value *task = mBuilder.CreateCall(getFunc("task_new"), {sizeVal, entry, dropVal}, "task");
+        llvm::Value *frame = mBuilder.CreateCall(getFunc("task_frame"), {task}, "frame");
+
+        // The frame owns its arguments, the caller may let go of them while the task runs
+        const vector<string> &argTypes = mFunctionArgumentTypes[func->getName().str()];
+        unsigned firstArg = frameType->getNumElements() - static_cast<unsigned>(func->arg_size());
+        for (size_t i = 0; i < call->argCount(); ++i)
         {
-            fieldType = llvm::Type::getInt32Ty(mContext);
+            llvm::Value *arg = generateOwnedValue(call->getArgs()[i], argTypes[i]);
+            mBuilder.CreateStore(arg, mBuilder.CreateStructGEP(frameType, frame, firstArg + static_cast<unsigned>(i)));
         }
-        else if (fieldTypeName == "float")
+
+        mBuilder.CreateCall(getFunc("task_spawn"), {task});
+        return task;
+    }
+
+    llvm::Value *CodeGen::generateJoin(shared_ptr<FunctionCallNode> call)
+    {
+        // The result stays in the task's frame, which starts with it, and is borrowed from the task
+        // like a field from its object
+        string resultType = taskResultType(call->getTaskType());
+        llvm::Value *task = generateExpression(call->getArgs()[0]);
+        llvm::Value *frame = mBuilder.CreateCall(getFunc("task_join"), {task}, "frame");
+        llvm::Type *type = stringToType(resultType);
+        llvm::Value *result = type->isVoidTy() ? nullptr : mBuilder.CreateLoad(type, frame, "result");
+
+        if (!getOwnedTemporaryType(task).empty())
         {
-            fieldType = llvm::Type::getDoubleTy(mContext);
+            if (isRefCountedType(resultType))
+            {
+                reportFatalError("Cannot join a temporary task of " + resultType + ", assign it to a variable first", call);
+                return nullptr;
+            }
+            releaseOwnedTemporaries({task});
         }
-        else if (fieldTypeName == "string")
+        return result;
+    }
+
+    llvm::Value *CodeGen::generateArrayLength(llvm::Value *array)
+    {
+        // The length never changes after silver_array_new, so its loads can be shared. Like fields
+        // that only alloc writes it is an invariant group, the memory of a freed array gets reused.
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::StructType *headerType = llvm::StructType::get(mContext, {llvm::PointerType::get(mContext, 0), int32Ty, int32Ty});
+        llvm::Value *lengthPtr = mBuilder.CreateStructGEP(headerType, array, 2, "length_ptr");
+        llvm::LoadInst *length = mBuilder.CreateLoad(int32Ty, lengthPtr, "length");
+        length->setMetadata(llvm::LLVMContext::MD_tbaa, getElementAccessTag("array length"));
+        length->setMetadata(llvm::LLVMContext::MD_invariant_group, llvm::MDNode::get(mContext, {}));
+        return length;
+    }
+
+    llvm::Value *CodeGen::generateElementAddress(llvm::Value *array, llvm::Value *index, const string& elementType)
+    {
+        // Arrays are { type descriptor, ref count, length, elements }, must match SilverArrayHeader in the runtime.
+        // The elements follow the header directly, whatever their alignment, as silver_array_new places them.
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::StructType *headerType = llvm::StructType::get(mContext, {llvm::PointerType::get(mContext, 0), int32Ty, int32Ty});
+        uint64_t headerSize = mModule->getDataLayout().getTypeAllocSize(headerType);
+        llvm::Value *elements = mBuilder.CreateConstInBoundsGEP1_64(llvm::Type::getInt8Ty(mContext), array, headerSize, "elements");
+        llvm::Value *offset = mBuilder.CreateSExt(index, llvm::Type::getInt64Ty(mContext));
+        return mBuilder.CreateInBoundsGEP(stringToType(elementType), elements, offset, "element_ptr");
+    }
+
+    llvm::Value *CodeGen::generateElementPointer(shared_ptr<IndexNode> indexNode, llvm::Value *array, const string& elementType)
+    {
+        if (elementType.empty())
         {
-            fieldType = llvm::PointerType::get(mContext, 0);
+            reportFatalError("Cannot index a value that is not an array", indexNode);
+            return nullptr;
         }
-        else
+
+        llvm::Value *index = generateExpression(indexNode->getIndex());
+        if (!indexNode->isBoundsChecked())
         {
-            reportFatalError("Unsupported field type in member access: " + fieldTypeName, memberNode);
-            return nullptr;
+            LOG("Codegen: Index at line %d is in range, no bounds check\n", indexNode->line());
+            return generateElementAddress(array, index, elementType);
         }
 
-        // Generate GEP to get pointer to field
-        llvm::Value *fieldPtr = mBuilder.CreateStructGEP(structType, objectPtr, static_cast<unsigned>(fieldIndex), memberName + "_ptr");
+        // A single unsigned compare also catches negative indices
+        llvm::Value *length = generateArrayLength(array);
+        llvm::Function *function = mBuilder.GetInsertBlock()->getParent();
+        llvm::BasicBlock *inBounds = llvm::BasicBlock::Create(mContext, "index ok", function);
+        llvm::BasicBlock *outOfBounds = llvm::BasicBlock::Create(mContext, "index out of bounds", function);
+        llvm::MDNode *weights = llvm::MDBuilder(mContext).createBranchWeights(1 << 20, 1);
+        mBuilder.CreateCondBr(mBuilder.CreateICmpULT(index, length, "in_bounds"), inBounds, outOfBounds, weights);
 
-        // Load the field value
-        return mBuilder.CreateLoad(fieldType, fieldPtr, memberName);
+        mBuilder.SetInsertPoint(outOfBounds);
+        mBuilder.CreateCall(getFunc("array_bounds_fail"), {index, length});
+        mBuilder.CreateUnreachable();
+
+        mBuilder.SetInsertPoint(inBounds);
+        return generateElementAddress(array, index, elementType);
     }
 
-    void CodeGen::generateClassMethods(shared_ptr<ClassDeclaration> classDecl)
+    llvm::Value *CodeGen::generateIndex(shared_ptr<IndexNode> indexNode)
     {
-        string className = classDecl->getName();
-        vector<shared_ptr<Function>> methods = classDecl->getMethods();
+        llvm::Value *array = generateExpression(indexNode->getArray());
+        if (llvm::FixedVectorType *vectorType = llvm::dyn_cast<llvm::FixedVectorType>(array->getType()))
+        {
+            return mBuilder.CreateExtractElement(array, generateLaneIndex(indexNode->getIndex(), vectorType), "lane");
+        }
 
-        // Look up the struct type for this class
-        auto structIt = mStructTypes.find(className);
-        if (structIt == mStructTypes.end())
+        string elementType = arrayElementType(getValueTypeName(indexNode->getArray(), array));
+        llvm::Value *elementPtr = generateElementPointer(indexNode, array, elementType);
+        llvm::LoadInst *element = mBuilder.CreateLoad(stringToType(elementType), elementPtr, "element");
+        element->setMetadata(llvm::LLVMContext::MD_tbaa, getElementAccessTag(elementType));
+
+        // Elements are borrowed from the array, so a temporary array can only be released here
+        // when the element isn't a reference it would take down with it
+        if (!getOwnedTemporaryType(array).empty())
         {
-            reportFatalError("Unknown class in method generation: " + className);
-            return;
+            if (isRefCountedType(elementType))
+            {
+                reportFatalError("Cannot index a temporary array of " + elementType + ", assign it to a variable first", indexNode);
+                return nullptr;
+            }
+            releaseOwnedTemporaries({array});
         }
+        return element;
+    }
 
+    void CodeGen::generateClassMethodPrototypes(shared_ptr<ClassDeclaration> classDecl)
+    {
+        string className = classDecl->getName();
+        vector<shared_ptr<Function>> methods = classDecl->getMethods();
         for (auto method = methods.begin(); method != methods.end(); ++method)
         {
             // Create mangled name: ClassName_methodName
@@ -1217,7 +3336,30 @@ namespace codegen
             llvm::FunctionType *funcType = llvm::FunctionType::get(retType, argTypes, false);
             llvm::Value *funcVal = mModule->getOrInsertFunction(mangledName, funcType).getCallee();
             llvm::Function *llvmFunc = llvm::cast<llvm::Function>(funcVal);
+            setInlining(llvmFunc, *method);
             putFunc(mangledName, llvmFunc);
+            mFunctionReturnTypes[mangledName] = (*method)->getReturnType();
+        }
+    }
+
+    void CodeGen::generateClassMethods(shared_ptr<ClassDeclaration> classDecl)
+    {
+        string className = classDecl->getName();
+        vector<shared_ptr<Function>> methods = classDecl->getMethods();
+
+        // Look up the struct type for this class
+        auto structIt = mStructTypes.find(className);
+        if (structIt == mStructTypes.end())
+        {
+            reportFatalError("Unknown class in method generation: " + className);
+            return;
+        }
+
+        for (auto method = methods.begin(); method != methods.end(); ++method)
+        {
+            string mangledName = className + "_" + (*method)->getName();
+            llvm::Function *llvmFunc = getFunc(mangledName);
+            vector<shared_ptr<Argument>> args = (*method)->getArguments();
 
             // Generate function body
             llvm::BasicBlock *entry = llvm::BasicBlock::Create(mContext, "entry", llvmFunc);
@@ -1250,21 +3392,20 @@ namespace codegen
                 mVariableTypes.put((*arg)->getName(), (*arg)->getType());
             }
 
-            // Generate method body
-            shared_ptr<BlockNode> block = (*method)->getBlock();
-            vector<shared_ptr<Expression>> &expressions = block->getExpressions();
-            for (auto expr = expressions.begin(); expr != expressions.end(); ++expr)
-            {
-                generateExpression(*expr);
-            }
+            // 'this' and class-typed parameters are borrowed, as for plain functions
+            retainReassignedParameters(*method);
+
+            // Generate method body, locals are released when its scope is left
+            generateIntoBlock(entry, (*method)->getBlock());
 
-            // For void methods without explicit return, add implicit ret void
-            llvm::BasicBlock *lastBlock = &llvmFunc->back();
+            // For void methods without explicit return, add implicit ret void where the body falls through
+            llvm::BasicBlock *lastBlock = mBuilder.GetInsertBlock();
             if (lastBlock->getTerminator() == nullptr)
             {
                 if ((*method)->getReturnType() == "void" || (*method)->getReturnType().empty())
                 {
                     mBuilder.SetInsertPoint(lastBlock);
+                    releaseAllInCurrentScope();
                     mBuilder.CreateRetVoid();
                 }
                 else
@@ -1273,10 +3414,11 @@ namespace codegen
                 }
             }
 
+            alignVectorAccesses(*llvmFunc);
+
             // Clean up
             mCurrentClass.clear();
             mThisPtr = nullptr;
-            releaseAllInCurrentScope();
             leaveRefCountScope();
             mTable.leaveContext();
             mVariableTypes.leaveContext();
@@ -1310,24 +3452,31 @@ namespace codegen
                     llvm::Value *arg = generateExpression(argNode);
                     args.push_back(arg);
                 }
-                return mBuilder.CreateCall(func, args);
+                llvm::Value *result = mBuilder.CreateCall(func, args);
+                releaseOwnedTemporaries(args);
+                return result;
             }
         }
 
-        // It's a method call on an object
-        // Get the object pointer
-        llvm::Value *objectPtr = generateExpression(call->getObject());
-
-        // Get the type of the object
+        // It's a method call on an object. Struct methods get the address of the struct, so they
+        // update it in place.
         string objectType;
-        if (objIdent != nullptr)
+        llvm::Value *objectPtr = generateValueAddress(call->getObject(), objectType);
+        if (objectPtr == nullptr)
         {
-            objectType = mVariableTypes.get(objIdent->getValue());
-        }
-        else
-        {
-            reportFatalError("Method call on complex expression not yet supported", call);
-            return nullptr;
+            // Get the object pointer
+            objectPtr = generateExpression(call->getObject());
+
+            // Get the type of the object
+            if (objIdent != nullptr)
+            {
+                objectType = mVariableTypes.get(objIdent->getValue());
+            }
+            else
+            {
+                reportFatalError("Method call on complex expression not yet supported", call);
+                return nullptr;
+            }
         }
 
         // Find the method
@@ -1350,7 +3499,9 @@ namespace codegen
             args.push_back(arg);
         }
 
-        return mBuilder.CreateCall(func, args);
+        llvm::Value *result = mBuilder.CreateCall(func, args);
+        releaseOwnedTemporaries(args);
+        return result;
     }
 
     void CodeGen::generateIf(shared_ptr<IfBlockNode> ifNode)
@@ -1381,7 +3532,7 @@ namespace codegen
             bodyBlocks.push_back(nextBodyBlock);
 
             mBuilder.SetInsertPoint(currentConditionBlock);
-            cmp = generateExpression(current->getCondition());
+            cmp = generateCondition(current->getCondition());
             mBuilder.CreateCondBr(cmp, currentBodyBlock, nextConditionBlock);
 
             generateIntoBlock(currentBodyBlock, current->getBlock());
@@ -1402,6 +3553,8 @@ namespace codegen
 
         mBuilder.SetInsertPoint(currentConditionBlock);
         cmp = generateExpression(current->getCondition());
+        // The condition may span several blocks (short-circuit operators), branch from where it ended
+        currentConditionBlock = mBuilder.GetInsertBlock();
 
         generateIntoBlock(currentBodyBlock, current->getBlock());
 
@@ -1477,35 +3630,337 @@ namespace codegen
         }
     }
 
+    llvm::AllocaInst *CodeGen::createEntryAlloca(llvm::Type *type, const string &name)
+    {
+        // Locals live in the entry block so mem2reg can promote them and loops don't grow the stack
+        llvm::BasicBlock &entry = mBuilder.GetInsertBlock()->getParent()->getEntryBlock();
+        llvm::IRBuilder<> builder(&entry, entry.begin());
+        return builder.CreateAlloca(type, 0, name);
+    }
+
     void CodeGen::generateWhile(shared_ptr<ast::WhileNode> whileNode)
     {
-        llvm::BasicBlock *preHeaderBlock = mBuilder.GetInsertBlock();
-        llvm::Function *function = preHeaderBlock->getParent();
-        llvm::BasicBlock *entry = llvm::BasicBlock::Create(mContext, "entry", function);
+        // The condition is the loop header and the end of the body branches back to it,
+        // blocks are laid out in that order
+        llvm::Function *function = mBuilder.GetInsertBlock()->getParent();
         llvm::BasicBlock *condition = llvm::BasicBlock::Create(mContext, "condition", function);
-        llvm::BasicBlock *body = llvm::BasicBlock::Create(mContext, "body", function);
-        llvm::BasicBlock *end = llvm::BasicBlock::Create(mContext, "end", function);
+        llvm::BasicBlock *body = llvm::BasicBlock::Create(mContext, "body");
+        llvm::BasicBlock *end = llvm::BasicBlock::Create(mContext, "end");
 
-        mBuilder.SetInsertPoint(preHeaderBlock);
-        mBuilder.CreateBr(entry);
-
-        mBuilder.SetInsertPoint(entry);
         mBuilder.CreateBr(condition);
 
+        mBuilder.SetInsertPoint(condition);
+        llvm::Value *cmp = generateCondition(whileNode->getCondition());
+        mBuilder.CreateCondBr(cmp, body, end);
+
+        // Variables declared outside the loop are never at their last use inside the body
+        body->insertInto(function);
+        mStatementCursors.push_back({nullptr, 0, mRefCountedVarsStack.size()});
         generateIntoBlock(body, whileNode->getBlock());
+        mStatementCursors.pop_back();
         // Only add branch if current block doesn't have a terminator (e.g., from return)
         if (!mBuilder.GetInsertBlock()->getTerminator())
         {
-            mBuilder.CreateBr(entry);
+            mBuilder.CreateBr(condition);
         }
 
-        mBuilder.SetInsertPoint(condition);
-        llvm::Value *cmp = generateExpression(whileNode->getCondition());
-        mBuilder.CreateCondBr(cmp, body, end);
-
+        end->insertInto(function);
         mBuilder.SetInsertPoint(end);
     }
 
+    void CodeGen::generateFor(shared_ptr<ForNode> forNode)
+    {
+        // The bounds are evaluated once, before the loop
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        string variableType = forNode->getVariableType();
+
+        mTable.enterContext();
+        mVariableTypes.enterContext();
+        enterRefCountScope();
+
+        llvm::Value *start;
+        llvm::Value *end;
+        llvm::Value *array = nullptr;
+        if (forNode->isRange())
+        {
+            start = generateExpression(forNode->getStart());
+            end = generateExpression(forNode->getEnd());
+        }
+        else
+        {
+            // Arrays are walked by index. Unless the body can't replace the variable holding the
+            // array, the loop keeps its own reference, released with the loop's scope.
+            string arrayType = "[" + variableType + "]";
+            array = generateExpression(forNode->getStart());
+            shared_ptr<IdentifierNode> arrayVar = dynamic_pointer_cast<IdentifierNode>(forNode->getStart());
+            bool owned = !getOwnedTemporaryType(array).empty();
+            if (!owned && (arrayVar == nullptr || expressionReferences(forNode->getBlock(), arrayVar->getValue(), true)))
+            {
+                generateRetain(array, arrayType);
+                owned = true;
+            }
+            if (owned)
+            {
+                // Not a valid identifier, so it can't clash with a variable
+                llvm::AllocaInst *arraySlot = createEntryAlloca(array->getType(), "for.array");
+                mBuilder.CreateStore(array, arraySlot);
+                mTable.put("for.array", arraySlot);
+                mVariableTypes.put("for.array", arrayType);
+                mRefCountedVarsStack.back().push_back("for.array");
+            }
+            start = llvm::ConstantInt::get(int32Ty, 0);
+            end = generateArrayLength(array);
+        }
+
+        if (forNode->isParallel())
+        {
+            generateParallelFor(forNode, start, end, array);
+        }
+        else
+        {
+            generateCountedLoop(forNode, start, end, array);
+        }
+
+        leaveRefCountScope();
+        mVariableTypes.leaveContext();
+        mTable.leaveContext();
+    }
+
+    void CodeGen::generateCountedLoop(shared_ptr<ForNode> forNode, llvm::Value *start, llvm::Value *end, llvm::Value *array)
+    {
+        // Lowered to the loop shape LLVM's loop passes expect: a guard skips empty loops, and a single
+        // latch increments the counter (which can't overflow, it stays below the end) and branches
+        // back to the body:
+        //   guard -> preheader -> body ... -> latch -> body or exit -> end, guard -> end
+        // Arrays are walked from index start to end, the caller keeps the array alive.
+        llvm::Function *function = mBuilder.GetInsertBlock()->getParent();
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        string variable = forNode->getVariable();
+        string variableType = forNode->getVariableType();
+
+        llvm::BasicBlock *guard = mBuilder.GetInsertBlock();
+        llvm::BasicBlock *preheader = llvm::BasicBlock::Create(mContext, "for preheader", function);
+        llvm::BasicBlock *body = llvm::BasicBlock::Create(mContext, "for body", function);
+        llvm::BasicBlock *latch = llvm::BasicBlock::Create(mContext, "for latch");
+        llvm::BasicBlock *exit = llvm::BasicBlock::Create(mContext, "for exit");
+        llvm::BasicBlock *done = llvm::BasicBlock::Create(mContext, "for end");
+
+        mBuilder.SetInsertPoint(guard);
+        mBuilder.CreateCondBr(mBuilder.CreateICmpSLT(start, end, "any"), preheader, done);
+        mBuilder.SetInsertPoint(preheader);
+        mBuilder.CreateBr(body);
+
+        mBuilder.SetInsertPoint(body);
+        llvm::PHINode *counter = mBuilder.CreatePHI(int32Ty, 2, forNode->isRange() ? variable : "index");
+        counter->addIncoming(start, preheader);
+
+        // The loop variable is a copy, assigning it in the body doesn't change the iteration
+        mStatementCursors.push_back({nullptr, 0, mRefCountedVarsStack.size()});
+        mTable.enterContext();
+        mVariableTypes.enterContext();
+        enterRefCountScope();
+        llvm::AllocaInst *slot = createEntryAlloca(stringToType(variableType), variable);
+        mTable.put(variable, slot);
+        mVariableTypes.put(variable, variableType);
+        if (forNode->isRange())
+        {
+            mBuilder.CreateStore(counter, slot);
+        }
+        else
+        {
+            // No bounds check, the index stays below the length of an array nothing else can free
+            llvm::LoadInst *element = mBuilder.CreateLoad(stringToType(variableType),
+                generateElementAddress(array, counter, variableType), variable);
+            element->setMetadata(llvm::LLVMContext::MD_tbaa, getElementAccessTag(variableType));
+            if (isRefCountedType(variableType))
+            {
+                // Owned for the iteration, the body may overwrite the element or the variable
+                generateRetain(element, variableType);
+                mRefCountedVarsStack.back().push_back(variable);
+            }
+            mBuilder.CreateStore(element, slot);
+        }
+
+        generateIntoBlock(body, forNode->getBlock());
+        leaveRefCountScope();
+        mVariableTypes.leaveContext();
+        mTable.leaveContext();
+        mStatementCursors.pop_back();
+        if (!mBuilder.GetInsertBlock()->getTerminator())
+        {
+            mBuilder.CreateBr(latch);
+        }
+
+        latch->insertInto(function);
+        mBuilder.SetInsertPoint(latch);
+        llvm::Value *next = mBuilder.CreateNSWAdd(counter, llvm::ConstantInt::get(int32Ty, 1), "next");
+        llvm::BranchInst *backedge = mBuilder.CreateCondBr(mBuilder.CreateICmpSLT(next, end, "more"), body, exit);
+        counter->addIncoming(next, latch);
+
+        // Counted loops always terminate
+        llvm::Metadata *mustProgress = llvm::MDNode::get(mContext, llvm::MDString::get(mContext, "llvm.loop.mustprogress"));
+        llvm::MDNode *loopID = llvm::MDNode::getDistinct(mContext, {nullptr, mustProgress});
+        loopID->replaceOperandWith(0, loopID);
+        backedge->setMetadata(llvm::LLVMContext::MD_loop, loopID);
+
+        exit->insertInto(function);
+        mBuilder.SetInsertPoint(exit);
+        mBuilder.CreateBr(done);
+
+        done->insertInto(function);
+        mBuilder.SetInsertPoint(done);
+    }
+
+    void CodeGen::generateParallelFor(shared_ptr<ForNode> forNode, llvm::Value *start, llvm::Value *end, llvm::Value *array)
+    {
+        // The body becomes "<f>.parallel"(context, from, to), which runs the loop from index from to
+        // to. The context holds the array, copies of the variables the body reads and pointers to
+        // the ones it sums into. The runtime calls it on pieces of the range from the thread pool and
+        // returns when all of them are done, so the context and everything it borrows outlive it.
+        llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+        vector<llvm::Type *> slots;
+        vector<llvm::Value *> values;
+        if (array != nullptr)
+        {
+            slots.push_back(ptrTy);
+            values.push_back(array);
+        }
+
+        vector<string> captures;
+        for (const string &name : forNode->getCaptures())
+        {
+            llvm::AllocaInst *variable;
+            if (name == "this" && mThisPtr != nullptr)
+            {
+                slots.push_back(ptrTy);
+                values.push_back(mThisPtr);
+            }
+            else if (mTable.tryGet(name, variable) && variable != nullptr)
+            {
+                slots.push_back(variable->getAllocatedType());
+                values.push_back(mBuilder.CreateLoad(variable->getAllocatedType(), variable, name));
+            }
+            else
+            {
+                // Folded to a constant, or only declared in the body
+                continue;
+            }
+            captures.push_back(name);
+        }
+        for (const string &name : forNode->getReductions())
+        {
+            slots.push_back(ptrTy);
+            values.push_back(mTable.get(name));
+        }
+
+        llvm::StructType *contextType = llvm::StructType::get(mContext, slots);
+        llvm::Function *body = generateParallelBody(forNode, contextType, captures, array != nullptr);
+
+        llvm::AllocaInst *context = createEntryAlloca(contextType, "parallel.context");
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            mBuilder.CreateStore(values[i], mBuilder.CreateStructGEP(contextType, context, static_cast<unsigned>(i)));
+        }
+        mBuilder.CreateCall(getFunc("parallel_for"), {start, end, body, context});
+    }
+
+    llvm::Function *CodeGen::generateParallelBody(shared_ptr<ForNode> forNode, llvm::StructType *contextType,
+                                                  const vector<string> &captures, bool hasArray)
+    {
+        llvm::Function *caller = mBuilder.GetInsertBlock()->getParent();
+        llvm::Type *int32Ty = llvm::Type::getInt32Ty(mContext);
+        llvm::Type *ptrTy = llvm::PointerType::get(mContext, 0);
+        llvm::FunctionType *bodyTy = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {ptrTy, int32Ty, int32Ty}, false);
+        llvm::Function *body = llvm::Function::Create(bodyTy, llvm::Function::InternalLinkage, caller->getName() + ".parallel", mModule);
+        llvm::Argument *context = body->getArg(0);
+        context->setName("context");
+        body->getArg(1)->setName("from");
+        body->getArg(2)->setName("to");
+
+        // Generated in the middle of the caller, which continues where it was afterwards
+        llvm::IRBuilderBase::InsertPointGuard guard(mBuilder);
+        vector<vector<string>> callerRefCountedVars;
+        vector<StatementCursor> callerStatementCursors;
+        set<llvm::AllocaInst *> callerUnassignedVars;
+        swap(callerRefCountedVars, mRefCountedVarsStack);
+        swap(callerStatementCursors, mStatementCursors);
+        swap(callerUnassignedVars, mUnassignedRefCountedVars);
+        llvm::Value *callerThis = mThisPtr;
+
+        mBuilder.SetInsertPoint(llvm::BasicBlock::Create(mContext, "entry", body));
+        mBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
+        if (caller->getSubprogram() != nullptr)
+        {
+            int lineNumber = forNode->line() > 0 ? forNode->line() : 1;
+            string name = body->getName().str();
+            llvm::DISubroutineType *funcType = mDIBuilder->createSubroutineType(mDIBuilder->getOrCreateTypeArray({}));
+            body->setSubprogram(mDIBuilder->createFunction(mDIFile, name, name, mDIFile, lineNumber, funcType, lineNumber,
+                                                           llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition));
+        }
+
+        // The variables the body reads are borrowed from the caller, the sums start at 0 in every piece
+        mTable.enterContext();
+        mVariableTypes.enterContext();
+        enterRefCountScope();
+        unsigned slot = 0;
+        llvm::Value *array = nullptr;
+        if (hasArray)
+        {
+            array = mBuilder.CreateLoad(ptrTy, mBuilder.CreateStructGEP(contextType, context, slot++), "array");
+        }
+        for (const string &name : captures)
+        {
+            llvm::Type *type = contextType->getElementType(slot);
+            llvm::Value *value = mBuilder.CreateLoad(type, mBuilder.CreateStructGEP(contextType, context, slot++), name);
+            if (name == "this")
+            {
+                mThisPtr = value;
+                continue;
+            }
+            llvm::AllocaInst *variable = createEntryAlloca(type, name);
+            mBuilder.CreateStore(value, variable);
+            mTable.put(name, variable);
+        }
+        vector<llvm::Value *> totals;
+        for (const string &name : forNode->getReductions())
+        {
+            totals.push_back(mBuilder.CreateLoad(ptrTy, mBuilder.CreateStructGEP(contextType, context, slot++), name + ".total"));
+            llvm::Type *type = stringToType(mVariableTypes.get(name));
+            llvm::AllocaInst *sum = createEntryAlloca(type, name);
+            mBuilder.CreateStore(llvm::Constant::getNullValue(type), sum);
+            mTable.put(name, sum);
+        }
+
+        generateCountedLoop(forNode, body->getArg(1), body->getArg(2), array);
+
+        // One atomic add per piece, the order doesn't matter for the caller, which waits for all of them
+        vector<string> reductions = forNode->getReductions();
+        for (size_t i = 0; i < reductions.size(); ++i)
+        {
+            llvm::AllocaInst *sum = mTable.get(reductions[i]);
+            llvm::Value *value = mBuilder.CreateLoad(sum->getAllocatedType(), sum, reductions[i]);
+            llvm::AtomicRMWInst::BinOp op = value->getType()->isFloatingPointTy() ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add;
+            mBuilder.CreateAtomicRMW(op, totals[i], value, llvm::MaybeAlign(), llvm::AtomicOrdering::Monotonic);
+        }
+        leaveRefCountScope();
+        mVariableTypes.leaveContext();
+        mTable.leaveContext();
+        mBuilder.CreateRetVoid();
+
+        swap(callerRefCountedVars, mRefCountedVarsStack);
+        swap(callerStatementCursors, mStatementCursors);
+        swap(callerUnassignedVars, mUnassignedRefCountedVars);
+        mThisPtr = callerThis;
+
+        alignVectorAccesses(*body);
+        if (mOptimize)
+        {
+            mFpm->run(*body);
+        }
+        LOG("Codegen: Outlined parallel loop at line %d into %s\n", forNode->line(), body->getName().str().c_str());
+        return body;
+    }
+
     llvm::Value *CodeGen::generateExpression(shared_ptr<Expression> expression)
     {
         // Set debug location for this expression
@@ -1516,18 +3971,22 @@ namespace codegen
         case ExpressionType::IntegerLiteral:
         {
             shared_ptr<IntegerLiteralNode> i = dynamic_pointer_cast<IntegerLiteralNode>(expression);
-            return llvm::ConstantInt::get(mContext, llvm::APInt(32, i->getValue(), true));
+            if (!i->hasExplicitType() && !integerFits(i->getValue(), "int"))
+            {
+                reportFatalError("Integer literal " + to_string(i->getValue()) + " doesn't fit in int, add a suffix like i64", expression);
+                return nullptr;
+            }
+            return llvm::ConstantInt::get(stringToType(i->getType()), static_cast<uint64_t>(i->getValue()), !isUnsignedType(i->getType()));
         }
         case ExpressionType::FloatLiteral:
         {
             shared_ptr<FloatLiteralNode> f = dynamic_pointer_cast<FloatLiteralNode>(expression);
-            return llvm::ConstantFP::get(mContext, llvm::APFloat(f->getValue()));
+            return llvm::ConstantFP::get(stringToType(f->getType()), f->getValue());
         }
         case ExpressionType::StringLiteral:
         {
             shared_ptr<StringLiteralNode> str = dynamic_pointer_cast<StringLiteralNode>(expression);
-            // Create a global string constant and return a pointer to it
-            return mBuilder.CreateGlobalString(str->getValue(), "str");
+            return generateStringLiteral(str->getValue());
         }
         case ExpressionType::UnaryOperator:
         {
@@ -1543,9 +4002,13 @@ namespace codegen
         {
             shared_ptr<IdentifierNode> var = dynamic_pointer_cast<IdentifierNode>(expression);
 
-            // Handle 'this' keyword specially - return the stored this pointer
+            // Handle 'this' keyword specially - return the stored this pointer, or a copy of the struct it points to
             if (var->getValue() == "this" && mThisPtr != nullptr)
             {
+                if (isValueType(mCurrentClass))
+                {
+                    return mBuilder.CreateLoad(mStructTypes[mCurrentClass], mThisPtr);
+                }
                 return mThisPtr;
             }
 
@@ -1576,14 +4039,17 @@ namespace codegen
             ASSERT(typeName != "");
             llvm::Type *type = stringToType(typeName);
 
-            llvm::AllocaInst *inst = mBuilder.CreateAlloca(type, 0, decl->getName());
+            llvm::AllocaInst *inst = createEntryAlloca(type, decl->getName());
             mTable.put(decl->getName(), inst);
             mVariableTypes.put(decl->getName(), typeName);
 
-            // Track ref-counted variables for automatic release on scope exit
+            // Track ref-counted variables for automatic release on scope exit. They start out null
+            // so releasing a variable that was never assigned (or was moved from) is harmless.
             if (isRefCountedType(typeName) && !mRefCountedVarsStack.empty())
             {
+                mBuilder.CreateStore(llvm::ConstantPointerNull::get(llvm::PointerType::get(mContext, 0)), inst);
                 mRefCountedVarsStack.back().push_back(decl->getName());
+                mUnassignedRefCountedVars.insert(inst);
                 LOG("Codegen: Tracking ref-counted variable %s\n", decl->getName().c_str());
             }
 
@@ -1591,7 +4057,8 @@ namespace codegen
             if (initExpr != nullptr)
             {
                 LOG("Codegen: Generating initializer for %s\n", decl->getName().c_str());
-                llvm::Value *initValue = generateExpression(initExpr);
+                llvm::Value *initValue = generateOwnedValue(initExpr, typeName);
+                mUnassignedRefCountedVars.erase(inst);
                 LOG("Codegen: Storing initializer for %s\n", decl->getName().c_str());
                 mBuilder.CreateStore(initValue, inst);
             }
@@ -1601,10 +4068,42 @@ namespace codegen
         case ExpressionType::Return:
         {
             shared_ptr<ReturnNode> ret = dynamic_pointer_cast<ReturnNode>(expression);
-            llvm::Value *exp = generateExpression(ret->getExpression());
+            shared_ptr<Expression> retExpr = ret->getExpression();
+
+            // The caller owns the returned reference. Returning a local moves it out instead of
+            // retaining it and then releasing it at scope exit; parameters and 'this' are retained.
+            string movedVar;
+            llvm::Value *exp;
+            shared_ptr<IdentifierNode> retIdent = dynamic_pointer_cast<IdentifierNode>(retExpr);
+            if (retIdent != nullptr && findRefCountScope(retIdent->getValue()) >= 0)
+            {
+                movedVar = retIdent->getValue();
+                exp = generateExpression(retExpr);
+            }
+            else if (retIdent != nullptr)
+            {
+                string typeName = retIdent->getValue() == "this" ? mCurrentClass : mVariableTypes.get(retIdent->getValue());
+                exp = generateOwnedValue(retExpr, typeName);
+            }
+            else
+            {
+                string functionName = mBuilder.GetInsertBlock()->getParent()->getName().str();
+                exp = generateOwnedValue(retExpr, mFunctionReturnTypes[functionName]);
+            }
+
+            // A call whose result is returned directly is a tail call, unless something still has to
+            // run after it (releasing temporaries passed to it)
+            llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(exp);
+            bool tailPosition = call != nullptr && call->getParent() == mBuilder.GetInsertBlock()
+                && &mBuilder.GetInsertBlock()->back() == call;
 
             // Release all ref-counted variables before returning
-            releaseAllScopes();
+            releaseAllScopes(movedVar);
+
+            if (tailPosition)
+            {
+                generateTailCall(call);
+            }
 
             return mBuilder.CreateRet(exp);
         }
@@ -1614,21 +4113,16 @@ namespace codegen
 
             llvm::Value *exp = generateExpression(cast->getExpression());
             llvm::Type *type = stringToType(cast->getCastType());
-
-            // TODO: a more generic casting mechanism
-            if (type == llvm::Type::getDoubleTy(mContext))
-            {
-                return mBuilder.CreateSIToFP(exp, llvm::Type::getDoubleTy(mContext));
-            }
-            else if (type == llvm::Type::getInt32Ty(mContext))
-            {
-                return mBuilder.CreateFPToSI(exp, llvm::Type::getInt32Ty(mContext));
-            }
-            else
+            if (!(exp->getType()->isIntegerTy() || exp->getType()->isFloatingPointTy()) || !(type->isIntegerTy() || type->isFloatingPointTy()))
             {
                 reportFatalError("Unsupported cast type: " + cast->getCastType(), expression);
                 return nullptr;
             }
+
+            // Truncates, extends by the signedness of the source, or converts between ints and floats
+            bool sourceSigned = !isUnsignedType(cast->getSourceType());
+            llvm::Instruction::CastOps opcode = llvm::CastInst::getCastOpcode(exp, sourceSigned, type, !isUnsignedType(cast->getCastType()));
+            return mBuilder.CreateCast(opcode, exp, type);
         }
         case ExpressionType::FunctionCall:
         {
@@ -1658,19 +4152,36 @@ namespace codegen
             return nullptr;
         }
         break;
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            generateFor(forNode);
+            return nullptr;
+        }
+        break;
         case ExpressionType::Block:
         {
             // Standalone block - generate its contents in a new scope
             shared_ptr<BlockNode> blockNode = dynamic_pointer_cast<BlockNode>(expression);
             mTable.enterContext();
             mVariableTypes.enterContext();
+            enterRefCountScope();
 
             vector<shared_ptr<Expression>> &expressions = blockNode->getExpressions();
-            for (auto it = expressions.begin(); it != expressions.end(); ++it)
+            mStatementCursors.push_back({&expressions, 0, mRefCountedVarsStack.size()});
+            for (size_t i = 0; i < expressions.size(); ++i)
             {
-                generateExpression(*it);
+                mStatementCursors.back().index = i;
+                llvm::Value *value = generateExpression(expressions[i]);
+                string ownedType = getOwnedTemporaryType(value);
+                if (!ownedType.empty())
+                {
+                    generateRelease(value, ownedType);
+                }
             }
+            mStatementCursors.pop_back();
 
+            leaveRefCountScope();
             mVariableTypes.leaveContext();
             mTable.leaveContext();
             return nullptr;
@@ -1691,6 +4202,11 @@ namespace codegen
             shared_ptr<MethodCallNode> mcn = dynamic_pointer_cast<MethodCallNode>(expression);
             return generateMethodCall(mcn);
         }
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            return generateIndex(index);
+        }
         default:
         {
             reportFatalError("Unknown expression type in codegen", expression);
@@ -1722,12 +4238,20 @@ namespace codegen
 
         mBuilder.SetInsertPoint(basicBlock);
 
-        vector<shared_ptr<Expression>> expressions = block->getExpressions();
-        for (auto it = expressions.begin(); it != expressions.end(); ++it)
+        vector<shared_ptr<Expression>> &expressions = block->getExpressions();
+        mStatementCursors.push_back({&expressions, 0, mRefCountedVarsStack.size()});
+        for (size_t i = 0; i < expressions.size(); ++i)
         {
-            shared_ptr<Expression> exp = *it;
-            generateExpression(exp);
+            mStatementCursors.back().index = i;
+            llvm::Value *value = generateExpression(expressions[i]);
+            string ownedType = getOwnedTemporaryType(value);
+            if (!ownedType.empty())
+            {
+                // An object or string returned by a call whose result is ignored
+                generateRelease(value, ownedType);
+            }
         }
+        mStatementCursors.pop_back();
 
         leaveRefCountScope();
         mTable.leaveContext();
@@ -1753,15 +4277,16 @@ namespace codegen
 
         std::string error;
         const llvm::Target *target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
+        // Kept for the loop passes, which need the target's cost model
+        std::unique_ptr<llvm::TargetMachine> tm;
         if (target)
         {
             llvm::TargetOptions opt;
-            llvm::TargetMachine *tm = target->createTargetMachine(
-                llvm::Triple(targetTriple), "generic", "", opt, llvm::Reloc::PIC_);
+            tm.reset(target->createTargetMachine(
+                llvm::Triple(targetTriple), "generic", "", opt, llvm::Reloc::PIC_));
             if (tm)
             {
                 mModule->setDataLayout(tm->createDataLayout());
-                delete tm;
             }
         }
 
@@ -1803,7 +4328,11 @@ namespace codegen
             );
         }
 
-        // Promote allocas to registers.
+        // Alias analysis for the passes below, using the field types from the TBAA metadata.
+        mFpm->add(llvm::createTypeBasedAAWrapperPass());
+        mFpm->add(llvm::createBasicAAWrapperPass());
+        // Split struct locals into their fields and promote allocas to registers.
+        mFpm->add(llvm::createSROAPass());
         mFpm->add(llvm::createPromoteMemoryToRegisterPass());
         // Do simple "peephole" optimizations and bit-twiddling optzns.
         mFpm->add(llvm::createInstructionCombiningPass());
@@ -1813,11 +4342,38 @@ namespace codegen
         mFpm->add(llvm::createGVNPass());
         // Simplify the control flow graph (deleting unreachable blocks, etc).
         mFpm->add(llvm::createCFGSimplificationPass());
+        // Hoist loop invariant loads and calls.
+        mFpm->add(llvm::createLICMPass());
 
         mFpm->doInitialization();
 
         generateClassTypes(assembly);
         generateAssembly(assembly);
+        markInvariantFieldLoads();
+        inferFunctionAttributes();
+
+        // Optimize again now that calls carry attributes
+        if (mOptimize)
+        {
+            for (llvm::Function &func : *mModule)
+            {
+                if (!func.isDeclaration())
+                {
+                    mFpm->run(func);
+                }
+            }
+        }
+
+        // Inline into optimized functions, so callee sizes are what they cost, then clean up the callers
+        vector<llvm::Function *> inlinedInto = inlineCalls();
+        if (mOptimize)
+        {
+            for (llvm::Function *func : inlinedInto)
+            {
+                mFpm->run(*func);
+            }
+            optimizeLoops(tm.get());
+        }
         if (logging::Logger::isEnabled())
         {
             LOG("Codegen: Assembly generation complete, printing module\n");
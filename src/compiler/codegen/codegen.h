@@ -18,6 +18,7 @@
 #pragma warning(disable:4100)   // unreferenced formal parameter
 #pragma warning(disable:4702)   // unreachable code
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -56,12 +57,35 @@ namespace codegen
         SymbolTable<std::string, std::string> mVariableTypes;  // Track type names for variables
         std::map<std::string, llvm::Function *> mFunctions;
         std::map<std::string, llvm::StructType *> mStructTypes;
+        std::map<std::string, llvm::GlobalVariable *> mTypeInfos;  // Runtime type descriptors per class
+        std::map<std::string, std::vector<unsigned>> mFieldSlots;  // Struct element of each field, in declaration order
         std::map<std::string, std::shared_ptr<ast::ClassDeclaration>> mClasses;
+        std::map<std::string, llvm::MDNode *> mTbaaTypes;  // Type based alias analysis node per field type
+        std::map<std::string, std::vector<llvm::MDNode *>> mFieldAccessTags;  // TBAA access tag of each field, in declaration order
+        std::set<llvm::MDNode *> mAssignedFields;  // Access tags of fields assigned after construction
         std::set<std::string> mLocalFunctions;  // Mangled names of local functions
+        std::map<std::string, std::string> mFunctionReturnTypes;  // Silver return type per mangled function name
+        std::map<std::string, std::vector<std::string>> mFunctionArgumentTypes;  // Silver parameter types per mangled function name
+        std::map<llvm::Function *, std::string> mTaskTypes;  // Task type the tasks running each spawn entry function have, "task<int>"
+        std::map<std::string, llvm::Constant *> mStringLiterals;  // One global per distinct literal in the module
+        std::set<llvm::Value *> mInternedStrings;  // The values in mStringLiterals, for constant folding
 
         // Stack of ref-counted variables per scope (for generating release calls)
         std::vector<std::vector<std::string>> mRefCountedVarsStack;
 
+        // Ref-counted variables that are still null because nothing was assigned since their declaration,
+        // by their alloca so a shadowing declaration in an inner block doesn't stand for the outer one
+        std::set<llvm::AllocaInst *> mUnassignedRefCountedVars;
+
+        // Statement lists being generated, innermost last, used to find the last use of a variable
+        struct StatementCursor
+        {
+            std::vector<std::shared_ptr<ast::Expression>> *statements;  // nullptr marks a loop body
+            size_t index;
+            size_t scopeDepth;  // Size of mRefCountedVarsStack while these statements are generated
+        };
+        std::vector<StatementCursor> mStatementCursors;
+
         // Current namespace path for resolving local function calls
         std::string mCurrentNamespace;
 
@@ -90,9 +114,19 @@ namespace codegen
         llvm::Function *getFunc(std::string name);
 
         llvm::Type *stringToType(std::string str);
+        llvm::AllocaInst *createEntryAlloca(llvm::Type *type, const std::string &name);
+        llvm::Constant *generateStringLiteral(const std::string& value);
+        llvm::Value *generateStringEquals(llvm::Value *lhs, llvm::Value *rhs);
         std::vector<llvm::Type *> getFunctionArgumentTypes(std::shared_ptr<ast::Function> function);
 
         void generateClassTypes(std::shared_ptr<ast::Assembly> assembly);
+        llvm::StructType *generateClassType(std::shared_ptr<ast::ClassDeclaration> classDecl);
+        unsigned getFieldSlot(const std::string& className, size_t fieldIndex);
+        llvm::MDNode *getTbaaType(const std::string& typeName);
+        void generateTbaaTypes(const std::string& className);
+        void tagFieldAccess(llvm::Instruction *inst, const std::string& className, size_t fieldIndex);
+        llvm::MDNode *getElementAccessTag(const std::string& elementType);
+        void markInvariantFieldLoads();
         void generateAssembly(std::shared_ptr<ast::Assembly> assembly);
         llvm::Function *generateFunctionPrototype(std::shared_ptr<ast::Function> function);
         llvm::Function *generateFunctionPrototypeWithName(std::shared_ptr<ast::Function> function, std::string mangledName);
@@ -100,19 +134,45 @@ namespace codegen
         llvm::Value *generateFunctionWithName(std::shared_ptr<ast::Function> function, std::string mangledName);
         llvm::Value *generateExpression(std::shared_ptr<ast::Expression> expression);
         llvm::Value *generateBinaryExpression(std::shared_ptr<ast::BinaryExpressionNode> expression);
-        llvm::Value *generateIntegerMath(std::string op, llvm::Value *lhs, llvm::Value *rhs);
+        llvm::Value *generateAssignment(std::shared_ptr<ast::BinaryExpressionNode> expression);
+        llvm::Value *generateLogicalExpression(std::shared_ptr<ast::BinaryExpressionNode> expression);
+        llvm::Value *generateCondition(std::shared_ptr<ast::Expression> condition);
+        llvm::Value *generateIntegerMath(std::string op, llvm::Value *lhs, llvm::Value *rhs, bool isUnsigned = false);
         llvm::Value *generateFloatingPointMath(std::string op, llvm::Value *lhs, llvm::Value *rhs);
+        llvm::Value *generateVectorMath(std::string op, llvm::Value *lhs, llvm::Value *rhs);
+        llvm::Value *generateVectorBuiltin(std::shared_ptr<ast::FunctionCallNode> call);
+        llvm::Value *generateLaneIndex(std::shared_ptr<ast::Expression> index, llvm::FixedVectorType *vectorType);
+        llvm::Value *generateLaneAssignment(std::shared_ptr<ast::IndexNode> indexNode, std::shared_ptr<ast::Expression> rhsExpr);
+        void alignVectorAccesses(llvm::Function &func);
         llvm::Value *generateFunctionCall(std::shared_ptr<ast::FunctionCallNode> expression);
         llvm::Value *generateQualifiedCall(std::shared_ptr<ast::QualifiedCallNode> expression);
         llvm::Value *generateAlloc(std::shared_ptr<ast::AllocNode> allocNode);
         llvm::Value *generateMemberAccess(std::shared_ptr<ast::MemberAccessNode> memberNode);
         llvm::Value *generateMethodCall(std::shared_ptr<ast::MethodCallNode> call);
+        llvm::GlobalVariable *getArrayTypeInfo(const std::string& typeName);
+        llvm::Value *generateValueAddress(std::shared_ptr<ast::Expression> expr, std::string &typeName);
+        llvm::Value *generateFieldPointer(std::shared_ptr<ast::MemberAccessNode> memberNode, std::string &className, size_t &fieldIndex);
+        std::string getValueTypeName(std::shared_ptr<ast::Expression> expr, llvm::Value *value);
+        llvm::Value *generateArrayLength(llvm::Value *array);
+        llvm::Value *generateHash(std::shared_ptr<ast::Expression> key);
+        llvm::Value *generateSpawn(std::shared_ptr<ast::FunctionCallNode> call, llvm::Function *func);
+        llvm::Function *getTaskEntry(llvm::Function *func, const std::string& taskType, llvm::StructType *&frameType);
+        llvm::Value *generateJoin(std::shared_ptr<ast::FunctionCallNode> call);
+        llvm::Value *generateElementAddress(llvm::Value *array, llvm::Value *index, const std::string& elementType);
+        llvm::Value *generateElementPointer(std::shared_ptr<ast::IndexNode> indexNode, llvm::Value *array, const std::string& elementType);
+        llvm::Value *generateIndex(std::shared_ptr<ast::IndexNode> indexNode);
+        void generateClassMethodPrototypes(std::shared_ptr<ast::ClassDeclaration> classDecl);
         void generateClassMethods(std::shared_ptr<ast::ClassDeclaration> classDecl);
         void generateNamespacePrototypes(std::shared_ptr<ast::NamespaceDeclaration> ns, std::string parentPath);
         void generateNamespaceBodies(std::shared_ptr<ast::NamespaceDeclaration> ns, std::string parentPath);
         std::string mangleName(std::string namespacePath, std::string funcName);
         void generateIf(std::shared_ptr<ast::IfBlockNode> ifNode);
         void generateWhile(std::shared_ptr<ast::WhileNode> whileNode);
+        void generateFor(std::shared_ptr<ast::ForNode> forNode);
+        void generateCountedLoop(std::shared_ptr<ast::ForNode> forNode, llvm::Value *start, llvm::Value *end, llvm::Value *array);
+        void generateParallelFor(std::shared_ptr<ast::ForNode> forNode, llvm::Value *start, llvm::Value *end, llvm::Value *array);
+        llvm::Function *generateParallelBody(std::shared_ptr<ast::ForNode> forNode, llvm::StructType *contextType,
+                                             const std::vector<std::string> &captures, bool hasArray);
         llvm::Value *generateBlock(std::shared_ptr<ast::BlockNode> block, llvm::Function * llvmFunc);
         llvm::Value *generateIntoBlock(llvm::BasicBlock *basicBlock, std::shared_ptr<ast::BlockNode> block);
 
@@ -121,12 +181,30 @@ namespace codegen
 
         // Reference counting helpers
         bool isRefCountedType(const std::string& typeName);
-        void generateRetain(llvm::Value* ptr);
-        void generateRelease(llvm::Value* ptr);
+        bool isValueType(const std::string& typeName);
+        bool isVectorType(const std::string& typeName);
+        void generateRetain(llvm::Value* ptr, const std::string& typeName);
+        void generateRelease(llvm::Value* ptr, const std::string& typeName);
         void enterRefCountScope();
         void leaveRefCountScope();
         void releaseAllInCurrentScope();
-        void releaseAllScopes();  // For return statements - release all ref-counted vars
+        void releaseAllScopes(const std::string& movedVar = "");  // For return statements - release all ref-counted vars
+        int findRefCountScope(const std::string& varName);
+        void generateTailCall(llvm::CallInst *call);
+
+        // Function attributes
+        void addRuntimeAttributes();
+        void inferFunctionAttributes();
+        void optimizeLoops(llvm::TargetMachine *tm);
+        void setInlining(llvm::Function *llvmFunc, std::shared_ptr<ast::Function> function);
+        std::vector<llvm::Function *> inlineCalls();
+        bool expressionReferences(std::shared_ptr<ast::Expression> expr, const std::string& varName, bool assignmentsOnly = false);
+        bool isLastUse(const std::string& varName, size_t declScope);
+        llvm::Value *generateOwnedValue(std::shared_ptr<ast::Expression> expr, const std::string& typeName);
+        std::string getOwnedTemporaryType(llvm::Value *value);
+        void generateClassDestructors();
+        void releaseOwnedTemporaries(const std::vector<llvm::Value *> &args);
+        void retainReassignedParameters(std::shared_ptr<ast::Function> function);
     public:
         CodeGen(std::shared_ptr<ast::Assembly> tree, std::string sourceFile, std::string outFile="");
 
@@ -2,6 +2,7 @@
 
 #include "parser.h"
 
+#include <algorithm>
 #include <stack>
 #include <filesystem>
 #include <fstream>
@@ -15,11 +16,47 @@ namespace parse
 {
     Parser::Parser(string name, Tokenizer tok, istream &in) :
         mName(name),
-        mTokens(tok, in)
+        mTokens(tok, in),
+        mImported(make_shared<set<string>>())
     {
 
     }
 
+    // True if the identifier appears as a whole name in the type: "Box<[T]>" mentions T
+    static bool typeMentions(const string &type, const string &name)
+    {
+        size_t start = 0;
+        while (start < type.size())
+        {
+            size_t end = start;
+            while (end < type.size() && (isalnum((unsigned char)type[end]) || type[end] == '_'))
+            {
+                ++end;
+            }
+
+            if (end > start && type.compare(start, end - start, name) == 0 && end - start == name.size())
+            {
+                return true;
+            }
+            start = end + 1;
+        }
+        return false;
+    }
+
+    // i32 and f64 are the int and float the rest of the compiler knows
+    static string canonicalType(const string &type)
+    {
+        if (type == "i32")
+        {
+            return "int";
+        }
+        else if (type == "f64")
+        {
+            return "float";
+        }
+        return type;
+    }
+
     void Parser::reportFatalError(string message)
     {
         // Try to get current token for line info
@@ -131,6 +168,86 @@ namespace parse
         return token;
     }
 
+    string Parser::parseType(string message)
+    {
+        // A type is a name, or "[T]" for an array of T
+        if (current().type() == TokenType::LeftBracket)
+        {
+            advance();
+            string elementType = parseType(message);
+            expectCurrentTokenType(TokenType::RightBracket, "Expected ']' to close array type");
+            advance();
+            return "[" + elementType + "]";
+        }
+
+        expectCurrentTokenType(TokenType::Identifier, message);
+        string type = canonicalType(current().text());
+        advance();
+
+        // "Box<int>" or "Pair<int, [float]>" instantiates a generic class, written without spaces
+        if (current().type() == TokenType::Operator && current().text() == "<")
+        {
+            advance();
+            type += "<";
+            for (;;)
+            {
+                type += parseType(message);
+                if (current().type() != TokenType::Comma)
+                {
+                    break;
+                }
+                advance();
+                type += ",";
+            }
+
+            expectCurrentTokenTypeAndText(TokenType::Operator, ">", "Expected '>' to close type arguments");
+            advance();
+            type += ">";
+
+            // Types that depend on a type parameter are only known once the template is instantiated
+            bool concrete = true;
+            for (const string &param : mTypeParameters)
+            {
+                concrete = concrete && !typeMentions(type, param);
+            }
+            if (concrete && find(mGenericTypes.begin(), mGenericTypes.end(), type) == mGenericTypes.end())
+            {
+                mGenericTypes.push_back(type);
+            }
+        }
+
+        return type;
+    }
+
+    vector<string> Parser::parseTypeParameters()
+    {
+        // "<T, U>" after the name of a generic function or class
+        expectCurrentTokenTypeAndText(TokenType::Operator, "<", "Expected '<' to open type parameters");
+        advance();
+
+        vector<string> params;
+        for (;;)
+        {
+            expectCurrentTokenType(TokenType::Identifier, "Expected type parameter name");
+            if (find(params.begin(), params.end(), current().text()) != params.end())
+            {
+                reportFatalError("Duplicate type parameter " + current().text());
+            }
+            params.push_back(current().text());
+            advance();
+
+            if (current().type() != TokenType::Comma)
+            {
+                break;
+            }
+            advance();
+        }
+
+        expectCurrentTokenTypeAndText(TokenType::Operator, ">", "Expected '>' to close type parameters");
+        advance();
+        return params;
+    }
+
     vector<shared_ptr<Argument>> Parser::parseArgumentsForDeclaration()
     {
         expectCurrentTokenType(TokenType::OpenParens, "Unexpected token after function name");
@@ -155,10 +272,7 @@ namespace parse
 
             advance();
 
-            expectCurrentTokenType(TokenType::Identifier, "Type for function argument.");
-
-            string type = current().text();
-            advance();
+            string type = parseType("Type for function argument.");
 
             args.push_back(shared_ptr<Argument>(new Argument(type, name)));
 
@@ -180,7 +294,7 @@ namespace parse
         return args;
     }
 
-    vector<shared_ptr<Function>> Parser::parseImport()
+    shared_ptr<Assembly> Parser::parseImport()
     {
         // TODO: better search, user defined imports
         expectCurrentTokenTypeAndText(TokenType::Keyword, "import", "Missing import keyword");
@@ -200,24 +314,49 @@ namespace parse
             fileName = filesystem::path("framework") / fileName;
         }
 
+        // A module imported from several files is only parsed once, so its functions and the
+        // instantiations of its generics aren't defined twice
+        if (filesystem::exists(fileName) && !mImported->insert(filesystem::canonical(fileName).string()).second)
+        {
+            return nullptr;
+        }
+
         if (fb.open(fileName.string().c_str(), ios::in))
         {
             istream input = istream(&fb);
 
             Tokenizer tok;
             Parser parser(fileName.string(), tok, input);
-            shared_ptr<ast::Assembly> importAssembly = parser.parse();
-            return importAssembly->getFunctions();
+            parser.mImported = mImported;
+            return parser.parse();
         }
         else
         {
             reportFatalError("Could not find import file " + fileName.string());
-            return vector<shared_ptr<Function>>();
+            return nullptr;
         }
     }
 
+    bool Parser::atFunction()
+    {
+        return current().type() == TokenType::Keyword
+            && (current().text() == "fn" || current().text() == "inline" || current().text() == "noinline");
+    }
+
     shared_ptr<Function> Parser::parseFunction(bool isLocal, Visibility visibility)
     {
+        Inlining inlining = Inlining::Default;
+        if (current().type() == TokenType::Keyword && current().text() == "inline")
+        {
+            inlining = Inlining::Always;
+            advance();
+        }
+        else if (current().type() == TokenType::Keyword && current().text() == "noinline")
+        {
+            inlining = Inlining::Never;
+            advance();
+        }
+
         expectCurrentTokenTypeAndText(TokenType::Keyword, "fn", "Missing function keyword");
 
         advance();
@@ -227,6 +366,14 @@ namespace parse
         string name = current().text();
         advance();
 
+        vector<string> typeParameters;
+        vector<string> enclosingParameters = mTypeParameters;
+        if (current().type() == TokenType::Operator && current().text() == "<")
+        {
+            typeParameters = parseTypeParameters();
+            mTypeParameters = typeParameters;
+        }
+
         vector<shared_ptr<Argument>> args = parseArgumentsForDeclaration();
 
         string returnType;
@@ -234,16 +381,14 @@ namespace parse
         {
             advance();
 
-            expectCurrentTokenType(TokenType::Identifier, "Invalid return type");
-
             // TODO: if multiple return types are wanted, need to implement here
-            returnType = current().text();
-            advance();
+            returnType = parseType("Invalid return type");
         }
 
         shared_ptr<BlockNode> block = parseBlock();
+        mTypeParameters = enclosingParameters;
 
-        return shared_ptr<Function>(new Function(block, name, args, returnType, isLocal, visibility));
+        return shared_ptr<Function>(new Function(block, name, args, returnType, isLocal, visibility, typeParameters, inlining));
     }
 
     shared_ptr<Field> Parser::parseField()
@@ -275,9 +420,7 @@ namespace parse
         advance();
 
         // Parse type
-        expectCurrentTokenType(TokenType::Identifier, "Expected field type");
-        string type = current().text();
-        advance();
+        string type = parseType("Expected field type");
 
         expectCurrentTokenType(TokenType::SemiColon, "Expected ';' after field declaration");
         advance();
@@ -287,13 +430,25 @@ namespace parse
 
     shared_ptr<ClassDeclaration> Parser::parseClass()
     {
-        expectCurrentTokenTypeAndText(TokenType::Keyword, "class", "Expected 'class' keyword");
+        // Structs share the class syntax, only their storage differs
+        bool valueType = current().type() == TokenType::Keyword && current().text() == "struct";
+        if (!valueType)
+        {
+            expectCurrentTokenTypeAndText(TokenType::Keyword, "class", "Expected 'class' keyword");
+        }
         advance();
 
         expectCurrentTokenType(TokenType::Identifier, "Expected class name");
         string name = current().text();
         advance();
 
+        vector<string> typeParameters;
+        if (current().type() == TokenType::Operator && current().text() == "<")
+        {
+            typeParameters = parseTypeParameters();
+            mTypeParameters = typeParameters;
+        }
+
         expectCurrentTokenType(TokenType::LeftBrace, "Expected '{' after class name");
         advance();
 
@@ -303,10 +458,10 @@ namespace parse
         while (current().type() != TokenType::RightBrace)
         {
             // Check if this is a method definition
-            // Methods can be: "fn name()", "public fn name()", or "private fn name()"
+            // Methods can be: "fn name()", "public fn name()", or "private fn name()", with "inline" or "noinline" before "fn"
             if (current().type() == TokenType::Keyword)
             {
-                if (current().text() == "fn")
+                if (atFunction())
                 {
                     // Default to public visibility
                     shared_ptr<Function> method = parseFunction(false, Visibility::Public);
@@ -315,14 +470,20 @@ namespace parse
                 else if (current().text() == "public")
                 {
                     advance();
-                    expectCurrentTokenTypeAndText(TokenType::Keyword, "fn", "Expected 'fn' after 'public'");
+                    if (!atFunction())
+                    {
+                        reportFatalError("Expected 'fn' after 'public'");
+                    }
                     shared_ptr<Function> method = parseFunction(false, Visibility::Public);
                     methods.push_back(method);
                 }
                 else if (current().text() == "private")
                 {
                     advance();
-                    expectCurrentTokenTypeAndText(TokenType::Keyword, "fn", "Expected 'fn' after 'private'");
+                    if (!atFunction())
+                    {
+                        reportFatalError("Expected 'fn' after 'private'");
+                    }
                     shared_ptr<Function> method = parseFunction(false, Visibility::Private);
                     methods.push_back(method);
                 }
@@ -332,6 +493,11 @@ namespace parse
                     shared_ptr<Field> field = parseField();
                     fields.push_back(field);
                 }
+
+                if (!methods.empty() && methods.back()->isGeneric())
+                {
+                    reportFatalError("Method " + methods.back()->getName() + " can't declare type parameters, make the class generic instead");
+                }
             }
             else
             {
@@ -343,8 +509,9 @@ namespace parse
 
         expectCurrentTokenType(TokenType::RightBrace, "Expected '}' to close class");
         advance();
+        mTypeParameters.clear();
 
-        return shared_ptr<ClassDeclaration>(new ClassDeclaration(name, fields, methods));
+        return shared_ptr<ClassDeclaration>(new ClassDeclaration(name, fields, methods, valueType, typeParameters));
     }
 
     shared_ptr<NamespaceDeclaration> Parser::parseNamespace()
@@ -380,11 +547,14 @@ namespace parse
                 if (current().text() == "local")
                 {
                     advance();
-                    expectCurrentTokenTypeAndText(TokenType::Keyword, "fn", "Expected 'fn' after 'local'");
+                    if (!atFunction())
+                    {
+                        reportFatalError("Expected 'fn' after 'local'");
+                    }
                     shared_ptr<Function> func = parseFunction(true);
                     functions.push_back(func);
                 }
-                else if (current().text() == "fn")
+                else if (atFunction())
                 {
                     shared_ptr<Function> func = parseFunction(false);
                     functions.push_back(func);
@@ -403,6 +573,12 @@ namespace parse
                 {
                     reportFatalError("Unexpected keyword in namespace: " + current().text());
                 }
+
+                // Instantiations are named after the template, which namespaces would have to qualify
+                if ((!functions.empty() && functions.back()->isGeneric()) || (!classes.empty() && classes.back()->isGeneric()))
+                {
+                    reportFatalError("Generic functions and classes must be declared outside of namespaces");
+                }
             }
             else
             {
@@ -467,24 +643,108 @@ namespace parse
     }
 
     shared_ptr<Expression> Parser::makeNode()
+    {
+        shared_ptr<Expression> node = makePrimary();
+
+        // Indexing binds tighter than any operator: "a[i] + 1", "this.values[i]"
+        while (current().type() == TokenType::LeftBracket)
+        {
+            int line = current().line();
+            int col = current().column();
+            advance();
+
+            shared_ptr<Expression> index = makeNode();
+            if (current().type() != TokenType::RightBracket)
+            {
+                index = parseStatementHelper(index, 0);
+            }
+
+            expectCurrentTokenType(TokenType::RightBracket, "Expected ']' after index");
+            advance();
+            node = shared_ptr<Expression>(new IndexNode(node, index, line, col));
+        }
+
+        return node;
+    }
+
+    shared_ptr<Expression> Parser::parseNumber()
+    {
+        // "42", "255u8", "1.5" or "0.5f32". Without a suffix the literal's type comes from where
+        // it's used, an int or a float when nothing decides.
+        string text = current().text();
+        size_t suffixStart = text.find_first_not_of("-0123456789.");
+        string digits = text.substr(0, suffixStart);
+        string suffix = suffixStart == string::npos ? "" : canonicalType(text.substr(suffixStart));
+        bool isFloat = digits.find('.') != string::npos;
+        int line = current().line();
+        int col = current().column();
+
+        if (!suffix.empty() && !isIntegerType(suffix) && !isFloatType(suffix))
+        {
+            reportFatalError("Unknown literal suffix " + suffix, current());
+        }
+
+        if (isFloat || isFloatType(suffix))
+        {
+            if (isIntegerType(suffix))
+            {
+                reportFatalError("Float literal " + text + " can't have the integer suffix " + suffix, current());
+            }
+            return shared_ptr<Expression>(new FloatLiteralNode(stod(digits), line, col, suffix));
+        }
+
+        // Unsuffixed literals may still become an i64, their range is checked once their type is known
+        int64_t value = 0;
+        try
+        {
+            value = suffix == "u64" ? static_cast<int64_t>(stoull(digits)) : stoll(digits);
+        }
+        catch (const out_of_range &)
+        {
+            reportFatalError("Integer literal " + text + " is out of range", current());
+        }
+        if (!suffix.empty() && suffix != "u64" && !integerFits(value, suffix))
+        {
+            reportFatalError("Integer literal " + digits + " doesn't fit in " + suffix, current());
+        }
+        if (suffix == "u64" && digits[0] == '-')
+        {
+            reportFatalError("Integer literal " + digits + " doesn't fit in u64", current());
+        }
+        return shared_ptr<Expression>(new IntegerLiteralNode(value, line, col, suffix));
+    }
+
+    shared_ptr<Expression> Parser::makePrimary()
     {
         shared_ptr<Expression> node;
-        double dVal;
-        int iVal;
         int line = current().line();
         int col = current().column();
 
-        // Handle alloc keyword
+        // Handle alloc keyword, "alloc [T](n)" allocates an array of n elements
         if (current().type() == TokenType::Keyword && current().text() == "alloc")
         {
             advance();
-            expectCurrentTokenType(TokenType::Identifier, "Expected type name after 'alloc'");
-            string typeName = current().text();
-            advance();
+            string typeName = parseType("Expected type name after 'alloc'");
             vector<shared_ptr<Expression>> args = parseFunctionArgs();
             return shared_ptr<Expression>(new AllocNode(typeName, args, line, col));
         }
 
+        // "spawn f(args)" runs a call on the thread pool, only plain function calls can be spawned
+        if (current().type() == TokenType::Keyword && current().text() == "spawn")
+        {
+            advance();
+            if (current().type() != TokenType::Identifier || lookAhead().type() != TokenType::OpenParens)
+            {
+                reportFatalError("Expected a function call after 'spawn'", current());
+            }
+            string name = current().text();
+            advance();
+            vector<shared_ptr<Expression>> args = parseFunctionArgs();
+            shared_ptr<FunctionCallNode> call(new FunctionCallNode(name, args, line, col));
+            call->setSpawned(true);
+            return call;
+        }
+
         // Handle 'this' keyword - treat as special identifier
         if (current().type() == TokenType::Keyword && current().text() == "this")
         {
@@ -518,9 +778,9 @@ namespace parse
         switch (current().type())
         {
         case TokenType::IntLiteral:
+        case TokenType::FloatLiteral:
         {
-            iVal = stoi(current().text());
-            node = shared_ptr<Expression>(new IntegerLiteralNode(iVal, line, col));
+            node = parseNumber();
             advance();
         }
             break;
@@ -531,7 +791,7 @@ namespace parse
             if (current().type() == TokenType::Identifier
                 && lookAhead().type() == TokenType::CloseParens)
             {
-                string type = current().text();
+                string type = canonicalType(current().text());
                 mTokens.advanceBy(2);
                 shared_ptr<Expression> exp = makeNode();
                 node = shared_ptr<Expression>(new CastNode(type, exp, line, col));
@@ -551,13 +811,6 @@ namespace parse
             advance();
         }
             break;
-        case TokenType::FloatLiteral:
-        {
-            dVal = stod(current().text());
-            node = shared_ptr<Expression>(new FloatLiteralNode(dVal, line, col));
-            advance();
-        }
-            break;
         case TokenType::Identifier:
         {
             // Check for qualified call or method call: Identifier.something[.more][(args)]
@@ -702,6 +955,10 @@ namespace parse
         {
             return 7;  // Highest precedence for member access
         }
+        else if (opStr == "..")
+        {
+            return -1;  // Only separates the bounds of a for range, never part of an expression
+        }
         else
         {
             CONSISTENCY_CHECK(false, "Unrecognized operator in parser.");
@@ -726,6 +983,13 @@ namespace parse
                 expectCurrentTokenType(TokenType::Identifier, "Expected member name after '.'");
                 string memberName = current().text();
                 advance();
+                if (current().type() == TokenType::OpenParens)
+                {
+                    // Method call on an element or a call result: "points[i].scale(2.0)"
+                    vector<shared_ptr<Expression>> args = parseFunctionArgs();
+                    curr = shared_ptr<Expression>(new MethodCallNode(curr, memberName, args, opLine, opCol));
+                    continue;
+                }
                 curr = shared_ptr<Expression>(new MemberAccessNode(curr, memberName, opLine, opCol));
                 continue;
             }
@@ -779,6 +1043,18 @@ namespace parse
             {
                 return parseWhile();
             }
+            else if (curr.text() == "for")
+            {
+                return parseFor();
+            }
+            else if (curr.text() == "parallel")
+            {
+                advance();
+                expectCurrentTokenTypeAndText(TokenType::Keyword, "for", "Expected for after parallel.");
+                shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(parseFor());
+                forNode->setParallel(true);
+                return forNode;
+            }
             else if (curr.text() == "return")
             {
                 int line = curr.line();
@@ -806,9 +1082,9 @@ namespace parse
             {
                 return parseIf();
             }
-            else if (curr.text() == "this")
+            else if (curr.text() == "this" || curr.text() == "spawn")
             {
-                // 'this' is a keyword but behaves like an identifier expression
+                // 'this' is a keyword but behaves like an identifier expression, a spawn is a call
                 shared_ptr<Expression> statement = parseStatement();
                 expectCurrentTokenType(TokenType::SemiColon, "Expected semicolon after statement.");
                 advance();
@@ -861,6 +1137,45 @@ namespace parse
         return shared_ptr<Expression>(new WhileNode(condition, block, line, col));
     }
 
+    shared_ptr<Expression> Parser::parseForOperand()
+    {
+        shared_ptr<Expression> operand = makeNode();
+        if (current().type() == TokenType::Operator)
+        {
+            operand = parseStatementHelper(operand, 0);
+        }
+        return operand;
+    }
+
+    shared_ptr<Expression> Parser::parseFor()
+    {
+        CONSISTENCY_CHECK(current().text() == "for", "parseFor called without for keyword");
+        int line = current().line();
+        int col = current().column();
+        // skip for
+        advance();
+
+        expectCurrentTokenType(TokenType::Identifier, "Expected loop variable after for.");
+        string variable = current().text();
+        advance();
+
+        expectCurrentTokenTypeAndText(TokenType::Keyword, "in", "Expected in after for loop variable.");
+        advance();
+
+        // "for i in start..end" or "for x in array"
+        shared_ptr<Expression> start = parseForOperand();
+        shared_ptr<Expression> end;
+        if (current().type() == TokenType::Operator && current().text() == "..")
+        {
+            advance();
+            end = parseForOperand();
+        }
+
+        shared_ptr<BlockNode> block = parseBlock();
+
+        return shared_ptr<Expression>(new ForNode(variable, start, end, block, line, col));
+    }
+
     shared_ptr<Expression> Parser::parseIf()
     {
         CONSISTENCY_CHECK(current().text() == "if", "parseIf called without if keyword");
@@ -921,10 +1236,7 @@ namespace parse
         {
             advance();
 
-            expectCurrentTokenType(TokenType::Identifier, "Expected type in declaration.");
-
-            type = current().text();
-            advance();
+            type = parseType("Expected type in declaration.");
 
             // Check for optional initializer after type annotation
             if (current().type() == TokenType::Operator && current().text() == "=")
@@ -956,10 +1268,36 @@ namespace parse
         {
             if (current().type() == TokenType::Keyword && current().text() == "import")
             {
-                vector<shared_ptr<Function>> expressions = parseImport();
-                functions.insert(functions.end(), expressions.begin(), expressions.end());
+                shared_ptr<Assembly> imported = parseImport();
+                if (imported != nullptr)
+                {
+                    vector<shared_ptr<Function>> importedFunctions = imported->getFunctions();
+                    functions.insert(functions.end(), importedFunctions.begin(), importedFunctions.end());
+                    vector<shared_ptr<ClassDeclaration>> importedClasses = imported->getClasses();
+                    classes.insert(classes.end(), importedClasses.begin(), importedClasses.end());
+
+                    // Compiled into this program's module, where calls to them can be inlined
+                    for (shared_ptr<Function> function : importedFunctions)
+                    {
+                        function->setImported(true);
+                    }
+                    for (shared_ptr<ClassDeclaration> importedClass : importedClasses)
+                    {
+                        for (shared_ptr<Function> method : importedClass->getMethods())
+                        {
+                            method->setImported(true);
+                        }
+                    }
+                    for (const string &type : imported->getGenericTypes())
+                    {
+                        if (find(mGenericTypes.begin(), mGenericTypes.end(), type) == mGenericTypes.end())
+                        {
+                            mGenericTypes.push_back(type);
+                        }
+                    }
+                }
             }
-            else if (current().type() == TokenType::Keyword && current().text() == "class")
+            else if (current().type() == TokenType::Keyword && (current().text() == "class" || current().text() == "struct"))
             {
                 shared_ptr<ClassDeclaration> classDecl = parseClass();
                 classes.push_back(classDecl);
@@ -977,6 +1315,6 @@ namespace parse
             }
         }
 
-        return shared_ptr<Assembly>(new Assembly(mName, functions, classes, namespaces));
+        return shared_ptr<Assembly>(new Assembly(mName, functions, classes, namespaces, mGenericTypes));
     }
 }
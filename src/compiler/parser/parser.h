@@ -3,6 +3,7 @@
 
 
 #include <memory>
+#include <set>
 
 #include "common.h"
 #include "tokenizer.h"
@@ -17,13 +18,20 @@ namespace parse
         TokenManager mTokens;
 
         std::string mName;
+        std::vector<std::string> mTypeParameters;  // Of the generic function or class being parsed
+        std::vector<std::string> mGenericTypes;
+        std::shared_ptr<std::set<std::string>> mImported;  // Shared with the parsers of imports
 
         void reportFatalError(std::string message);
         void reportFatalError(std::string message, tok::Token token);
 
+        std::string parseType(std::string message);
+        std::vector<std::string> parseTypeParameters();
         std::vector<std::shared_ptr<ast::Argument>> parseArgumentsForDeclaration();
-        std::vector<std::shared_ptr<ast::Function>> parseImport();
+        std::shared_ptr<ast::Assembly> parseImport();
         std::shared_ptr<ast::Function> parseFunction(bool isLocal = false, ast::Visibility visibility = ast::Visibility::Public);
+        // At "fn", or at an "inline"/"noinline" modifier in front of it
+        bool atFunction();
         std::shared_ptr<ast::ClassDeclaration> parseClass();
         std::shared_ptr<ast::NamespaceDeclaration> parseNamespace();
         std::shared_ptr<ast::Field> parseField();
@@ -31,6 +39,8 @@ namespace parse
 
         std::shared_ptr<ast::Expression> parseIfWhileCondition();
         std::shared_ptr<ast::Expression> parseWhile();
+        std::shared_ptr<ast::Expression> parseFor();
+        std::shared_ptr<ast::Expression> parseForOperand();
         std::shared_ptr<ast::Expression> parseIf();
         std::shared_ptr<ast::Expression> parseLet();
         std::shared_ptr<ast::Expression> parseStatementHelper(std::shared_ptr<ast::Expression> curr, int minPrecedence);
@@ -39,6 +49,8 @@ namespace parse
         std::shared_ptr<ast::Expression> parseExpression();
 
         std::shared_ptr<ast::Expression> makeNode();
+        std::shared_ptr<ast::Expression> makePrimary();
+        std::shared_ptr<ast::Expression> parseNumber();
 
         bool expectCurrentTokenType(tok::TokenType type, std::string message);
         bool expectCurrentTokenText(std::string text, std::string message);
@@ -13,8 +13,8 @@ using namespace std;
 namespace tok
 {
     Tokenizer::Tokenizer(void) :
-        mOperators({ "+", "++", "-", "--", "*", "/", "%", "=", "!=", "<", ">", "==", ">=", "<=", "->", ".", "&&", "||" }),
-        mKeywords({ "if", "elif", "else", "for", "while", "module", "return", "fn", "let", "import", "class", "public", "private", "alloc", "namespace", "local", "this" }),
+        mOperators({ "+", "++", "-", "--", "*", "/", "%", "=", "!=", "<", ">", "==", ">=", "<=", "->", ".", "..", "&&", "||" }),
+        mKeywords({ "if", "elif", "else", "for", "in", "while", "module", "return", "fn", "let", "import", "class", "public", "private", "alloc", "namespace", "local", "this", "struct", "inline", "noinline", "spawn", "parallel" }),
         mSpecialtokens({ '[', ']', '{', '}', '(', ')', ',', ';', ':' }),
         mBuffer(),
         mState(BufferState::EmptyState),
@@ -136,11 +136,13 @@ namespace tok
         break;
         case BufferState::IntConstantState:
         {
-            if (ch == '.')
+            // A type suffix like "255u8" or "1f32" follows the digits, the parser checks it
+            bool suffix = isIdentifierCharacter(mBuffer.back()) && !isDigit(mBuffer.back());
+            if (ch == '.' && !suffix)
             {
                 mState = BufferState::FloatConstantState;
             }
-            else if (!isDigit(ch))
+            else if (!isIdentifierCharacter(ch))
             {
                 mReady = true;
             }
@@ -148,7 +150,7 @@ namespace tok
         break;
         case BufferState::FloatConstantState:
         {
-            if (!isDigit(ch))
+            if (!isDigit(ch) && (!isIdentifierCharacter(ch) || mBuffer.back() == '.'))
             {
                 mReady = true;
             }
@@ -316,6 +318,23 @@ namespace tok
         char ch = mBuffer.at(mBuffer.size() - 1);
         mBuffer.pop_back();
 
+        // "0..n": what looked like the start of a float is an int followed by the range operator
+        if (mState == BufferState::FloatConstantState && ch == '.' && mBuffer.back() == '.')
+        {
+            mBuffer.pop_back();
+            string text = string(mBuffer.begin(), mBuffer.end());
+            int tokenLine = mTokenStartLine;
+            int tokenColumn = mTokenStartColumn;
+
+            mState = BufferState::OperatorState;
+            mBuffer.assign({ '.', '.' });
+            mTokenStartLine = mCurrentLine;
+            mTokenStartColumn = mCurrentColumn - 2;
+            mReady = false;
+
+            return Token(TokenType::IntLiteral, text, tokenLine, tokenColumn);
+        }
+
         string text = string(mBuffer.begin(), mBuffer.end());
         TokenType type = tokenType(text);
 
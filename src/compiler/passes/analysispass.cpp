@@ -2,6 +2,11 @@
 #include "analysispass.h"
 #include "hoistdeclarationpass.h"
 #include "typeinferencepass.h"
+#include "constantfoldingpass.h"
+#include "deadfunctionpass.h"
+#include "boundscheckpass.h"
+#include "parallelforpass.h"
+#include "monomorphizationpass.h"
 
 using namespace std;
 using namespace ast;
@@ -9,10 +14,14 @@ using namespace ast;
 namespace analysis
 {    
     AnalysisPassManager::AnalysisPassManager(BuildType type) :
-        mPasses()
+        mPasses(),
+        mMonomorphization(new MonomorphizationPass())
     {
         mPasses.push_back(shared_ptr<Pass>(new HoistDeclarationPass()));
-        mPasses.push_back(shared_ptr<Pass>(new TypeInferencePass()));
+        mPasses.push_back(shared_ptr<Pass>(new TypeInferencePass(mMonomorphization)));
+        mPasses.push_back(shared_ptr<Pass>(new ConstantFoldingPass()));
+        mPasses.push_back(shared_ptr<Pass>(new BoundsCheckPass()));
+        mPasses.push_back(shared_ptr<Pass>(new ParallelForPass()));
 
         if (type == BuildType::Debug)
         {
@@ -63,6 +72,17 @@ namespace analysis
                 performPassOnBlock(whileBlock, symbols);
             }
             break;
+            case ExpressionType::For:
+            {
+                // The loop variable is only visible in the body, and shadows any constant of the same name
+                shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(*current);
+                symbols.enterContext();
+                symbols.put(forNode->getVariable(), forNode->getVariableType());
+                symbols.put("const:" + forNode->getVariable(), "");
+                performPassOnBlock(forNode->getBlock(), symbols);
+                symbols.leaveContext();
+            }
+            break;
             case ExpressionType::Block:
             {
                 shared_ptr<BlockNode> subBlock = dynamic_pointer_cast<BlockNode>(*current);
@@ -84,6 +104,8 @@ namespace analysis
         symbols.put("funcargs:strlen_utf8", "string");
         symbols.put("string_bytes()", "int");
         symbols.put("funcargs:string_bytes", "string");
+        symbols.put("utf8_valid()", "int");
+        symbols.put("funcargs:utf8_valid", "string");
         symbols.put("print()", "void");
         symbols.put("funcargs:print", "string");
         symbols.put("print_string()", "void");
@@ -92,30 +114,46 @@ namespace analysis
         symbols.put("funcargs:print_int", "int");
         symbols.put("print_float()", "void");
         symbols.put("funcargs:print_float", "float");
+        symbols.put("float_to_string()", "string");
+        symbols.put("funcargs:float_to_string", "float");
+        symbols.put("flush()", "void");
+        symbols.put("funcargs:flush", "");
         symbols.put("strcmp()", "int");
         symbols.put("funcargs:strcmp", "string,string");
         symbols.put("refcount()", "int");
         // refcount accepts any reference type, so we don't register specific arg types
+        symbols.put("len()", "int");
+        // len accepts any array type, TypeInferencePass checks its argument
+        symbols.put("hash()", "u32");
+        // hash accepts any integer or a string, TypeInferencePass checks its argument
+        symbols.put("join()", "void");
+        // join gives the result of the task it waits for, TypeInferencePass works out its type
+        symbols.put("map_probe()", "int");
+        symbols.put("funcargs:map_probe", "[u8],int,int,int");
 
         // Register user-defined functions
-        // Also register "funcargs:functionName" -> comma-separated parameter types
         vector<shared_ptr<Function>> functions = assembly->getFunctions();
         for (auto func = functions.begin(); func != functions.end(); ++func)
         {
-            string name = (*func)->getName() + "()";
-            symbols.put(name, (*func)->getReturnType());
+            defineFunction(*func, symbols);
+        }
+    }
 
-            // Store parameter types for argument validation
-            string argsKey = "funcargs:" + (*func)->getName();
-            string argTypes = "";
-            vector<shared_ptr<Argument>> args = (*func)->getArguments();
-            for (size_t i = 0; i < args.size(); ++i)
-            {
-                if (i > 0) argTypes += ",";
-                argTypes += args[i]->getType();
-            }
-            symbols.put(argsKey, argTypes);
+    void AnalysisPassManager::defineFunction(shared_ptr<Function> function, SymbolTable<string, string> &symbols)
+    {
+        string name = function->getName() + "()";
+        symbols.putGlobal(name, function->getReturnType());
+
+        // Also register "funcargs:functionName" -> comma-separated parameter types
+        string argsKey = "funcargs:" + function->getName();
+        string argTypes = "";
+        vector<shared_ptr<Argument>> args = function->getArguments();
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            if (i > 0) argTypes += ",";
+            argTypes += args[i]->getType();
         }
+        symbols.putGlobal(argsKey, argTypes);
     }
 
     void AnalysisPassManager::defineClasses(shared_ptr<Assembly> assembly, SymbolTable<string, string> &symbols)
@@ -123,49 +161,74 @@ namespace analysis
         vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
         for (auto cls = classes.begin(); cls != classes.end(); ++cls)
         {
-            string className = (*cls)->getName();
-            // Register the class itself
-            symbols.put("class:" + className, className);
+            defineClass(*cls, symbols);
+        }
+    }
 
-            // Register each field as "ClassName.fieldName" -> fieldType
-            // Also register "fieldvis:ClassName.fieldName" -> "public" or "private"
-            vector<shared_ptr<Field>> fields = (*cls)->getFields();
-            for (auto field = fields.begin(); field != fields.end(); ++field)
-            {
-                string fieldKey = className + "." + (*field)->getName();
-                symbols.put(fieldKey, (*field)->getType());
+    void AnalysisPassManager::defineClass(shared_ptr<ClassDeclaration> cls, SymbolTable<string, string> &symbols)
+    {
+        string className = cls->getName();
+        // Register the class itself
+        symbols.putGlobal("class:" + className, className);
+
+        // A struct is created by calling it like a function: "Point(x, y)" takes the fields in order,
+        // as does "alloc Body(...)" for a class
+        string fieldTypes = "";
+        vector<shared_ptr<Field>> classFields = cls->getFields();
+        for (size_t i = 0; i < classFields.size(); ++i)
+        {
+            if (i > 0) fieldTypes += ",";
+            fieldTypes += classFields[i]->getType();
+        }
+        if (cls->isValueType())
+        {
+            symbols.putGlobal("struct:" + className, className);
+            symbols.putGlobal(className + "()", className);
+            symbols.putGlobal("funcargs:" + className, fieldTypes);
+        }
+        else
+        {
+            symbols.putGlobal("allocargs:" + className, fieldTypes);
+        }
 
-                // Store visibility for access control
-                string visKey = "fieldvis:" + className + "." + (*field)->getName();
-                string visibility = (*field)->getVisibility() == Visibility::Public ? "public" : "private";
-                symbols.put(visKey, visibility);
-            }
+        // Register each field as "ClassName.fieldName" -> fieldType
+        // Also register "fieldvis:ClassName.fieldName" -> "public" or "private"
+        vector<shared_ptr<Field>> fields = cls->getFields();
+        for (auto field = fields.begin(); field != fields.end(); ++field)
+        {
+            string fieldKey = className + "." + (*field)->getName();
+            symbols.putGlobal(fieldKey, (*field)->getType());
 
-            // Register each method as "method:ClassName.methodName()" -> returnType
-            // Also register "methodargs:ClassName.methodName" -> comma-separated parameter types
-            // Also register "methodvis:ClassName.methodName" -> "public" or "private"
-            vector<shared_ptr<Function>> methods = (*cls)->getMethods();
-            for (auto method = methods.begin(); method != methods.end(); ++method)
-            {
-                string methodKey = "method:" + className + "." + (*method)->getName() + "()";
-                symbols.put(methodKey, (*method)->getReturnType());
-
-                // Store parameter types for argument validation
-                string argsKey = "methodargs:" + className + "." + (*method)->getName();
-                string argTypes = "";
-                vector<shared_ptr<Argument>> args = (*method)->getArguments();
-                for (size_t i = 0; i < args.size(); ++i)
-                {
-                    if (i > 0) argTypes += ",";
-                    argTypes += args[i]->getType();
-                }
-                symbols.put(argsKey, argTypes);
+            // Store visibility for access control
+            string visKey = "fieldvis:" + className + "." + (*field)->getName();
+            string visibility = (*field)->getVisibility() == Visibility::Public ? "public" : "private";
+            symbols.putGlobal(visKey, visibility);
+        }
+
+        // Register each method as "method:ClassName.methodName()" -> returnType
+        // Also register "methodargs:ClassName.methodName" -> comma-separated parameter types
+        // Also register "methodvis:ClassName.methodName" -> "public" or "private"
+        vector<shared_ptr<Function>> methods = cls->getMethods();
+        for (auto method = methods.begin(); method != methods.end(); ++method)
+        {
+            string methodKey = "method:" + className + "." + (*method)->getName() + "()";
+            symbols.putGlobal(methodKey, (*method)->getReturnType());
 
-                // Store visibility for access control
-                string visKey = "methodvis:" + className + "." + (*method)->getName();
-                string visibility = (*method)->getVisibility() == Visibility::Public ? "public" : "private";
-                symbols.put(visKey, visibility);
+            // Store parameter types for argument validation
+            string argsKey = "methodargs:" + className + "." + (*method)->getName();
+            string argTypes = "";
+            vector<shared_ptr<Argument>> args = (*method)->getArguments();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                if (i > 0) argTypes += ",";
+                argTypes += args[i]->getType();
             }
+            symbols.putGlobal(argsKey, argTypes);
+
+            // Store visibility for access control
+            string visKey = "methodvis:" + className + "." + (*method)->getName();
+            string visibility = (*method)->getVisibility() == Visibility::Public ? "public" : "private";
+            symbols.putGlobal(visKey, visibility);
         }
     }
 
@@ -297,62 +360,61 @@ namespace analysis
         symbols.leaveContext();
     }
 
+    void AnalysisPassManager::performPassesOnFunction(shared_ptr<Function> function, string thisType, SymbolTable<string, string> &symbols)
+    {
+        // Enter a new context for this function with 'this' and parameters defined
+        symbols.enterContext();
+        if (!thisType.empty())
+        {
+            symbols.put("this", thisType);
+        }
+
+        // Register expected return type for validation
+        symbols.put("__return_type__", function->getReturnType());
+
+        // Register function parameters
+        vector<shared_ptr<Argument>> args = function->getArguments();
+        for (auto arg = args.begin(); arg != args.end(); ++arg)
+        {
+            symbols.put((*arg)->getName(), (*arg)->getType());
+        }
+
+        shared_ptr<BlockNode> block = function->getBlock();
+        performPassOnBlock(block, symbols);
+
+        symbols.leaveContext();
+    }
+
     void AnalysisPassManager::performPasses(shared_ptr<Assembly> assembly)
     {
         SymbolTable<string, string> symbols;
+        mMonomorphization->collectTemplates(assembly);
         defineFunctions(assembly, symbols);
         defineClasses(assembly, symbols);
         defineNamespaces(assembly, symbols);
 
+        // Generic classes the code names directly, like "alloc Box<int>(1)"
+        vector<string> genericTypes = assembly->getGenericTypes();
+        for (auto type = genericTypes.begin(); type != genericTypes.end(); ++type)
+        {
+            mMonomorphization->requireType(*type, symbols);
+        }
+
         // Process top-level functions
         vector<shared_ptr<Function>> functions = assembly->getFunctions();
         for (auto func = functions.begin(); func != functions.end(); ++func)
         {
-            // Enter a new context for this function with parameters defined
-            symbols.enterContext();
-
-            // Register expected return type for validation
-            symbols.put("__return_type__", (*func)->getReturnType());
-
-            // Register function parameters
-            vector<shared_ptr<Argument>> args = (*func)->getArguments();
-            for (auto arg = args.begin(); arg != args.end(); ++arg)
-            {
-                symbols.put((*arg)->getName(), (*arg)->getType());
-            }
-
-            shared_ptr<BlockNode> block = (*func)->getBlock();
-            performPassOnBlock(block, symbols);
-
-            symbols.leaveContext();
+            performPassesOnFunction(*func, "", symbols);
         }
 
         // Process class methods
         vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
         for (auto cls = classes.begin(); cls != classes.end(); ++cls)
         {
-            string className = (*cls)->getName();
             vector<shared_ptr<Function>> methods = (*cls)->getMethods();
             for (auto method = methods.begin(); method != methods.end(); ++method)
             {
-                // Enter a new context for this method with 'this' and parameters defined
-                symbols.enterContext();
-                symbols.put("this", className);
-
-                // Register expected return type for validation
-                symbols.put("__return_type__", (*method)->getReturnType());
-
-                // Register method parameters
-                vector<shared_ptr<Argument>> args = (*method)->getArguments();
-                for (auto arg = args.begin(); arg != args.end(); ++arg)
-                {
-                    symbols.put((*arg)->getName(), (*arg)->getType());
-                }
-
-                shared_ptr<BlockNode> block = (*method)->getBlock();
-                performPassOnBlock(block, symbols);
-
-                symbols.leaveContext();
+                performPassesOnFunction(*method, (*cls)->getName(), symbols);
             }
         }
 
@@ -362,5 +424,20 @@ namespace analysis
         {
             performPassesOnNamespace(*ns, symbols, "");
         }
+
+        // Instantiations of generics are checked last, their bodies can ask for more of them
+        vector<pair<shared_ptr<Function>, string>> pending;
+        while (mMonomorphization->takePending(pending))
+        {
+            for (auto it = pending.begin(); it != pending.end(); ++it)
+            {
+                performPassesOnFunction(it->first, it->second, symbols);
+            }
+        }
+        mMonomorphization->addInstances(assembly);
+
+        // Everything has been checked, drop what main can't reach before codegen sees it
+        DeadFunctionPass deadFunctions;
+        deadFunctions.performPass(assembly);
     }
 }
\ No newline at end of file
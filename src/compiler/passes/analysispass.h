@@ -45,12 +45,16 @@ namespace analysis
         virtual void performPass(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols) = 0;
     };
 
+    class MonomorphizationPass;
+
     class AnalysisPassManager
     {
     private:
         std::vector<std::shared_ptr<Pass>> mPasses;
+        std::shared_ptr<MonomorphizationPass> mMonomorphization;
 
         void performPassOnBlock(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols);
+        void performPassesOnFunction(std::shared_ptr<ast::Function> function, std::string thisType, SymbolTable<std::string, std::string> &symbols);
         void defineFunctions(std::shared_ptr<ast::Assembly> assembly, SymbolTable<std::string, std::string> &symbols);
         void defineClasses(std::shared_ptr<ast::Assembly> assembly, SymbolTable<std::string, std::string> &symbols);
         void defineNamespaces(std::shared_ptr<ast::Assembly> assembly, SymbolTable<std::string, std::string> &symbols);
@@ -60,6 +64,10 @@ namespace analysis
     public:
         AnalysisPassManager(BuildType type);
 
+        // Also used for instantiations of generics, which are defined while other code is checked
+        static void defineFunction(std::shared_ptr<ast::Function> function, SymbolTable<std::string, std::string> &symbols);
+        static void defineClass(std::shared_ptr<ast::ClassDeclaration> cls, SymbolTable<std::string, std::string> &symbols);
+
         void performPasses(std::shared_ptr<ast::Assembly> assembly);
     };
 }
@@ -0,0 +1,368 @@
+#include "boundscheckpass.h"
+#include "logger.h"
+
+using namespace std;
+using namespace ast;
+
+namespace analysis
+{
+    static bool isIdentifier(shared_ptr<Expression> expression, const string &name)
+    {
+        shared_ptr<IdentifierNode> identifier = dynamic_pointer_cast<IdentifierNode>(expression);
+        return identifier != nullptr && identifier->getValue() == name;
+    }
+
+    static bool isIntegerLiteral(shared_ptr<Expression> expression, int &value)
+    {
+        // Indices are ints
+        shared_ptr<IntegerLiteralNode> literal = dynamic_pointer_cast<IntegerLiteralNode>(expression);
+        if (literal == nullptr || literal->getType() != "int")
+        {
+            return false;
+        }
+        value = static_cast<int>(literal->getValue());
+        return true;
+    }
+
+    // "len(a)" with the built-in len, returns a
+    static string lengthOf(shared_ptr<Expression> expression, SymbolTable<string, string> &symbols)
+    {
+        shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
+        if (call == nullptr || call->getName() != "len" || call->argCount() != 1 || symbols.contains("funcargs:len"))
+        {
+            return "";
+        }
+
+        shared_ptr<IdentifierNode> array = dynamic_pointer_cast<IdentifierNode>(call->getArgs()[0]);
+        return array != nullptr ? array->getValue() : "";
+    }
+
+    // "a && b && c" -> a, b, c in evaluation order
+    static void collectConjuncts(shared_ptr<Expression> condition, vector<shared_ptr<Expression>> &conjuncts)
+    {
+        shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(condition);
+        if (binary != nullptr && binary->getOperator() == "&&")
+        {
+            collectConjuncts(binary->getLhs(), conjuncts);
+            collectConjuncts(binary->getRhs(), conjuncts);
+        }
+        else
+        {
+            conjuncts.push_back(condition);
+        }
+    }
+
+    // Whether the expression, or any block nested in it, assigns or declares the variable
+    static bool assigns(shared_ptr<Expression> expression, const string &name)
+    {
+        if (expression == nullptr)
+        {
+            return false;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::Declaration:
+            return dynamic_pointer_cast<DeclarationNode>(expression)->getName() == name;
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            return (binary->getOperator() == "=" && isIdentifier(binary->getLhs(), name))
+                || assigns(binary->getRhs(), name);
+        }
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                if (assigns(ifNode->getBlock(), name))
+                {
+                    return true;
+                }
+            }
+            return assigns(ifBlock->getElseBlock(), name);
+        }
+        case ExpressionType::While:
+            return assigns(dynamic_pointer_cast<WhileNode>(expression)->getBlock(), name);
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            return forNode->getVariable() == name || assigns(forNode->getBlock(), name);
+        }
+        case ExpressionType::Block:
+        {
+            for (shared_ptr<Expression> current : dynamic_pointer_cast<BlockNode>(expression)->getExpressions())
+            {
+                if (assigns(current, name))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        default:
+            // Calls can't reach a function's locals
+            return false;
+        }
+    }
+
+    // "i = i + 1"
+    static bool isIncrement(shared_ptr<Expression> expression, const string &index)
+    {
+        shared_ptr<BinaryExpressionNode> assignment = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+        if (assignment == nullptr || assignment->getOperator() != "=" || !isIdentifier(assignment->getLhs(), index))
+        {
+            return false;
+        }
+
+        shared_ptr<BinaryExpressionNode> sum = dynamic_pointer_cast<BinaryExpressionNode>(assignment->getRhs());
+        int step;
+        return sum != nullptr && sum->getOperator() == "+" && isIdentifier(sum->getLhs(), index)
+            && isIntegerLiteral(sum->getRhs(), step) && step == 1;
+    }
+
+    bool BoundsCheckPass::startsNonNegative(const vector<shared_ptr<Expression>> &statements, size_t position, const string &index)
+    {
+        // The closest statement before the loop that sets the index has to set it to a literal
+        for (size_t i = position; i > 0; --i)
+        {
+            shared_ptr<Expression> current = statements[i - 1];
+            int value;
+            shared_ptr<DeclarationNode> decl = dynamic_pointer_cast<DeclarationNode>(current);
+            if (decl != nullptr && decl->getName() == index)
+            {
+                return isIntegerLiteral(decl->getExpression(), value) && value >= 0;
+            }
+
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(current);
+            if (binary != nullptr && binary->getOperator() == "=" && isIdentifier(binary->getLhs(), index))
+            {
+                return isIntegerLiteral(binary->getRhs(), value) && value >= 0;
+            }
+
+            if (assigns(current, index))
+            {
+                return false;
+            }
+        }
+
+        // A parameter or a variable of an enclosing block, nothing is known about it
+        return false;
+    }
+
+    bool BoundsCheckPass::onlyIncrements(shared_ptr<BlockNode> body, const string &index, const string &array)
+    {
+        for (shared_ptr<Expression> current : body->getExpressions())
+        {
+            if (assigns(current, array) || (assigns(current, index) && !isIncrement(current, index)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void BoundsCheckPass::removeChecks(shared_ptr<Expression> expression, const string &index, const string &array)
+    {
+        if (expression == nullptr)
+        {
+            return;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> indexNode = dynamic_pointer_cast<IndexNode>(expression);
+            if (isIdentifier(indexNode->getArray(), array) && isIdentifier(indexNode->getIndex(), index) && indexNode->isBoundsChecked())
+            {
+                indexNode->setBoundsChecked(false);
+                LOG("Bounds check elimination: %s[%s] at line %d is in range\n", array.c_str(), index.c_str(), expression->line());
+            }
+            removeChecks(indexNode->getArray(), index, array);
+            removeChecks(indexNode->getIndex(), index, array);
+        }
+        break;
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            removeChecks(binary->getLhs(), index, array);
+            removeChecks(binary->getRhs(), index, array);
+        }
+        break;
+        case ExpressionType::Declaration:
+            removeChecks(dynamic_pointer_cast<DeclarationNode>(expression)->getExpression(), index, array);
+            break;
+        case ExpressionType::Return:
+            removeChecks(dynamic_pointer_cast<ReturnNode>(expression)->getExpression(), index, array);
+            break;
+        case ExpressionType::Cast:
+            removeChecks(dynamic_pointer_cast<CastNode>(expression)->getExpression(), index, array);
+            break;
+        case ExpressionType::MemberAccess:
+            removeChecks(dynamic_pointer_cast<MemberAccessNode>(expression)->getObject(), index, array);
+            break;
+        case ExpressionType::FunctionCall:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<FunctionCallNode>(expression)->getArgs())
+            {
+                removeChecks(arg, index, array);
+            }
+        }
+        break;
+        case ExpressionType::QualifiedCall:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<QualifiedCallNode>(expression)->getArgs())
+            {
+                removeChecks(arg, index, array);
+            }
+        }
+        break;
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            removeChecks(call->getObject(), index, array);
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                removeChecks(arg, index, array);
+            }
+        }
+        break;
+        case ExpressionType::Alloc:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<AllocNode>(expression)->getArgs())
+            {
+                removeChecks(arg, index, array);
+            }
+        }
+        break;
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                removeChecks(ifNode->getCondition(), index, array);
+                removeChecks(ifNode->getBlock(), index, array);
+            }
+            removeChecks(ifBlock->getElseBlock(), index, array);
+        }
+        break;
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expression);
+            removeChecks(whileNode->getCondition(), index, array);
+            removeChecks(whileNode->getBlock(), index, array);
+        }
+        break;
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            removeChecks(forNode->getStart(), index, array);
+            removeChecks(forNode->getEnd(), index, array);
+            removeChecks(forNode->getBlock(), index, array);
+        }
+        break;
+        case ExpressionType::Block:
+        {
+            for (shared_ptr<Expression> current : dynamic_pointer_cast<BlockNode>(expression)->getExpressions())
+            {
+                removeChecks(current, index, array);
+            }
+        }
+        break;
+        default:
+            break;
+        }
+    }
+
+    void BoundsCheckPass::analyzeLoop(shared_ptr<WhileNode> whileNode, const vector<shared_ptr<Expression>> &statements,
+                                      size_t position, SymbolTable<string, string> &symbols)
+    {
+        vector<shared_ptr<Expression>> conjuncts;
+        collectConjuncts(whileNode->getCondition(), conjuncts);
+
+        for (size_t i = 0; i < conjuncts.size(); ++i)
+        {
+            // "i < len(a)" or "len(a) > i"
+            shared_ptr<BinaryExpressionNode> compare = dynamic_pointer_cast<BinaryExpressionNode>(conjuncts[i]);
+            if (compare == nullptr || (compare->getOperator() != "<" && compare->getOperator() != ">"))
+            {
+                continue;
+            }
+
+            bool lessThan = compare->getOperator() == "<";
+            shared_ptr<IdentifierNode> indexNode = dynamic_pointer_cast<IdentifierNode>(lessThan ? compare->getLhs() : compare->getRhs());
+            string array = lengthOf(lessThan ? compare->getRhs() : compare->getLhs(), symbols);
+            if (indexNode == nullptr || array.empty())
+            {
+                continue;
+            }
+
+            string index = indexNode->getValue();
+            if (!startsNonNegative(statements, position, index) || !onlyIncrements(whileNode->getBlock(), index, array))
+            {
+                continue;
+            }
+
+            // Short-circuiting means the rest of the condition only runs when the index is in range
+            for (size_t j = i + 1; j < conjuncts.size(); ++j)
+            {
+                removeChecks(conjuncts[j], index, array);
+            }
+
+            for (shared_ptr<Expression> current : whileNode->getBlock()->getExpressions())
+            {
+                if (assigns(current, index))
+                {
+                    break;
+                }
+                removeChecks(current, index, array);
+            }
+        }
+    }
+
+    void BoundsCheckPass::analyzeFor(shared_ptr<ForNode> forNode, SymbolTable<string, string> &symbols)
+    {
+        // "for i in 0..len(a)": i is always in range, the end is read once before the loop
+        int start;
+        string index = forNode->getVariable();
+        string array = forNode->isRange() ? lengthOf(forNode->getEnd(), symbols) : "";
+        if (array.empty() || array == index || !isIntegerLiteral(forNode->getStart(), start) || start < 0
+            || assigns(forNode->getBlock(), array))
+        {
+            return;
+        }
+
+        // Assigning the loop variable only changes it until the next iteration
+        for (shared_ptr<Expression> current : forNode->getBlock()->getExpressions())
+        {
+            if (assigns(current, index))
+            {
+                break;
+            }
+            removeChecks(current, index, array);
+        }
+    }
+
+    void BoundsCheckPass::performPass(shared_ptr<BlockNode> block, SymbolTable<string, string> &symbols)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        // Nested loops are handled when their enclosing block is visited
+        vector<shared_ptr<Expression>> &expressions = block->getExpressions();
+        for (size_t i = 0; i < expressions.size(); ++i)
+        {
+            if (expressions[i]->getExpressionType() == ExpressionType::While)
+            {
+                analyzeLoop(dynamic_pointer_cast<WhileNode>(expressions[i]), expressions, i, symbols);
+            }
+            else if (expressions[i]->getExpressionType() == ExpressionType::For)
+            {
+                analyzeFor(dynamic_pointer_cast<ForNode>(expressions[i]), symbols);
+            }
+        }
+    }
+}
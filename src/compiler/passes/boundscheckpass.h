@@ -0,0 +1,35 @@
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "common.h"
+#include "analysispass.h"
+#include "ast/ast.h"
+
+namespace analysis
+{
+    // Removes the bounds check of "a[i]" inside "while (i < len(a))" when i provably stays in
+    // range: it holds a non-negative literal when the loop is entered, and the only change to it
+    // in the body is a top-level "i = i + 1", which can't overflow past the length. The body must
+    // not assign a. Accesses from the increment on keep their check, i may equal the length there.
+    // The same holds in "for i in 0..len(a)" until the body assigns i.
+    class BoundsCheckPass : public Pass
+    {
+    private:
+        void analyzeLoop(std::shared_ptr<ast::WhileNode> whileNode, const std::vector<std::shared_ptr<ast::Expression>> &statements,
+                         size_t position, SymbolTable<std::string, std::string> &symbols);
+        void analyzeFor(std::shared_ptr<ast::ForNode> forNode, SymbolTable<std::string, std::string> &symbols);
+        bool startsNonNegative(const std::vector<std::shared_ptr<ast::Expression>> &statements, size_t position, const std::string &index);
+        bool onlyIncrements(std::shared_ptr<ast::BlockNode> body, const std::string &index, const std::string &array);
+        void removeChecks(std::shared_ptr<ast::Expression> expression, const std::string &index, const std::string &array);
+
+    public:
+        BoundsCheckPass() = default;
+        virtual ~BoundsCheckPass() = default;
+
+        virtual void performPass(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols) override;
+    };
+}
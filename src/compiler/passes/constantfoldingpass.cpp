@@ -0,0 +1,478 @@
+
+#include "constantfoldingpass.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "logger.h"
+
+using namespace std;
+using namespace ast;
+
+namespace analysis
+{
+    static bool isLiteral(shared_ptr<Expression> expression)
+    {
+        ExpressionType type = expression->getExpressionType();
+        return type == ExpressionType::IntegerLiteral || type == ExpressionType::FloatLiteral
+            || type == ExpressionType::StringLiteral;
+    }
+
+    static bool isNumericLiteral(shared_ptr<Expression> expression)
+    {
+        ExpressionType type = expression->getExpressionType();
+        return type == ExpressionType::IntegerLiteral || type == ExpressionType::FloatLiteral;
+    }
+
+    static double numericValue(shared_ptr<Expression> expression)
+    {
+        if (expression->getExpressionType() == ExpressionType::IntegerLiteral)
+        {
+            return dynamic_pointer_cast<IntegerLiteralNode>(expression)->getValue();
+        }
+        return dynamic_pointer_cast<FloatLiteralNode>(expression)->getValue();
+    }
+
+    static shared_ptr<Expression> makeInt(int64_t value, shared_ptr<Expression> at, const string &type = "int")
+    {
+        return shared_ptr<Expression>(new IntegerLiteralNode(value, at->line(), at->column(), type));
+    }
+
+    static shared_ptr<Expression> makeFloat(double value, shared_ptr<Expression> at, const string &type = "float")
+    {
+        // f32 arithmetic rounds every result to single precision
+        if (type == "f32")
+        {
+            value = static_cast<float>(value);
+        }
+        return shared_ptr<Expression>(new FloatLiteralNode(value, at->line(), at->column(), type));
+    }
+
+    // The bits of a result reduced to the width of its type, sign or zero extended back to 64 bits
+    static int64_t wrapInteger(uint64_t bits, const string &type)
+    {
+        unsigned width = numericTypeBits(type);
+        if (width == 64)
+        {
+            return static_cast<int64_t>(bits);
+        }
+        uint64_t mask = (uint64_t(1) << width) - 1;
+        bits &= mask;
+        if (!isUnsignedType(type) && (bits >> (width - 1)) != 0)
+        {
+            bits |= ~mask;
+        }
+        return static_cast<int64_t>(bits);
+    }
+
+    // Constants are stored in the symbol table as "<type>:42", "<type>:<hex float>" or "string:text",
+    // the type being the literal's, like "int" or "u8"
+    static string encodeConstant(shared_ptr<Expression> literal)
+    {
+        switch (literal->getExpressionType())
+        {
+        case ExpressionType::IntegerLiteral:
+        {
+            shared_ptr<IntegerLiteralNode> integer = dynamic_pointer_cast<IntegerLiteralNode>(literal);
+            return integer->getType() + ":" + to_string(integer->getValue());
+        }
+        case ExpressionType::FloatLiteral:
+        {
+            // Hex floats round-trip exactly
+            shared_ptr<FloatLiteralNode> floating = dynamic_pointer_cast<FloatLiteralNode>(literal);
+            char text[64];
+            snprintf(text, sizeof(text), "%a", floating->getValue());
+            return floating->getType() + ":" + text;
+        }
+        case ExpressionType::StringLiteral:
+            return "string:" + dynamic_pointer_cast<StringLiteralNode>(literal)->getValue();
+        default:
+            return "";
+        }
+    }
+
+    static shared_ptr<Expression> decodeConstant(const string &constant, shared_ptr<Expression> at)
+    {
+        size_t colon = constant.find(':');
+        string type = constant.substr(0, colon);
+        if (isIntegerType(type))
+        {
+            return makeInt(strtoll(constant.c_str() + colon + 1, nullptr, 10), at, type);
+        }
+        else if (isFloatType(type))
+        {
+            return makeFloat(strtod(constant.c_str() + colon + 1, nullptr), at, type);
+        }
+        return shared_ptr<Expression>(new StringLiteralNode(constant.substr(colon + 1), at->line(), at->column()));
+    }
+
+    // Number of "name = ..." statements in the block and the blocks nested in it
+    static size_t countAssignments(shared_ptr<BlockNode> block, const string &name)
+    {
+        size_t count = 0;
+        if (block == nullptr)
+        {
+            return count;
+        }
+
+        for (shared_ptr<Expression> current : block->getExpressions())
+        {
+            switch (current->getExpressionType())
+            {
+            case ExpressionType::BinaryOperator:
+            {
+                shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(current);
+                shared_ptr<IdentifierNode> lhs = dynamic_pointer_cast<IdentifierNode>(binary->getLhs());
+                if (binary->getOperator() == "=" && lhs != nullptr && lhs->getValue() == name)
+                {
+                    count++;
+                }
+            }
+            break;
+            case ExpressionType::IfBlock:
+            {
+                shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(current);
+                for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+                {
+                    count += countAssignments(ifNode->getBlock(), name);
+                }
+                count += countAssignments(ifBlock->getElseBlock(), name);
+            }
+            break;
+            case ExpressionType::While:
+                count += countAssignments(dynamic_pointer_cast<WhileNode>(current)->getBlock(), name);
+                break;
+            case ExpressionType::For:
+                count += countAssignments(dynamic_pointer_cast<ForNode>(current)->getBlock(), name);
+                break;
+            case ExpressionType::Block:
+                count += countAssignments(dynamic_pointer_cast<BlockNode>(current), name);
+                break;
+            default:
+                break;
+            }
+        }
+
+        return count;
+    }
+
+    shared_ptr<Expression> ConstantFoldingPass::foldBinary(shared_ptr<BinaryExpressionNode> binary)
+    {
+        shared_ptr<Expression> lhs = binary->getLhs();
+        shared_ptr<Expression> rhs = binary->getRhs();
+        string op = binary->getOperator();
+
+        // Comparisons fold to 1 or 0, which codegen accepts as a condition
+        if (lhs->getExpressionType() == ExpressionType::StringLiteral && rhs->getExpressionType() == ExpressionType::StringLiteral)
+        {
+            bool equal = dynamic_pointer_cast<StringLiteralNode>(lhs)->getValue() == dynamic_pointer_cast<StringLiteralNode>(rhs)->getValue();
+            if (op == "==" || op == "!=")
+            {
+                return makeInt((op == "==") == equal ? 1 : 0, binary);
+            }
+            return binary;
+        }
+
+        if (!isNumericLiteral(lhs) || !isNumericLiteral(rhs))
+        {
+            return binary;
+        }
+
+        if (lhs->getExpressionType() == ExpressionType::IntegerLiteral && rhs->getExpressionType() == ExpressionType::IntegerLiteral)
+        {
+            // Same semantics as the generated instructions for the operands' type: arithmetic wraps,
+            // division by zero and INT_MIN / -1 are left for the program to hit at runtime
+            string type = dynamic_pointer_cast<IntegerLiteralNode>(lhs)->getType();
+            int64_t a = dynamic_pointer_cast<IntegerLiteralNode>(lhs)->getValue();
+            int64_t b = dynamic_pointer_cast<IntegerLiteralNode>(rhs)->getValue();
+            uint64_t ua = static_cast<uint64_t>(a);
+            uint64_t ub = static_cast<uint64_t>(b);
+            bool isUnsigned = isUnsignedType(type);
+            if (op == "+") return makeInt(wrapInteger(ua + ub, type), binary, type);
+            if (op == "-") return makeInt(wrapInteger(ua - ub, type), binary, type);
+            if (op == "*") return makeInt(wrapInteger(ua * ub, type), binary, type);
+            if ((op == "/" || op == "%") && (b == 0 || (!isUnsigned && b == -1 && a == wrapInteger(uint64_t(1) << (numericTypeBits(type) - 1), type))))
+            {
+                return binary;
+            }
+            if (op == "/") return makeInt(isUnsigned ? static_cast<int64_t>(ua / ub) : a / b, binary, type);
+            if (op == "%") return makeInt(isUnsigned ? static_cast<int64_t>(ua % ub) : a % b, binary, type);
+            if (op == "<") return makeInt(isUnsigned ? ua < ub : a < b, binary);
+            if (op == ">") return makeInt(isUnsigned ? ua > ub : a > b, binary);
+            if (op == "<=") return makeInt(isUnsigned ? ua <= ub : a <= b, binary);
+            if (op == ">=") return makeInt(isUnsigned ? ua >= ub : a >= b, binary);
+            if (op == "==") return makeInt(a == b, binary);
+            if (op == "!=") return makeInt(a != b, binary);
+            if (op == "&&") return makeInt(a != 0 && b != 0, binary);
+            if (op == "||") return makeInt(a != 0 || b != 0, binary);
+            return binary;
+        }
+
+        // Floats, with an int operand promoted like codegen does. Comparisons are ordered, so any
+        // comparison involving NaN is false.
+        double a = numericValue(lhs);
+        double b = numericValue(rhs);
+        string type = lhs->getExpressionType() == ExpressionType::FloatLiteral
+            ? dynamic_pointer_cast<FloatLiteralNode>(lhs)->getType() : dynamic_pointer_cast<FloatLiteralNode>(rhs)->getType();
+        if (op == "+") return makeFloat(a + b, binary, type);
+        if (op == "-") return makeFloat(a - b, binary, type);
+        if (op == "*") return makeFloat(a * b, binary, type);
+        if (op == "/") return makeFloat(a / b, binary, type);
+        if (op == "%") return makeFloat(fmod(a, b), binary, type);
+        if (op == "<") return makeInt(a < b, binary);
+        if (op == ">") return makeInt(a > b, binary);
+        if (op == "<=") return makeInt(a <= b, binary);
+        if (op == ">=") return makeInt(a >= b, binary);
+        if (op == "==") return makeInt(a == b, binary);
+        if (op == "!=") return makeInt(a < b || a > b, binary);
+        return binary;
+    }
+
+    shared_ptr<Expression> ConstantFoldingPass::foldCast(shared_ptr<CastNode> cast)
+    {
+        shared_ptr<Expression> value = cast->getExpression();
+        string type = cast->getCastType();
+        if (value->getExpressionType() == ExpressionType::IntegerLiteral)
+        {
+            shared_ptr<IntegerLiteralNode> integer = dynamic_pointer_cast<IntegerLiteralNode>(value);
+            bool fromUnsigned = isUnsignedType(integer->getType());
+            if (isFloatType(type))
+            {
+                double converted = fromUnsigned ? static_cast<double>(static_cast<uint64_t>(integer->getValue()))
+                    : static_cast<double>(integer->getValue());
+                return makeFloat(converted, cast, type);
+            }
+
+            // Truncated to the narrower type, or sign or zero extended as the source type says
+            return makeInt(wrapInteger(static_cast<uint64_t>(integer->getValue()), type), cast, type);
+        }
+
+        if (value->getExpressionType() == ExpressionType::FloatLiteral)
+        {
+            double f = dynamic_pointer_cast<FloatLiteralNode>(value)->getValue();
+            if (isFloatType(type))
+            {
+                return makeFloat(f, cast, type);
+            }
+
+            // Out of range conversions are undefined, leave them alone
+            double truncated = trunc(f);
+            if (truncated > -9.2e18 && truncated < 9.2e18 && integerFits(static_cast<int64_t>(truncated), type))
+            {
+                return makeInt(static_cast<int64_t>(truncated), cast, type);
+            }
+        }
+
+        return cast;
+    }
+
+    shared_ptr<Expression> ConstantFoldingPass::foldCall(shared_ptr<FunctionCallNode> call)
+    {
+        vector<shared_ptr<Expression>> args = call->getArgs();
+        if (args.size() != 1 || args[0]->getExpressionType() != ExpressionType::StringLiteral)
+        {
+            return call;
+        }
+
+        string value = dynamic_pointer_cast<StringLiteralNode>(args[0])->getValue();
+        if (call->getName() == "string_bytes")
+        {
+            return makeInt(static_cast<int64_t>(value.size()), call);
+        }
+        else if (call->getName() == "strlen_utf8")
+        {
+            // Codepoints are the bytes that are not continuation bytes, like the runtime counts them
+            int codepoints = 0;
+            for (unsigned char c : value)
+            {
+                if ((c & 0xC0) != 0x80)
+                {
+                    codepoints++;
+                }
+            }
+            return makeInt(codepoints, call);
+        }
+
+        return call;
+    }
+
+    shared_ptr<Expression> ConstantFoldingPass::fold(shared_ptr<Expression> expression, SymbolTable<string, string> &symbols)
+    {
+        if (expression == nullptr)
+        {
+            return expression;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::Identifier:
+        {
+            shared_ptr<IdentifierNode> identifier = dynamic_pointer_cast<IdentifierNode>(expression);
+            string constant = symbols.get("const:" + identifier->getValue());
+            if (!constant.empty())
+            {
+                LOG("Constant folding: %s -> %s\n", identifier->getValue().c_str(), constant.c_str());
+                return decodeConstant(constant, expression);
+            }
+            return expression;
+        }
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            binary->setRhs(fold(binary->getRhs(), symbols));
+            if (binary->getOperator() == "=")
+            {
+                // The target itself stays, but the index of "a[i] = ..." can still fold
+                if (binary->getLhs()->getExpressionType() == ExpressionType::Index)
+                {
+                    fold(binary->getLhs(), symbols);
+                }
+                return binary;
+            }
+
+            binary->setLhs(fold(binary->getLhs(), symbols));
+            return foldBinary(binary);
+        }
+        case ExpressionType::Cast:
+        {
+            shared_ptr<CastNode> cast = dynamic_pointer_cast<CastNode>(expression);
+            cast->setExpression(fold(cast->getExpression(), symbols));
+            return foldCast(cast);
+        }
+        case ExpressionType::FunctionCall:
+        {
+            shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
+            vector<shared_ptr<Expression>> args = call->getArgs();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                call->setArg(i, fold(args[i], symbols));
+            }
+            return foldCall(call);
+        }
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            vector<shared_ptr<Expression>> args = call->getArgs();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                call->setArg(i, fold(args[i], symbols));
+            }
+            return call;
+        }
+        case ExpressionType::QualifiedCall:
+        {
+            shared_ptr<QualifiedCallNode> call = dynamic_pointer_cast<QualifiedCallNode>(expression);
+            vector<shared_ptr<Expression>> args = call->getArgs();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                call->setArg(i, fold(args[i], symbols));
+            }
+            return call;
+        }
+        case ExpressionType::Alloc:
+        {
+            shared_ptr<AllocNode> alloc = dynamic_pointer_cast<AllocNode>(expression);
+            vector<shared_ptr<Expression>> args = alloc->getArgs();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                alloc->setArg(i, fold(args[i], symbols));
+            }
+            return alloc;
+        }
+        case ExpressionType::Index:
+        {
+            // An array never folds to a literal, but arguments of a call producing it can
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            fold(index->getArray(), symbols);
+            index->setIndex(fold(index->getIndex(), symbols));
+            return index;
+        }
+        case ExpressionType::Return:
+        {
+            shared_ptr<ReturnNode> ret = dynamic_pointer_cast<ReturnNode>(expression);
+            ret->setExpression(fold(ret->getExpression(), symbols));
+            return ret;
+        }
+        case ExpressionType::Declaration:
+        {
+            shared_ptr<DeclarationNode> decl = dynamic_pointer_cast<DeclarationNode>(expression);
+            decl->setExpression(fold(decl->getExpression(), symbols));
+            return decl;
+        }
+        case ExpressionType::IfBlock:
+        {
+            // The blocks themselves are visited separately, only the conditions belong to this one
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                ifNode->setCondition(fold(ifNode->getCondition(), symbols));
+            }
+            return ifBlock;
+        }
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expression);
+            whileNode->setCondition(fold(whileNode->getCondition(), symbols));
+            return whileNode;
+        }
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            forNode->setStart(fold(forNode->getStart(), symbols));
+            if (forNode->isRange())
+            {
+                forNode->setEnd(fold(forNode->getEnd(), symbols));
+            }
+            return forNode;
+        }
+        default:
+            return expression;
+        }
+    }
+
+    void ConstantFoldingPass::performPass(shared_ptr<BlockNode> block, SymbolTable<string, string> &symbols)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        vector<shared_ptr<Expression>> &expressions = block->getExpressions();
+        for (size_t i = 0; i < expressions.size(); ++i)
+        {
+            expressions[i] = fold(expressions[i], symbols);
+
+            shared_ptr<DeclarationNode> decl = dynamic_pointer_cast<DeclarationNode>(expressions[i]);
+            if (decl == nullptr)
+            {
+                continue;
+            }
+
+            // HoistDeclarationPass splits "let x = e" into the declaration and an "x = e" that follows it
+            shared_ptr<Expression> initializer = decl->getExpression();
+            size_t initializerAssignments = 0;
+            shared_ptr<BinaryExpressionNode> next = i + 1 < expressions.size()
+                ? dynamic_pointer_cast<BinaryExpressionNode>(expressions[i + 1]) : nullptr;
+            if (initializer == nullptr && next != nullptr && next->getOperator() == "=")
+            {
+                shared_ptr<IdentifierNode> target = dynamic_pointer_cast<IdentifierNode>(next->getLhs());
+                if (target != nullptr && target->getValue() == decl->getName())
+                {
+                    next->setRhs(fold(next->getRhs(), symbols));
+                    initializer = next->getRhs();
+                    initializerAssignments = 1;
+                }
+            }
+
+            // A variable initialized with a literal and never assigned again is replaced by the
+            // literal. Anything else shadows a constant with the same name from an enclosing block.
+            string constant;
+            if (initializer != nullptr && isLiteral(initializer)
+                && countAssignments(block, decl->getName()) == initializerAssignments)
+            {
+                constant = encodeConstant(initializer);
+                LOG("Constant folding: %s is constant %s\n", decl->getName().c_str(), constant.c_str());
+            }
+            symbols.put("const:" + decl->getName(), constant);
+        }
+    }
+}
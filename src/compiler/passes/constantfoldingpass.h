@@ -0,0 +1,32 @@
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "common.h"
+#include "analysispass.h"
+#include "ast/ast.h"
+
+namespace analysis
+{
+    // Folds arithmetic, comparisons and casts on literals, string_bytes/strlen_utf8 of string
+    // literals, and replaces reads of variables that are only ever assigned a literal once.
+    // Propagated constants are recorded in the symbol table as "const:name" -> "type:value"
+    // so nested blocks, which are visited later, see them too.
+    class ConstantFoldingPass : public Pass
+    {
+    private:
+        std::shared_ptr<ast::Expression> fold(std::shared_ptr<ast::Expression> expression, SymbolTable<std::string, std::string> &symbols);
+        std::shared_ptr<ast::Expression> foldBinary(std::shared_ptr<ast::BinaryExpressionNode> binary);
+        std::shared_ptr<ast::Expression> foldCast(std::shared_ptr<ast::CastNode> cast);
+        std::shared_ptr<ast::Expression> foldCall(std::shared_ptr<ast::FunctionCallNode> call);
+
+    public:
+        ConstantFoldingPass() = default;
+        virtual ~ConstantFoldingPass() = default;
+
+        virtual void performPass(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols) override;
+    };
+}
@@ -0,0 +1,334 @@
+
+#include "deadfunctionpass.h"
+#include "logger.h"
+
+using namespace std;
+using namespace ast;
+
+namespace analysis
+{
+    // Same as CodeGen::mangleName: "Math.Advanced" + "add" -> "Math_Advanced_add"
+    static string mangle(const string &namespacePath, const string &name)
+    {
+        string mangled = namespacePath;
+        for (size_t i = 0; i < mangled.size(); ++i)
+        {
+            if (mangled[i] == '.')
+            {
+                mangled[i] = '_';
+            }
+        }
+        return mangled + "_" + name;
+    }
+
+    // Types of the parameters and locals of a function. A name can map to several types when
+    // blocks shadow each other, every candidate is considered then.
+    static void collectVariableTypes(shared_ptr<BlockNode> block, multimap<string, string> &types)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        for (shared_ptr<Expression> current : block->getExpressions())
+        {
+            switch (current->getExpressionType())
+            {
+            case ExpressionType::Declaration:
+            {
+                shared_ptr<DeclarationNode> decl = dynamic_pointer_cast<DeclarationNode>(current);
+                types.insert({decl->getName(), decl->getTypeName()});
+            }
+            break;
+            case ExpressionType::IfBlock:
+            {
+                shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(current);
+                for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+                {
+                    collectVariableTypes(ifNode->getBlock(), types);
+                }
+                collectVariableTypes(ifBlock->getElseBlock(), types);
+            }
+            break;
+            case ExpressionType::While:
+                collectVariableTypes(dynamic_pointer_cast<WhileNode>(current)->getBlock(), types);
+                break;
+            case ExpressionType::For:
+            {
+                shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(current);
+                types.insert({forNode->getVariable(), forNode->getVariableType()});
+                collectVariableTypes(forNode->getBlock(), types);
+            }
+            break;
+            case ExpressionType::Block:
+                collectVariableTypes(dynamic_pointer_cast<BlockNode>(current), types);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void DeadFunctionPass::collectNamespace(shared_ptr<NamespaceDeclaration> ns, string parentPath)
+    {
+        string currentPath = parentPath.empty() ? ns->getName() : parentPath + "." + ns->getName();
+        for (shared_ptr<Function> func : ns->getFunctions())
+        {
+            mFunctions[mangle(currentPath, func->getName())] = {func, currentPath, ""};
+        }
+
+        for (shared_ptr<NamespaceDeclaration> nested : ns->getNestedNamespaces())
+        {
+            collectNamespace(nested, currentPath);
+        }
+    }
+
+    void DeadFunctionPass::markReachable(const string &mangledName)
+    {
+        if (mFunctions.find(mangledName) != mFunctions.end() && mReachable.insert(mangledName).second)
+        {
+            mWorklist.push_back(mangledName);
+        }
+    }
+
+    void DeadFunctionPass::visitExpression(shared_ptr<Expression> expression, const FunctionInfo &caller,
+                                           const multimap<string, string> &variableTypes)
+    {
+        if (expression == nullptr)
+        {
+            return;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::FunctionCall:
+        {
+            // Inside a namespace codegen looks for a function in the same namespace first
+            shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
+            string local = caller.namespacePath.empty() ? "" : mangle(caller.namespacePath, call->getName());
+            if (mFunctions.find(local) != mFunctions.end())
+            {
+                markReachable(local);
+            }
+            else
+            {
+                markReachable(call->getName());
+            }
+
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                visitExpression(arg, caller, variableTypes);
+            }
+        }
+        break;
+        case ExpressionType::QualifiedCall:
+        {
+            shared_ptr<QualifiedCallNode> call = dynamic_pointer_cast<QualifiedCallNode>(expression);
+            markReachable(mangle(call->getNamespacePath(), call->getFunctionName()));
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                visitExpression(arg, caller, variableTypes);
+            }
+        }
+        break;
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            string methodName = call->getMethodName();
+            shared_ptr<IdentifierNode> objIdent = dynamic_pointer_cast<IdentifierNode>(call->getObject());
+
+            // "Math.add(...)" parses as a method call on the namespace
+            if (objIdent != nullptr)
+            {
+                markReachable(mangle(objIdent->getValue(), methodName));
+            }
+
+            // Otherwise it's a method of the object's class. When the type isn't known, keep the
+            // method in every class that has one with this name.
+            set<string> classes;
+            if (objIdent != nullptr && objIdent->getValue() == "this" && !caller.className.empty())
+            {
+                classes.insert(caller.className);
+            }
+            else if (objIdent != nullptr)
+            {
+                auto range = variableTypes.equal_range(objIdent->getValue());
+                for (auto it = range.first; it != range.second; ++it)
+                {
+                    classes.insert(it->second);
+                }
+            }
+            if (classes.empty())
+            {
+                classes = mClassNames;
+            }
+
+            for (const string &className : classes)
+            {
+                markReachable(className + "_" + methodName);
+            }
+
+            visitExpression(call->getObject(), caller, variableTypes);
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                visitExpression(arg, caller, variableTypes);
+            }
+        }
+        break;
+        case ExpressionType::Alloc:
+        {
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<AllocNode>(expression)->getArgs())
+            {
+                visitExpression(arg, caller, variableTypes);
+            }
+        }
+        break;
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            visitExpression(binary->getLhs(), caller, variableTypes);
+            visitExpression(binary->getRhs(), caller, variableTypes);
+        }
+        break;
+        case ExpressionType::MemberAccess:
+            visitExpression(dynamic_pointer_cast<MemberAccessNode>(expression)->getObject(), caller, variableTypes);
+            break;
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            visitExpression(index->getArray(), caller, variableTypes);
+            visitExpression(index->getIndex(), caller, variableTypes);
+        }
+        break;
+        case ExpressionType::Cast:
+            visitExpression(dynamic_pointer_cast<CastNode>(expression)->getExpression(), caller, variableTypes);
+            break;
+        case ExpressionType::Return:
+            visitExpression(dynamic_pointer_cast<ReturnNode>(expression)->getExpression(), caller, variableTypes);
+            break;
+        case ExpressionType::Declaration:
+            visitExpression(dynamic_pointer_cast<DeclarationNode>(expression)->getExpression(), caller, variableTypes);
+            break;
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                visitExpression(ifNode->getCondition(), caller, variableTypes);
+                visitExpression(ifNode->getBlock(), caller, variableTypes);
+            }
+            visitExpression(ifBlock->getElseBlock(), caller, variableTypes);
+        }
+        break;
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expression);
+            visitExpression(whileNode->getCondition(), caller, variableTypes);
+            visitExpression(whileNode->getBlock(), caller, variableTypes);
+        }
+        break;
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            visitExpression(forNode->getStart(), caller, variableTypes);
+            visitExpression(forNode->getEnd(), caller, variableTypes);
+            visitExpression(forNode->getBlock(), caller, variableTypes);
+        }
+        break;
+        case ExpressionType::Block:
+        {
+            for (shared_ptr<Expression> current : dynamic_pointer_cast<BlockNode>(expression)->getExpressions())
+            {
+                visitExpression(current, caller, variableTypes);
+            }
+        }
+        break;
+        default:
+            break;
+        }
+    }
+
+    vector<shared_ptr<Function>> DeadFunctionPass::keepReachable(const vector<shared_ptr<Function>> &functions, const string &prefix)
+    {
+        vector<shared_ptr<Function>> kept;
+        for (shared_ptr<Function> func : functions)
+        {
+            string mangledName = prefix + func->getName();
+            if (mReachable.find(mangledName) != mReachable.end())
+            {
+                kept.push_back(func);
+            }
+            else
+            {
+                LOG("Dead function elimination: removed %s\n", mangledName.c_str());
+            }
+        }
+        return kept;
+    }
+
+    void DeadFunctionPass::pruneNamespace(shared_ptr<NamespaceDeclaration> ns, string parentPath)
+    {
+        string currentPath = parentPath.empty() ? ns->getName() : parentPath + "." + ns->getName();
+        ns->setFunctions(keepReachable(ns->getFunctions(), mangle(currentPath, "")));
+        for (shared_ptr<NamespaceDeclaration> nested : ns->getNestedNamespaces())
+        {
+            pruneNamespace(nested, currentPath);
+        }
+    }
+
+    void DeadFunctionPass::performPass(shared_ptr<Assembly> assembly)
+    {
+        for (shared_ptr<Function> func : assembly->getFunctions())
+        {
+            mFunctions[func->getName()] = {func, "", ""};
+        }
+
+        for (shared_ptr<ClassDeclaration> cls : assembly->getClasses())
+        {
+            mClassNames.insert(cls->getName());
+            for (shared_ptr<Function> method : cls->getMethods())
+            {
+                mFunctions[cls->getName() + "_" + method->getName()] = {method, "", cls->getName()};
+            }
+        }
+
+        for (shared_ptr<NamespaceDeclaration> ns : assembly->getNamespaces())
+        {
+            collectNamespace(ns, "");
+        }
+
+        // Without an entry point everything is an export
+        if (mFunctions.find("main") == mFunctions.end())
+        {
+            return;
+        }
+
+        markReachable("main");
+        while (!mWorklist.empty())
+        {
+            string name = mWorklist.back();
+            mWorklist.pop_back();
+
+            const FunctionInfo &info = mFunctions[name];
+            multimap<string, string> variableTypes;
+            for (shared_ptr<Argument> arg : info.function->getArguments())
+            {
+                variableTypes.insert({arg->getName(), arg->getType()});
+            }
+            collectVariableTypes(info.function->getBlock(), variableTypes);
+            visitExpression(info.function->getBlock(), info, variableTypes);
+        }
+
+        assembly->setFunctions(keepReachable(assembly->getFunctions(), ""));
+        for (shared_ptr<ClassDeclaration> cls : assembly->getClasses())
+        {
+            cls->setMethods(keepReachable(cls->getMethods(), cls->getName() + "_"));
+        }
+        for (shared_ptr<NamespaceDeclaration> ns : assembly->getNamespaces())
+        {
+            pruneNamespace(ns, "");
+        }
+
+        LOG("Dead function elimination: kept %zu of %zu functions\n", mReachable.size(), mFunctions.size());
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+#include <string>
+
+#include "common.h"
+#include "ast/ast.h"
+
+namespace analysis
+{
+    // Removes functions, namespace functions and methods that can't be reached from main, so
+    // imported libraries only cost compile time and code size for what the program calls.
+    // Unlike the block passes this looks at the whole assembly, so it runs after them.
+    // Functions are identified by their mangled name, the same one codegen gives them.
+    class DeadFunctionPass
+    {
+    private:
+        struct FunctionInfo
+        {
+            std::shared_ptr<ast::Function> function;
+            std::string namespacePath;  // "Math.Advanced" for namespace functions
+            std::string className;      // Owning class for methods
+        };
+
+        std::map<std::string, FunctionInfo> mFunctions;
+        std::set<std::string> mClassNames;
+        std::set<std::string> mReachable;
+        std::vector<std::string> mWorklist;
+
+        void collectNamespace(std::shared_ptr<ast::NamespaceDeclaration> ns, std::string parentPath);
+        void markReachable(const std::string &mangledName);
+        void visitExpression(std::shared_ptr<ast::Expression> expression, const FunctionInfo &caller,
+                             const std::multimap<std::string, std::string> &variableTypes);
+        std::vector<std::shared_ptr<ast::Function>> keepReachable(const std::vector<std::shared_ptr<ast::Function>> &functions,
+                                                                  const std::string &prefix);
+        void pruneNamespace(std::shared_ptr<ast::NamespaceDeclaration> ns, std::string parentPath);
+
+    public:
+        DeadFunctionPass() = default;
+        virtual ~DeadFunctionPass() = default;
+
+        void performPass(std::shared_ptr<ast::Assembly> assembly);
+    };
+}
@@ -0,0 +1,500 @@
+#include "monomorphizationpass.h"
+#include <algorithm>
+#include <sstream>
+#include "logger.h"
+
+using namespace std;
+using namespace ast;
+
+namespace analysis
+{
+    // "Pair<int,Box<float>>" -> "Pair" and {"int", "Box<float>"}, false for anything that isn't generic
+    static bool splitGenericType(const string &type, string &base, vector<string> &args)
+    {
+        size_t open = type.find('<');
+        if (open == string::npos || type.empty() || type.front() == '[' || type.back() != '>')
+        {
+            return false;
+        }
+
+        base = type.substr(0, open);
+        args.clear();
+        int depth = 0;
+        size_t start = open + 1;
+        for (size_t i = start; i < type.size() - 1; ++i)
+        {
+            char ch = type[i];
+            if (ch == '<' || ch == '[')
+            {
+                ++depth;
+            }
+            else if (ch == '>' || ch == ']')
+            {
+                --depth;
+            }
+            else if (ch == ',' && depth == 0)
+            {
+                args.push_back(type.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+        args.push_back(type.substr(start, type.size() - 1 - start));
+        return true;
+    }
+
+    static string instanceName(const string &base, const vector<string> &parameters, const map<string, string> &bindings)
+    {
+        string name = base + "<";
+        for (size_t i = 0; i < parameters.size(); ++i)
+        {
+            if (i > 0) name += ",";
+            name += bindings.at(parameters[i]);
+        }
+        return name + ">";
+    }
+
+    string MonomorphizationPass::substitute(const string &type, const map<string, string> &bindings)
+    {
+        string result;
+        size_t i = 0;
+        while (i < type.size())
+        {
+            size_t end = i;
+            while (end < type.size() && (isalnum((unsigned char)type[end]) || type[end] == '_'))
+            {
+                ++end;
+            }
+
+            if (end == i)
+            {
+                result += type[i++];
+                continue;
+            }
+
+            string name = type.substr(i, end - i);
+            auto it = bindings.find(name);
+            result += it != bindings.end() ? it->second : name;
+            i = end;
+        }
+
+        if (result.find('<') != string::npos)
+        {
+            mRequiredTypes.push_back(result);
+        }
+        return result;
+    }
+
+    shared_ptr<BlockNode> MonomorphizationPass::cloneBlock(shared_ptr<BlockNode> block, const map<string, string> &bindings)
+    {
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+
+        vector<shared_ptr<Expression>> expressions;
+        for (shared_ptr<Expression> current : block->getExpressions())
+        {
+            expressions.push_back(clone(current, bindings));
+        }
+        return shared_ptr<BlockNode>(new BlockNode(expressions, block->line(), block->column()));
+    }
+
+    shared_ptr<Expression> MonomorphizationPass::clone(shared_ptr<Expression> expression, const map<string, string> &bindings)
+    {
+        if (expression == nullptr)
+        {
+            return nullptr;
+        }
+
+        int line = expression->line();
+        int col = expression->column();
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::IntegerLiteral:
+        {
+            // Unsuffixed literals are typed by each instantiation on its own
+            shared_ptr<IntegerLiteralNode> literal = dynamic_pointer_cast<IntegerLiteralNode>(expression);
+            return shared_ptr<Expression>(new IntegerLiteralNode(literal->getValue(), line, col,
+                                                                 literal->hasExplicitType() ? literal->getType() : ""));
+        }
+        case ExpressionType::FloatLiteral:
+        {
+            shared_ptr<FloatLiteralNode> literal = dynamic_pointer_cast<FloatLiteralNode>(expression);
+            return shared_ptr<Expression>(new FloatLiteralNode(literal->getValue(), line, col,
+                                                               literal->hasExplicitType() ? literal->getType() : ""));
+        }
+        case ExpressionType::StringLiteral:
+            return shared_ptr<Expression>(new StringLiteralNode(dynamic_pointer_cast<StringLiteralNode>(expression)->getValue(), line, col));
+        case ExpressionType::Identifier:
+            return shared_ptr<Expression>(new IdentifierNode(dynamic_pointer_cast<IdentifierNode>(expression)->getValue(), line, col));
+        case ExpressionType::Empty:
+            return shared_ptr<Expression>(new EmptyStatementNode(line, col));
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            return shared_ptr<Expression>(new BinaryExpressionNode(clone(binary->getLhs(), bindings), clone(binary->getRhs(), bindings),
+                                                                   binary->getOperator(), line, col));
+        }
+        case ExpressionType::Declaration:
+        {
+            shared_ptr<DeclarationNode> decl = dynamic_pointer_cast<DeclarationNode>(expression);
+            return shared_ptr<Expression>(new DeclarationNode(decl->getName(), substitute(decl->getTypeName(), bindings),
+                                                              clone(decl->getExpression(), bindings), line, col));
+        }
+        case ExpressionType::FunctionCall:
+        {
+            shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
+            vector<shared_ptr<Expression>> args;
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                args.push_back(clone(arg, bindings));
+            }
+            shared_ptr<FunctionCallNode> copy(new FunctionCallNode(call->getName(), args, line, col));
+            copy->setSpawned(call->isSpawned());
+            return copy;
+        }
+        case ExpressionType::Return:
+            return shared_ptr<Expression>(new ReturnNode(clone(dynamic_pointer_cast<ReturnNode>(expression)->getExpression(), bindings), line, col));
+        case ExpressionType::Cast:
+        {
+            shared_ptr<CastNode> cast = dynamic_pointer_cast<CastNode>(expression);
+            return shared_ptr<Expression>(new CastNode(substitute(cast->getCastType(), bindings), clone(cast->getExpression(), bindings), line, col));
+        }
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            vector<shared_ptr<IfNode>> ifs;
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                ifs.push_back(shared_ptr<IfNode>(new IfNode(clone(ifNode->getCondition(), bindings), cloneBlock(ifNode->getBlock(), bindings),
+                                                            ifNode->line(), ifNode->column())));
+            }
+            return shared_ptr<Expression>(new IfBlockNode(ifs, cloneBlock(ifBlock->getElseBlock(), bindings), line, col));
+        }
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expression);
+            return shared_ptr<Expression>(new WhileNode(clone(whileNode->getCondition(), bindings), cloneBlock(whileNode->getBlock(), bindings), line, col));
+        }
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            shared_ptr<ForNode> copy(new ForNode(forNode->getVariable(), clone(forNode->getStart(), bindings), clone(forNode->getEnd(), bindings),
+                                                 cloneBlock(forNode->getBlock(), bindings), line, col));
+            copy->setParallel(forNode->isParallel());
+            return copy;
+        }
+        case ExpressionType::Block:
+            return cloneBlock(dynamic_pointer_cast<BlockNode>(expression), bindings);
+        case ExpressionType::Alloc:
+        {
+            shared_ptr<AllocNode> alloc = dynamic_pointer_cast<AllocNode>(expression);
+            vector<shared_ptr<Expression>> args;
+            for (shared_ptr<Expression> arg : alloc->getArgs())
+            {
+                args.push_back(clone(arg, bindings));
+            }
+            return shared_ptr<Expression>(new AllocNode(substitute(alloc->getTypeName(), bindings), args, line, col));
+        }
+        case ExpressionType::MemberAccess:
+        {
+            shared_ptr<MemberAccessNode> member = dynamic_pointer_cast<MemberAccessNode>(expression);
+            return shared_ptr<Expression>(new MemberAccessNode(clone(member->getObject(), bindings), member->getMemberName(), line, col));
+        }
+        case ExpressionType::QualifiedCall:
+        {
+            shared_ptr<QualifiedCallNode> call = dynamic_pointer_cast<QualifiedCallNode>(expression);
+            vector<shared_ptr<Expression>> args;
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                args.push_back(clone(arg, bindings));
+            }
+            return shared_ptr<Expression>(new QualifiedCallNode(call->getNamespacePath(), call->getFunctionName(), args, line, col));
+        }
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            vector<shared_ptr<Expression>> args;
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                args.push_back(clone(arg, bindings));
+            }
+            return shared_ptr<Expression>(new MethodCallNode(clone(call->getObject(), bindings), call->getMethodName(), args, line, col));
+        }
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            return shared_ptr<Expression>(new IndexNode(clone(index->getArray(), bindings), clone(index->getIndex(), bindings), line, col));
+        }
+        default:
+        {
+            OPTIMIZATION_ERROR_AT(expression, "Unexpected expression in generic template");
+        }
+        }
+    }
+
+    shared_ptr<Function> MonomorphizationPass::cloneFunction(shared_ptr<Function> function, const string &name, const map<string, string> &bindings)
+    {
+        vector<shared_ptr<Argument>> args;
+        for (shared_ptr<Argument> arg : function->getArguments())
+        {
+            args.push_back(shared_ptr<Argument>(new Argument(substitute(arg->getType(), bindings), arg->getName())));
+        }
+
+        shared_ptr<Function> clone(new Function(cloneBlock(function->getBlock(), bindings), name, args,
+                                                substitute(function->getReturnType(), bindings), function->isLocal(), function->getVisibility(),
+                                                {}, function->getInlining()));
+        clone->setImported(function->isImported());
+        return clone;
+    }
+
+    void MonomorphizationPass::collectTemplates(shared_ptr<Assembly> assembly)
+    {
+        vector<shared_ptr<Function>> functions;
+        for (shared_ptr<Function> func : assembly->getFunctions())
+        {
+            if (func->isGeneric())
+            {
+                mFunctionTemplates[func->getName()] = func;
+            }
+            else
+            {
+                functions.push_back(func);
+            }
+        }
+        assembly->setFunctions(functions);
+
+        vector<shared_ptr<ClassDeclaration>> classes;
+        for (shared_ptr<ClassDeclaration> cls : assembly->getClasses())
+        {
+            if (cls->isGeneric())
+            {
+                mClassTemplates[cls->getName()] = cls;
+            }
+            else
+            {
+                classes.push_back(cls);
+            }
+        }
+        assembly->setClasses(classes);
+    }
+
+    bool MonomorphizationPass::isTemplate(const string &name)
+    {
+        auto cls = mClassTemplates.find(name);
+        return mFunctionTemplates.find(name) != mFunctionTemplates.end()
+               || (cls != mClassTemplates.end() && cls->second->isValueType());
+    }
+
+    void MonomorphizationPass::unify(const string &pattern, const string &actual, const vector<string> &parameters,
+                                     map<string, string> &bindings, shared_ptr<Expression> call)
+    {
+        if (find(parameters.begin(), parameters.end(), pattern) != parameters.end())
+        {
+            auto it = bindings.find(pattern);
+            if (it == bindings.end())
+            {
+                bindings[pattern] = actual;
+            }
+            else if (it->second != actual)
+            {
+                OPTIMIZATION_ERROR_AT(call, "Type parameter " + pattern + " can't be both " + it->second + " and " + actual);
+            }
+            return;
+        }
+
+        // Look inside arrays and generic types, anything else is checked against the instantiation's signature
+        if (pattern.size() > 2 && pattern.front() == '[' && actual.size() > 2 && actual.front() == '[')
+        {
+            unify(pattern.substr(1, pattern.size() - 2), actual.substr(1, actual.size() - 2), parameters, bindings, call);
+            return;
+        }
+
+        string patternBase, actualBase;
+        vector<string> patternArgs, actualArgs;
+        if (splitGenericType(pattern, patternBase, patternArgs) && splitGenericType(actual, actualBase, actualArgs)
+            && patternBase == actualBase && patternArgs.size() == actualArgs.size())
+        {
+            for (size_t i = 0; i < patternArgs.size(); ++i)
+            {
+                unify(patternArgs[i], actualArgs[i], parameters, bindings, call);
+            }
+        }
+    }
+
+    string MonomorphizationPass::instantiateCall(shared_ptr<FunctionCallNode> call, const vector<string> &argTypes,
+                                                 SymbolTable<string, string> &symbols)
+    {
+        // A generic struct is built from its fields, so they play the role of the arguments
+        string name = call->getName();
+        vector<string> parameters;
+        vector<string> patterns;
+        auto func = mFunctionTemplates.find(name);
+        if (func != mFunctionTemplates.end())
+        {
+            parameters = func->second->getTypeParameters();
+            for (shared_ptr<Argument> arg : func->second->getArguments())
+            {
+                patterns.push_back(arg->getType());
+            }
+        }
+        else
+        {
+            shared_ptr<ClassDeclaration> cls = mClassTemplates.at(name);
+            parameters = cls->getTypeParameters();
+            for (shared_ptr<Field> field : cls->getFields())
+            {
+                patterns.push_back(field->getType());
+            }
+        }
+
+        if (argTypes.size() != patterns.size())
+        {
+            stringstream error;
+            error << "Function " << name << " expects " << patterns.size() << " argument(s) but got " << argTypes.size();
+            OPTIMIZATION_ERROR_AT(call, error.str());
+        }
+
+        map<string, string> bindings;
+        for (size_t i = 0; i < patterns.size(); ++i)
+        {
+            unify(patterns[i], argTypes[i], parameters, bindings, call);
+        }
+
+        for (const string &param : parameters)
+        {
+            if (bindings.find(param) == bindings.end())
+            {
+                OPTIMIZATION_ERROR_AT(call, "Cannot infer type parameter " + param + " of " + name + " from its arguments");
+            }
+        }
+
+        string instance = instanceName(name, parameters, bindings);
+        if (func == mFunctionTemplates.end())
+        {
+            requireType(instance, symbols);
+        }
+        else if (mInstantiated.insert(instance).second)
+        {
+            LOG("Monomorphization: instantiated %s\n", instance.c_str());
+            shared_ptr<Function> function = cloneFunction(func->second, instance, bindings);
+            mFunctions.push_back(function);
+            mPending.push_back({function, ""});
+            AnalysisPassManager::defineFunction(function, symbols);
+            instantiateRequiredTypes(symbols);
+        }
+        return instance;
+    }
+
+    void MonomorphizationPass::requireType(const string &type, SymbolTable<string, string> &symbols)
+    {
+        if (type.size() > 2 && type.front() == '[' && type.back() == ']')
+        {
+            requireType(type.substr(1, type.size() - 2), symbols);
+            return;
+        }
+
+        string base;
+        vector<string> args;
+        if (!splitGenericType(type, base, args))
+        {
+            return;
+        }
+
+        for (const string &arg : args)
+        {
+            requireType(arg, symbols);
+        }
+
+        // Task handles are built in, only their result type can be a generic class
+        if (!taskResultType(type).empty())
+        {
+            return;
+        }
+
+        if (mInstantiated.find(type) == mInstantiated.end())
+        {
+            instantiateClass(type, symbols);
+        }
+    }
+
+    void MonomorphizationPass::instantiateClass(const string &type, SymbolTable<string, string> &symbols)
+    {
+        string base;
+        vector<string> args;
+        splitGenericType(type, base, args);
+
+        auto it = mClassTemplates.find(base);
+        if (it == mClassTemplates.end())
+        {
+            OPTIMIZATION_ERROR("Unknown generic class " + base + " in " + type);
+        }
+
+        shared_ptr<ClassDeclaration> cls = it->second;
+        vector<string> parameters = cls->getTypeParameters();
+        if (args.size() != parameters.size())
+        {
+            stringstream error;
+            error << "Class " << base << " expects " << parameters.size() << " type argument(s) but got " << args.size();
+            OPTIMIZATION_ERROR(error.str());
+        }
+
+        // Registered before the copy so fields and methods can refer to the class itself
+        mInstantiated.insert(type);
+        LOG("Monomorphization: instantiated %s\n", type.c_str());
+
+        map<string, string> bindings;
+        for (size_t i = 0; i < parameters.size(); ++i)
+        {
+            bindings[parameters[i]] = args[i];
+        }
+
+        vector<shared_ptr<Field>> fields;
+        for (shared_ptr<Field> field : cls->getFields())
+        {
+            fields.push_back(shared_ptr<Field>(new Field(field->getName(), substitute(field->getType(), bindings), field->getVisibility())));
+        }
+
+        vector<shared_ptr<Function>> methods;
+        for (shared_ptr<Function> method : cls->getMethods())
+        {
+            methods.push_back(cloneFunction(method, method->getName(), bindings));
+            mPending.push_back({methods.back(), type});
+        }
+
+        shared_ptr<ClassDeclaration> instance(new ClassDeclaration(type, fields, methods, cls->isValueType()));
+        mClasses.push_back(instance);
+        AnalysisPassManager::defineClass(instance, symbols);
+        instantiateRequiredTypes(symbols);
+    }
+
+    void MonomorphizationPass::instantiateRequiredTypes(SymbolTable<string, string> &symbols)
+    {
+        while (!mRequiredTypes.empty())
+        {
+            string type = mRequiredTypes.back();
+            mRequiredTypes.pop_back();
+            requireType(type, symbols);
+        }
+    }
+
+    bool MonomorphizationPass::takePending(vector<pair<shared_ptr<Function>, string>> &pending)
+    {
+        pending.swap(mPending);
+        mPending.clear();
+        return !pending.empty();
+    }
+
+    void MonomorphizationPass::addInstances(shared_ptr<Assembly> assembly)
+    {
+        vector<shared_ptr<Function>> functions = assembly->getFunctions();
+        functions.insert(functions.end(), mFunctions.begin(), mFunctions.end());
+        assembly->setFunctions(functions);
+
+        vector<shared_ptr<ClassDeclaration>> classes = assembly->getClasses();
+        classes.insert(classes.end(), mClasses.begin(), mClasses.end());
+        assembly->setClasses(classes);
+
+        LOG("Monomorphization: %zu function(s) and %zu class(es) instantiated\n", mFunctions.size(), mClasses.size());
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+#include <string>
+
+#include "common.h"
+#include "analysispass.h"
+#include "ast/ast.h"
+
+namespace analysis
+{
+    // Specializes generic functions and classes for the types they're used with. Templates are
+    // taken out of the assembly before anything is checked, every use then gets its own copy
+    // with the type parameters substituted: "max(1, 2)" calls "max<int>", "Box<[float]>" is a
+    // class of its own. An instantiation is created once per compilation however many modules
+    // ask for it, and is checked and compiled like handwritten code, so there's no boxing and
+    // errors in a template show up when it's first used with types it doesn't work for.
+    class MonomorphizationPass
+    {
+    private:
+        std::map<std::string, std::shared_ptr<ast::Function>> mFunctionTemplates;
+        std::map<std::string, std::shared_ptr<ast::ClassDeclaration>> mClassTemplates;
+        std::set<std::string> mInstantiated;
+        std::vector<std::shared_ptr<ast::Function>> mFunctions;
+        std::vector<std::shared_ptr<ast::ClassDeclaration>> mClasses;
+        // Instantiated functions and methods whose bodies haven't been checked, with the type of "this"
+        std::vector<std::pair<std::shared_ptr<ast::Function>, std::string>> mPending;
+        // Generic types written in a template, instantiated once the copy is complete
+        std::vector<std::string> mRequiredTypes;
+
+        std::string substitute(const std::string &type, const std::map<std::string, std::string> &bindings);
+        std::shared_ptr<ast::Expression> clone(std::shared_ptr<ast::Expression> expression, const std::map<std::string, std::string> &bindings);
+        std::shared_ptr<ast::BlockNode> cloneBlock(std::shared_ptr<ast::BlockNode> block, const std::map<std::string, std::string> &bindings);
+        std::shared_ptr<ast::Function> cloneFunction(std::shared_ptr<ast::Function> function, const std::string &name,
+                                                     const std::map<std::string, std::string> &bindings);
+        void unify(const std::string &pattern, const std::string &actual, const std::vector<std::string> &parameters,
+                   std::map<std::string, std::string> &bindings, std::shared_ptr<ast::Expression> call);
+        void instantiateClass(const std::string &type, SymbolTable<std::string, std::string> &symbols);
+        void instantiateRequiredTypes(SymbolTable<std::string, std::string> &symbols);
+
+    public:
+        MonomorphizationPass() = default;
+        virtual ~MonomorphizationPass() = default;
+
+        // Moves the templates out of the assembly, before anything is defined or checked
+        void collectTemplates(std::shared_ptr<ast::Assembly> assembly);
+        // A generic function, or a generic struct whose type arguments come from its constructor
+        bool isTemplate(const std::string &name);
+        // Infers the type arguments of a call to a template and returns the name of the instantiation
+        std::string instantiateCall(std::shared_ptr<ast::FunctionCallNode> call, const std::vector<std::string> &argTypes,
+                                    SymbolTable<std::string, std::string> &symbols);
+        // Instantiates every generic class a type like "[Box<Pair<int,float>>]" refers to
+        void requireType(const std::string &type, SymbolTable<std::string, std::string> &symbols);
+        bool takePending(std::vector<std::pair<std::shared_ptr<ast::Function>, std::string>> &pending);
+        // Hands the instantiations to the assembly once they've all been checked
+        void addInstances(std::shared_ptr<ast::Assembly> assembly);
+    };
+}
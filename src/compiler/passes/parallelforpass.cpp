@@ -0,0 +1,304 @@
+#include "parallelforpass.h"
+#include "logger.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace ast;
+
+namespace analysis
+{
+    static bool isIdentifier(shared_ptr<Expression> expression, const string &name)
+    {
+        shared_ptr<IdentifierNode> identifier = dynamic_pointer_cast<IdentifierNode>(expression);
+        return identifier != nullptr && identifier->getValue() == name;
+    }
+
+    // Whether the expression reads the variable
+    static bool mentions(shared_ptr<Expression> expression, const string &name)
+    {
+        if (expression == nullptr)
+        {
+            return false;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::Identifier:
+            return isIdentifier(expression, name);
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            return mentions(binary->getLhs(), name) || mentions(binary->getRhs(), name);
+        }
+        case ExpressionType::Cast:
+            return mentions(dynamic_pointer_cast<CastNode>(expression)->getExpression(), name);
+        case ExpressionType::FunctionCall:
+        {
+            vector<shared_ptr<Expression>> args = dynamic_pointer_cast<FunctionCallNode>(expression)->getArgs();
+            return any_of(args.begin(), args.end(), [&](shared_ptr<Expression> arg) { return mentions(arg, name); });
+        }
+        case ExpressionType::QualifiedCall:
+        {
+            vector<shared_ptr<Expression>> args = dynamic_pointer_cast<QualifiedCallNode>(expression)->getArgs();
+            return any_of(args.begin(), args.end(), [&](shared_ptr<Expression> arg) { return mentions(arg, name); });
+        }
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            vector<shared_ptr<Expression>> args = call->getArgs();
+            return mentions(call->getObject(), name)
+                || any_of(args.begin(), args.end(), [&](shared_ptr<Expression> arg) { return mentions(arg, name); });
+        }
+        case ExpressionType::MemberAccess:
+            return mentions(dynamic_pointer_cast<MemberAccessNode>(expression)->getObject(), name);
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            return mentions(index->getArray(), name) || mentions(index->getIndex(), name);
+        }
+        default:
+            // Statements don't appear inside the operands of a sum
+            return false;
+        }
+    }
+
+    // "total = total + a - b ...", with total first in a chain of + and -, or "total = e + total",
+    // where the other operands don't read total
+    static bool isSum(shared_ptr<BinaryExpressionNode> assignment, const string &name)
+    {
+        shared_ptr<BinaryExpressionNode> sum = dynamic_pointer_cast<BinaryExpressionNode>(assignment->getRhs());
+        if (sum != nullptr && sum->getOperator() == "+" && isIdentifier(sum->getRhs(), name) && !mentions(sum->getLhs(), name))
+        {
+            return true;
+        }
+
+        shared_ptr<Expression> first = assignment->getRhs();
+        while (sum != nullptr && (sum->getOperator() == "+" || sum->getOperator() == "-"))
+        {
+            if (mentions(sum->getRhs(), name))
+            {
+                return false;
+            }
+            first = sum->getLhs();
+            sum = dynamic_pointer_cast<BinaryExpressionNode>(first);
+        }
+        return first != assignment->getRhs() && isIdentifier(first, name);
+    }
+
+    // Whether name is a variable of the body at this point, declared earlier in an enclosing block
+    bool ParallelForPass::isLocal(const LoopUses &uses, const string &name)
+    {
+        return any_of(uses.scopes.begin(), uses.scopes.end(),
+                      [&](const vector<string> &scope) { return find(scope.begin(), scope.end(), name) != scope.end(); });
+    }
+
+    void ParallelForPass::collectUses(shared_ptr<Expression> expression, LoopUses &uses)
+    {
+        if (expression == nullptr)
+        {
+            return;
+        }
+
+        switch (expression->getExpressionType())
+        {
+        case ExpressionType::Identifier:
+        {
+            string name = dynamic_pointer_cast<IdentifierNode>(expression)->getValue();
+            if (!isLocal(uses, name) && uses.readCounts[name]++ == 0)
+            {
+                uses.reads.push_back(name);
+            }
+        }
+        break;
+        case ExpressionType::BinaryOperator:
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            shared_ptr<IdentifierNode> target = dynamic_pointer_cast<IdentifierNode>(binary->getLhs());
+            if (binary->getOperator() == "=" && target != nullptr)
+            {
+                if (!isLocal(uses, target->getValue()))
+                {
+                    uses.assignments[target->getValue()].push_back(binary);
+                }
+            }
+            else
+            {
+                shared_ptr<Expression> object = binary->getLhs();
+                while (binary->getOperator() == "=" && object->getExpressionType() == ExpressionType::MemberAccess)
+                {
+                    object = dynamic_pointer_cast<MemberAccessNode>(object)->getObject();
+                }
+                shared_ptr<IdentifierNode> holder = dynamic_pointer_cast<IdentifierNode>(object);
+                if (object != binary->getLhs() && holder != nullptr && !isLocal(uses, holder->getValue()))
+                {
+                    uses.fieldAssignments.push_back({holder->getValue(), binary});
+                }
+                collectUses(binary->getLhs(), uses);
+            }
+            collectUses(binary->getRhs(), uses);
+        }
+        break;
+        case ExpressionType::Declaration:
+        {
+            shared_ptr<DeclarationNode> declaration = dynamic_pointer_cast<DeclarationNode>(expression);
+            collectUses(declaration->getExpression(), uses);
+            uses.scopes.back().push_back(declaration->getName());
+        }
+        break;
+        case ExpressionType::Return:
+            OPTIMIZATION_ERROR_AT(expression, "Cannot return from a parallel loop");
+        case ExpressionType::Cast:
+            collectUses(dynamic_pointer_cast<CastNode>(expression)->getExpression(), uses);
+            break;
+        case ExpressionType::FunctionCall:
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<FunctionCallNode>(expression)->getArgs())
+            {
+                collectUses(arg, uses);
+            }
+            break;
+        case ExpressionType::QualifiedCall:
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<QualifiedCallNode>(expression)->getArgs())
+            {
+                collectUses(arg, uses);
+            }
+            break;
+        case ExpressionType::Alloc:
+            for (shared_ptr<Expression> arg : dynamic_pointer_cast<AllocNode>(expression)->getArgs())
+            {
+                collectUses(arg, uses);
+            }
+            break;
+        case ExpressionType::MethodCall:
+        {
+            shared_ptr<MethodCallNode> call = dynamic_pointer_cast<MethodCallNode>(expression);
+            collectUses(call->getObject(), uses);
+            for (shared_ptr<Expression> arg : call->getArgs())
+            {
+                collectUses(arg, uses);
+            }
+        }
+        break;
+        case ExpressionType::MemberAccess:
+            collectUses(dynamic_pointer_cast<MemberAccessNode>(expression)->getObject(), uses);
+            break;
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            collectUses(index->getArray(), uses);
+            collectUses(index->getIndex(), uses);
+        }
+        break;
+        case ExpressionType::IfBlock:
+        {
+            shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(expression);
+            for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+            {
+                collectUses(ifNode->getCondition(), uses);
+                collectUses(ifNode->getBlock(), uses);
+            }
+            collectUses(ifBlock->getElseBlock(), uses);
+        }
+        break;
+        case ExpressionType::While:
+        {
+            shared_ptr<WhileNode> whileNode = dynamic_pointer_cast<WhileNode>(expression);
+            collectUses(whileNode->getCondition(), uses);
+            collectUses(whileNode->getBlock(), uses);
+        }
+        break;
+        case ExpressionType::For:
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            collectUses(forNode->getStart(), uses);
+            collectUses(forNode->getEnd(), uses);
+            uses.scopes.push_back({forNode->getVariable()});
+            collectUses(forNode->getBlock(), uses);
+            uses.scopes.pop_back();
+        }
+        break;
+        case ExpressionType::Block:
+            uses.scopes.push_back({});
+            for (shared_ptr<Expression> current : dynamic_pointer_cast<BlockNode>(expression)->getExpressions())
+            {
+                collectUses(current, uses);
+            }
+            uses.scopes.pop_back();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void ParallelForPass::analyzeLoop(shared_ptr<ForNode> forNode, SymbolTable<string, string> &symbols)
+    {
+        LoopUses uses;
+        uses.scopes.push_back({forNode->getVariable()});
+        collectUses(forNode->getBlock(), uses);
+
+        // Variables of the body are private to each iteration and left out of the uses, only the
+        // ones from outside are shared. A name the body declares is still shared before its
+        // declaration and outside the block that declares it.
+        vector<string> reductions;
+        for (auto &assigned : uses.assignments)
+        {
+            const string &name = assigned.first;
+            if (!symbols.contains(name))
+            {
+                continue;
+            }
+
+            bool sums = uses.readCounts[name] == static_cast<int>(assigned.second.size());
+            for (shared_ptr<BinaryExpressionNode> assignment : assigned.second)
+            {
+                if (!sums || !isSum(assignment, name))
+                {
+                    OPTIMIZATION_ERROR_AT(assignment, "Parallel loop can only change " << name << " as a sum, like "
+                                          << name << " = " << name << " + ...");
+                }
+            }
+
+            string type = symbols.get(name);
+            if (!isIntegerType(type) && !isFloatType(type))
+            {
+                OPTIMIZATION_ERROR_AT(assigned.second[0], "Parallel loop can only sum integers and floats, " << name << " is " << type);
+            }
+            reductions.push_back(name);
+        }
+
+        for (auto &assigned : uses.fieldAssignments)
+        {
+            const string &name = assigned.first;
+            if (name != "this" && !symbols.get("struct:" + symbols.get(name)).empty())
+            {
+                OPTIMIZATION_ERROR_AT(assigned.second, "Parallel loop can't change fields of " << name << ", structs are copied into the loop");
+            }
+        }
+
+        vector<string> captures;
+        for (const string &name : uses.reads)
+        {
+            if ((name == "this" || symbols.contains(name)) && find(reductions.begin(), reductions.end(), name) == reductions.end())
+            {
+                captures.push_back(name);
+            }
+        }
+
+        LOG("ParallelForPass: Loop at line %d reads %zu variables and sums into %zu\n", forNode->line(), captures.size(), reductions.size());
+        forNode->setCaptures(captures);
+        forNode->setReductions(reductions);
+    }
+
+    void ParallelForPass::performPass(shared_ptr<BlockNode> block, SymbolTable<string, string> &symbols)
+    {
+        // Nested loops are checked when the pass reaches the block they are in
+        for (shared_ptr<Expression> expression : block->getExpressions())
+        {
+            shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(expression);
+            if (forNode != nullptr && forNode->isParallel())
+            {
+                analyzeLoop(forNode, symbols);
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "common.h"
+#include "analysispass.h"
+#include "ast/ast.h"
+
+namespace analysis
+{
+    // Checks the body of "parallel for" loops, which codegen outlines into a function that runs on
+    // several threads at once. The body reads the variables around the loop but can't assign them,
+    // except to sum into them: "total = total + e" or "total = total - e", where e doesn't read
+    // total, or chains of those. Each thread sums into its own copy that starts at 0 and is added to the variable when
+    // its part of the loop is done. Elements of arrays and fields of objects can be assigned, the
+    // iterations have to keep to their own ones, but not fields of structs, which are copied into the
+    // loop like other values. Records the variables the loop reads and sums into.
+    class ParallelForPass : public Pass
+    {
+    private:
+        struct LoopUses
+        {
+            std::vector<std::string> reads;  // In order of first use
+            std::map<std::string, int> readCounts;
+            std::vector<std::vector<std::string>> scopes;  // Names the body has declared so far, by enclosing block
+            std::map<std::string, std::vector<std::shared_ptr<ast::BinaryExpressionNode>>> assignments;  // Of variables from outside
+            std::vector<std::pair<std::string, std::shared_ptr<ast::BinaryExpressionNode>>> fieldAssignments;  // By the variable holding the object
+        };
+
+        static bool isLocal(const LoopUses &uses, const std::string &name);
+        void collectUses(std::shared_ptr<ast::Expression> expression, LoopUses &uses);
+        void analyzeLoop(std::shared_ptr<ast::ForNode> forNode, SymbolTable<std::string, std::string> &symbols);
+
+    public:
+        ParallelForPass() = default;
+        virtual ~ParallelForPass() = default;
+
+        virtual void performPass(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols) override;
+    };
+}
@@ -9,20 +9,131 @@ using namespace ast;
 
 namespace analysis
 {
-    // Helper function to split a comma-separated string of types
+    // Helper function to split a comma-separated string of types, "Pair<int,float>" is one type
     static vector<string> splitArgTypes(const string& argTypes)
     {
         vector<string> result;
         if (argTypes.empty()) return result;
 
-        stringstream ss(argTypes);
-        string item;
-        while (getline(ss, item, ','))
+        int depth = 0;
+        size_t start = 0;
+        for (size_t i = 0; i < argTypes.size(); ++i)
         {
-            result.push_back(item);
+            char ch = argTypes[i];
+            if (ch == '<' || ch == '[')
+            {
+                ++depth;
+            }
+            else if (ch == '>' || ch == ']')
+            {
+                --depth;
+            }
+            else if (ch == ',' && depth == 0)
+            {
+                result.push_back(argTypes.substr(start, i - start));
+                start = i + 1;
+            }
         }
+        result.push_back(argTypes.substr(start));
         return result;
     }
+
+    // "[int]" -> "int", or an empty string for anything that isn't an array type
+    static string arrayElementType(const string& type)
+    {
+        if (type.size() > 2 && type.front() == '[' && type.back() == ']')
+        {
+            return type.substr(1, type.size() - 2);
+        }
+        return "";
+    }
+
+    // "f64x4" -> "float" with 4 lanes, "i32x8" -> "int" with 8, "f32x4" -> "f32" with 4, or an empty string for anything that isn't a vector type
+    static string vectorLaneType(const string& type, unsigned &lanes)
+    {
+        if (type.size() < 5 || type[3] != 'x')
+        {
+            return "";
+        }
+        string lane = type.substr(0, 3);
+        string count = type.substr(4);
+        if ((lane != "i32" && lane != "f32" && lane != "f64") || (count != "2" && count != "4" && count != "8" && count != "16"))
+        {
+            return "";
+        }
+        lanes = static_cast<unsigned>(stoul(count));
+        return lane == "i32" ? "int" : lane == "f32" ? "f32" : "float";
+    }
+
+    static bool isVectorType(const string& type)
+    {
+        unsigned lanes;
+        return !vectorLaneType(type, lanes).empty();
+    }
+
+    // Literals without a suffix, and arithmetic on nothing else, which can still take any integer or float type
+    static bool isUntypedConstant(shared_ptr<Expression> expression, bool integer)
+    {
+        shared_ptr<IntegerLiteralNode> intLiteral = dynamic_pointer_cast<IntegerLiteralNode>(expression);
+        if (intLiteral != nullptr)
+        {
+            return integer && !intLiteral->hasExplicitType();
+        }
+
+        shared_ptr<FloatLiteralNode> floatLiteral = dynamic_pointer_cast<FloatLiteralNode>(expression);
+        if (floatLiteral != nullptr)
+        {
+            return !integer && !floatLiteral->hasExplicitType();
+        }
+
+        shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+        string op = binary == nullptr ? "" : binary->getOperator();
+        return (op == "+" || op == "-" || op == "*" || op == "/" || op == "%")
+            && isUntypedConstant(binary->getLhs(), integer) && isUntypedConstant(binary->getRhs(), integer);
+    }
+
+    static void setConstantType(shared_ptr<Expression> expression, const string &type)
+    {
+        if (expression->getExpressionType() == ExpressionType::IntegerLiteral)
+        {
+            shared_ptr<IntegerLiteralNode> literal = dynamic_pointer_cast<IntegerLiteralNode>(expression);
+            if (!integerFits(literal->getValue(), type))
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Integer literal " + to_string(literal->getValue()) + " doesn't fit in " + type);
+            }
+            literal->setType(type);
+        }
+        else if (expression->getExpressionType() == ExpressionType::FloatLiteral)
+        {
+            dynamic_pointer_cast<FloatLiteralNode>(expression)->setType(type);
+        }
+        else
+        {
+            shared_ptr<BinaryExpressionNode> binary = dynamic_pointer_cast<BinaryExpressionNode>(expression);
+            setConstantType(binary->getLhs(), type);
+            setConstantType(binary->getRhs(), type);
+            binary->setOperandType(type);
+        }
+    }
+
+    // Gives an unsuffixed constant the numeric type its context expects: "let x: i64 = 0", "f * 2.0"
+    // with f an f32. Integers stay integers and floats floats. True when the expression now has the type.
+    static bool adaptConstant(shared_ptr<Expression> expression, const string &type)
+    {
+        if ((isIntegerType(type) && isUntypedConstant(expression, true)) || (isFloatType(type) && isUntypedConstant(expression, false)))
+        {
+            setConstantType(expression, type);
+            return true;
+        }
+        return false;
+    }
+
+    TypeInferencePass::TypeInferencePass(shared_ptr<MonomorphizationPass> monomorphization) :
+        mMonomorphization(monomorphization)
+    {
+
+    }
+
     string TypeInferencePass::getTypeForExpression(shared_ptr<Expression> expression, SymbolTable<string, string> &symbols)
     {
         switch (expression->getExpressionType())
@@ -34,6 +145,7 @@ namespace analysis
         }
         break;
         case ExpressionType::While:
+        case ExpressionType::For:
         {
             OPTIMIZATION_ERROR_AT(expression, "Cannot assign result of loop to variable");
         }
@@ -45,12 +157,12 @@ namespace analysis
         break;
         case ExpressionType::IntegerLiteral:
         {
-            return "int";
+            return dynamic_pointer_cast<IntegerLiteralNode>(expression)->getType();
         }
         break;
         case ExpressionType::FloatLiteral:
         {
-            return "float";
+            return dynamic_pointer_cast<FloatLiteralNode>(expression)->getType();
         }
         break;
         case ExpressionType::StringLiteral:
@@ -69,14 +181,70 @@ namespace analysis
             shared_ptr<BinaryExpressionNode> expr = dynamic_pointer_cast<BinaryExpressionNode>(expression);
             string lhsType = getTypeForExpression(expr->getLhs(), symbols);
             string rhsType = getTypeForExpression(expr->getRhs(), symbols);
+            string op = expr->getOperator();
+
+            // Conditions combine comparisons of any types
+            if (op == "&&" || op == "||")
+            {
+                if (isVectorType(lhsType) || isVectorType(rhsType))
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Operator " + op + " is not defined for vectors, use select, any or all on a mask");
+                }
+                return "int";
+            }
+
+            // Vectors work lane by lane, with a scalar of their lane type standing for every lane.
+            // Comparisons give an i32 mask with the same number of lanes.
+            unsigned lanes;
+            string vectorType = isVectorType(lhsType) ? lhsType : rhsType;
+            string laneType = vectorLaneType(vectorType, lanes);
+            if (!laneType.empty() && op != "=")
+            {
+                bool vectorOnLeft = vectorType == lhsType;
+                string otherType = vectorOnLeft ? rhsType : lhsType;
+                if (otherType != vectorType && adaptConstant(vectorOnLeft ? expr->getRhs() : expr->getLhs(), laneType))
+                {
+                    otherType = laneType;
+                }
+                if (otherType != vectorType && otherType != laneType)
+                {
+                    stringstream error;
+                    error << "Types " << lhsType << " and " << rhsType << " do not match";
+                    OPTIMIZATION_ERROR_AT(expression, error.str());
+                }
+                if (op == "<" || op == ">" || op == "<=" || op == ">=" || op == "==" || op == "!=")
+                {
+                    return "i32x" + to_string(lanes);
+                }
+                return vectorType;
+            }
 
+            if (lhsType != rhsType && adaptConstant(expr->getRhs(), lhsType))
+            {
+                rhsType = lhsType;
+            }
+            else if (lhsType != rhsType && adaptConstant(expr->getLhs(), rhsType))
+            {
+                lhsType = rhsType;
+            }
             if (lhsType != rhsType)
             {
                 stringstream error;
                 error << "Types " << lhsType << " and " << rhsType << " do not match";
                 OPTIMIZATION_ERROR_AT(expression, error.str());
             }
+            expr->setOperandType(lhsType);
+
+            // Structs can only be copied, compare or combine their fields instead
+            if (!symbols.get("struct:" + lhsType).empty() && expr->getOperator() != "=")
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Operator " + expr->getOperator() + " is not defined for struct " + lhsType);
+            }
 
+            if (op == "<" || op == ">" || op == "<=" || op == ">=" || op == "==" || op == "!=")
+            {
+                return "int";
+            }
             return lhsType;
         }
         break;
@@ -110,17 +278,91 @@ namespace analysis
         case ExpressionType::FunctionCall:
         {
             shared_ptr<FunctionCallNode> call = dynamic_pointer_cast<FunctionCallNode>(expression);
+
+            // A call to a generic is redirected to the instantiation for its argument types
+            if (mMonomorphization->isTemplate(call->getName()))
+            {
+                vector<string> argTypes;
+                vector<shared_ptr<Expression>> actualArgs = call->getArgs();
+                for (size_t i = 0; i < actualArgs.size(); ++i)
+                {
+                    argTypes.push_back(getTypeForExpression(actualArgs[i], symbols));
+                }
+                call->setName(mMonomorphization->instantiateCall(call, argTypes, symbols));
+            }
+
             string funcName = call->getName() + "()";
 
             if (!symbols.contains(funcName))
             {
+                string vectorType = getTypeForVectorBuiltin(call, symbols);
+                if (!vectorType.empty())
+                {
+                    return vectorType;
+                }
                 OPTIMIZATION_ERROR_AT(expression, "Unknown function: " + call->getName());
             }
 
             string type = symbols.get(funcName);
 
-            // Validate argument count and types (only if arg types are registered)
+            // Built-in len takes any array, unless a user function replaced it
             string argsKey = "funcargs:" + call->getName();
+            if (call->getName() == "len" && !symbols.contains(argsKey))
+            {
+                vector<shared_ptr<Expression>> actualArgs = call->getArgs();
+                if (actualArgs.size() != 1)
+                {
+                    stringstream error;
+                    error << "Function len expects 1 argument(s) but got " << actualArgs.size();
+                    OPTIMIZATION_ERROR_AT(expression, error.str());
+                }
+
+                string actualType = getTypeForExpression(actualArgs[0], symbols);
+                if (arrayElementType(actualType).empty())
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Function len expects an array but got " + actualType);
+                }
+            }
+
+            // Built-in hash takes the key types of a HashMap
+            if (call->getName() == "hash" && !symbols.contains(argsKey))
+            {
+                vector<shared_ptr<Expression>> actualArgs = call->getArgs();
+                if (actualArgs.size() != 1)
+                {
+                    stringstream error;
+                    error << "Function hash expects 1 argument(s) but got " << actualArgs.size();
+                    OPTIMIZATION_ERROR_AT(expression, error.str());
+                }
+
+                string actualType = getTypeForExpression(actualArgs[0], symbols);
+                if (!isIntegerType(actualType) && actualType != "string")
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Function hash expects an integer or a string but got " + actualType);
+                }
+            }
+
+            // Built-in join waits for a task and gives its function's result
+            if (call->getName() == "join" && !symbols.contains(argsKey))
+            {
+                vector<shared_ptr<Expression>> actualArgs = call->getArgs();
+                if (actualArgs.size() != 1)
+                {
+                    stringstream error;
+                    error << "Function join expects 1 argument(s) but got " << actualArgs.size();
+                    OPTIMIZATION_ERROR_AT(expression, error.str());
+                }
+
+                string actualType = getTypeForExpression(actualArgs[0], symbols);
+                type = taskResultType(actualType);
+                if (type.empty())
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Function join expects a task but got " + actualType);
+                }
+                call->setTaskType(actualType);
+            }
+
+            // Validate argument count and types (only if arg types are registered)
             if (symbols.contains(argsKey))
             {
                 string expectedArgsStr = symbols.get(argsKey);
@@ -139,7 +381,7 @@ namespace analysis
                 for (size_t i = 0; i < actualArgs.size() && i < expectedArgs.size(); ++i)
                 {
                     string actualType = getTypeForExpression(actualArgs[i], symbols);
-                    if (actualType != expectedArgs[i])
+                    if (actualType != expectedArgs[i] && !adaptConstant(actualArgs[i], expectedArgs[i]))
                     {
                         stringstream error;
                         error << "Argument " << (i + 1) << " of function " << call->getName()
@@ -149,6 +391,17 @@ namespace analysis
                 }
             }
 
+            // The builtins and struct constructors are generated inline, there is no function to run
+            if (call->isSpawned())
+            {
+                if (!symbols.contains(argsKey) || !symbols.get("struct:" + call->getName()).empty())
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Cannot spawn " + call->getName() + ", only functions can be spawned");
+                }
+                type = "task<" + (type.empty() ? string("void") : type) + ">";
+                call->setTaskType(type);
+            }
+
             return type;
         }
         break;
@@ -159,13 +412,59 @@ namespace analysis
         break;
         case ExpressionType::Cast:
         {
+            // Conversions between any two numeric types
             shared_ptr<CastNode> cast = dynamic_pointer_cast<CastNode>(expression);
-            return cast->getCastType();
+            string sourceType = getTypeForExpression(cast->getExpression(), symbols);
+            string castType = cast->getCastType();
+            if ((!isIntegerType(sourceType) && !isFloatType(sourceType)) || (!isIntegerType(castType) && !isFloatType(castType)))
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Cannot cast " + sourceType + " to " + castType);
+            }
+            cast->setSourceType(sourceType);
+            return castType;
         }
         break;
         case ExpressionType::Alloc:
         {
             shared_ptr<AllocNode> alloc = dynamic_pointer_cast<AllocNode>(expression);
+            if (!symbols.get("struct:" + alloc->getTypeName()).empty())
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Struct " + alloc->getTypeName() + " is a value type, create it with "
+                    + alloc->getTypeName() + "(...) instead of alloc");
+            }
+
+            // "alloc [T](n)" takes the length, the elements start out zeroed
+            if (!arrayElementType(alloc->getTypeName()).empty())
+            {
+                vector<shared_ptr<Expression>> args = alloc->getArgs();
+                if (args.size() != 1 || getTypeForExpression(args[0], symbols) != "int")
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Array allocation expects a length of type int");
+                }
+            }
+            else
+            {
+                // The field values in declaration order, or none to start every field at zero
+                vector<shared_ptr<Expression>> args = alloc->getArgs();
+                vector<string> fieldTypes = splitArgTypes(symbols.get("allocargs:" + alloc->getTypeName()));
+                if (symbols.contains("allocargs:" + alloc->getTypeName()) && !args.empty() && args.size() != fieldTypes.size())
+                {
+                    stringstream error;
+                    error << "Class " << alloc->getTypeName() << " expects " << fieldTypes.size() << " field value(s) but got " << args.size();
+                    OPTIMIZATION_ERROR_AT(expression, error.str());
+                }
+                for (size_t i = 0; i < args.size(); ++i)
+                {
+                    string argType = getTypeForExpression(args[i], symbols);
+                    if (i < fieldTypes.size() && argType != fieldTypes[i] && !adaptConstant(args[i], fieldTypes[i]))
+                    {
+                        stringstream error;
+                        error << "Field value " << (i + 1) << " of " << alloc->getTypeName() << " expects type " << fieldTypes[i]
+                              << " but got " << argType;
+                        OPTIMIZATION_ERROR_AT(expression, error.str());
+                    }
+                }
+            }
             return alloc->getTypeName();
         }
         break;
@@ -277,7 +576,7 @@ namespace analysis
                         for (size_t i = 0; i < actualArgs.size() && i < expectedArgs.size(); ++i)
                         {
                             string actualType = getTypeForExpression(actualArgs[i], symbols);
-                            if (actualType != expectedArgs[i])
+                            if (actualType != expectedArgs[i] && !adaptConstant(actualArgs[i], expectedArgs[i]))
                             {
                                 stringstream error;
                                 error << "Argument " << (i + 1) << " of function " << objIdent->getValue() << "." << call->getMethodName()
@@ -335,7 +634,7 @@ namespace analysis
                 for (size_t i = 0; i < actualArgs.size() && i < expectedArgs.size(); ++i)
                 {
                     string actualType = getTypeForExpression(actualArgs[i], symbols);
-                    if (actualType != expectedArgs[i])
+                    if (actualType != expectedArgs[i] && !adaptConstant(actualArgs[i], expectedArgs[i]))
                     {
                         stringstream error;
                         error << "Argument " << (i + 1) << " of method " << call->getMethodName()
@@ -348,6 +647,45 @@ namespace analysis
             return type;
         }
         break;
+        case ExpressionType::Index:
+        {
+            shared_ptr<IndexNode> index = dynamic_pointer_cast<IndexNode>(expression);
+            string arrayType = getTypeForExpression(index->getArray(), symbols);
+
+            // "v[i]" is a lane of a vector
+            unsigned lanes;
+            string laneType = vectorLaneType(arrayType, lanes);
+            if (!laneType.empty())
+            {
+                string indexType = getTypeForExpression(index->getIndex(), symbols);
+                if (indexType != "int")
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Lane index must be an int but got " + indexType);
+                }
+
+                shared_ptr<IntegerLiteralNode> literal = dynamic_pointer_cast<IntegerLiteralNode>(index->getIndex());
+                if (literal != nullptr && (literal->getValue() < 0 || literal->getValue() >= static_cast<int>(lanes)))
+                {
+                    OPTIMIZATION_ERROR_AT(expression, "Lane " + to_string(literal->getValue()) + " is out of range for " + arrayType);
+                }
+                return laneType;
+            }
+
+            string elementType = arrayElementType(arrayType);
+            if (elementType.empty())
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Cannot index a value of type " + arrayType);
+            }
+
+            string indexType = getTypeForExpression(index->getIndex(), symbols);
+            if (indexType != "int")
+            {
+                OPTIMIZATION_ERROR_AT(expression, "Array index must be an int but got " + indexType);
+            }
+
+            return elementType;
+        }
+        break;
         default:
         {
             OPTIMIZATION_ERROR_AT(expression, "Unknown type in getTypeForExpression");
@@ -356,6 +694,121 @@ namespace analysis
         }
     }
 
+    void TypeInferencePass::checkCondition(shared_ptr<Expression> condition, SymbolTable<string, string> &symbols)
+    {
+        // else has no condition
+        if (condition == nullptr)
+        {
+            return;
+        }
+
+        string type = getTypeForExpression(condition, symbols);
+        if (isVectorType(type))
+        {
+            OPTIMIZATION_ERROR_AT(condition, "Condition can't be the vector " + type + ", reduce it with any or all");
+        }
+    }
+
+    string TypeInferencePass::getTypeForVectorBuiltin(shared_ptr<FunctionCallNode> call, SymbolTable<string, string> &symbols)
+    {
+        // Built-in vector functions, unless the program defines its own. Empty for any other call.
+        string name = call->getName();
+        vector<shared_ptr<Expression>> args = call->getArgs();
+        vector<string> argTypes;
+        unsigned lanes;
+
+        if (isVectorType(name))
+        {
+            // "f64x4(x)" fills every lane with x, "f64x4(a, b, c, d)" sets each lane
+            string laneType = vectorLaneType(name, lanes);
+            if (args.size() != 1 && args.size() != lanes)
+            {
+                stringstream error;
+                error << "Vector " << name << " expects 1 or " << lanes << " lane value(s) but got " << args.size();
+                OPTIMIZATION_ERROR_AT(call, error.str());
+            }
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                string argType = getTypeForExpression(args[i], symbols);
+                if (argType != laneType && !adaptConstant(args[i], laneType))
+                {
+                    stringstream error;
+                    error << "Lane value " << (i + 1) << " of " << name << " expects type " << laneType << " but got " << argType;
+                    OPTIMIZATION_ERROR_AT(call, error.str());
+                }
+            }
+            return name;
+        }
+
+        if (name != "shuffle" && name != "select" && name != "reduce_add" && name != "reduce_min" && name != "reduce_max"
+            && name != "any" && name != "all")
+        {
+            return "";
+        }
+
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            argTypes.push_back(getTypeForExpression(args[i], symbols));
+        }
+        string laneType = args.empty() ? "" : vectorLaneType(argTypes[0], lanes);
+        if (laneType.empty())
+        {
+            OPTIMIZATION_ERROR_AT(call, "Function " + name + " expects a vector but got " + (args.empty() ? "no arguments" : argTypes[0]));
+        }
+
+        if (name == "shuffle")
+        {
+            // shuffle(v, lanes...) or shuffle(a, b, lanes...), where the lanes of b come after those of a
+            size_t firstIndex = args.size() > 1 && argTypes[1] == argTypes[0] ? 2 : 1;
+            unsigned sources = static_cast<unsigned>(firstIndex) * lanes;
+            string resultType = argTypes[0].substr(0, 4) + to_string(args.size() - firstIndex);
+            if (!isVectorType(resultType))
+            {
+                OPTIMIZATION_ERROR_AT(call, "Shuffle must pick 2, 4, 8 or 16 lanes");
+            }
+            for (size_t i = firstIndex; i < args.size(); ++i)
+            {
+                shared_ptr<IntegerLiteralNode> literal = dynamic_pointer_cast<IntegerLiteralNode>(args[i]);
+                if (literal == nullptr)
+                {
+                    OPTIMIZATION_ERROR_AT(call, "Shuffle lanes must be integer literals");
+                }
+                if (literal->getValue() < 0 || literal->getValue() >= static_cast<int>(sources))
+                {
+                    OPTIMIZATION_ERROR_AT(call, "Lane " + to_string(literal->getValue()) + " is out of range for shuffle of " + argTypes[0]);
+                }
+            }
+            return resultType;
+        }
+        else if (name == "select")
+        {
+            // select(mask, a, b) takes the lanes of a where the mask is set and those of b elsewhere
+            string maskType = "i32x" + to_string(lanes);
+            if (args.size() != 3 || argTypes[0] != maskType || argTypes[1] != argTypes[2] || !isVectorType(argTypes[1])
+                || argTypes[1].substr(3) != argTypes[0].substr(3))
+            {
+                OPTIMIZATION_ERROR_AT(call, "Function select expects a mask and two vectors with as many lanes");
+            }
+            return argTypes[1];
+        }
+
+        if (args.size() != 1)
+        {
+            stringstream error;
+            error << "Function " << name << " expects 1 argument(s) but got " << args.size();
+            OPTIMIZATION_ERROR_AT(call, error.str());
+        }
+        if (name == "any" || name == "all")
+        {
+            if (laneType != "int")
+            {
+                OPTIMIZATION_ERROR_AT(call, "Function " + name + " expects an i32 mask but got " + argTypes[0]);
+            }
+            return "int";
+        }
+        return laneType;
+    }
+
     void TypeInferencePass::performPass(shared_ptr<BlockNode> block, SymbolTable<string, string> &symbols)
     {
         if (block == nullptr)
@@ -404,7 +857,7 @@ namespace analysis
                     if (initExpr != nullptr)
                     {
                         string initType = getTypeForExpression(initExpr, symbols);
-                        if (initType != decl->getTypeName())
+                        if (initType != decl->getTypeName() && !adaptConstant(initExpr, decl->getTypeName()))
                         {
                             stringstream error;
                             error << "Types " << decl->getTypeName() << " and " << initType << " do not match";
@@ -433,7 +886,7 @@ namespace analysis
                     }
 
                     string lhsType = getTypeForExpression(expr->getLhs(), symbols);
-                    if (lhsType != rhsType)
+                    if (lhsType != rhsType && !adaptConstant(expr->getRhs(), lhsType))
                     {
                         stringstream error;
                         error << "Cannot assign type " << rhsType << " to variable of type " << lhsType;
@@ -453,7 +906,7 @@ namespace analysis
                     string actualType = getTypeForExpression(ret->getExpression(), symbols);
 
                     // Check return type matches (empty expectedReturnType means void)
-                    if (!expectedReturnType.empty() && actualType != expectedReturnType)
+                    if (!expectedReturnType.empty() && actualType != expectedReturnType && !adaptConstant(ret->getExpression(), expectedReturnType))
                     {
                         stringstream error;
                         error << "Return type mismatch: expected " << expectedReturnType << " but got " << actualType;
@@ -479,6 +932,47 @@ namespace analysis
                 getTypeForExpression(current, symbols);
             }
             break;
+            case ExpressionType::IfBlock:
+            {
+                // Conditions can call generics too, which have to be instantiated before codegen
+                shared_ptr<IfBlockNode> ifBlock = dynamic_pointer_cast<IfBlockNode>(current);
+                for (shared_ptr<IfNode> ifNode : ifBlock->getIfs())
+                {
+                    checkCondition(ifNode->getCondition(), symbols);
+                }
+            }
+            break;
+            case ExpressionType::While:
+            {
+                checkCondition(dynamic_pointer_cast<WhileNode>(current)->getCondition(), symbols);
+            }
+            break;
+            case ExpressionType::For:
+            {
+                // The loop variable is an int for ranges and the element type for arrays
+                shared_ptr<ForNode> forNode = dynamic_pointer_cast<ForNode>(current);
+                string startType = getTypeForExpression(forNode->getStart(), symbols);
+                if (forNode->isRange())
+                {
+                    string endType = getTypeForExpression(forNode->getEnd(), symbols);
+                    if (startType != "int" || endType != "int")
+                    {
+                        OPTIMIZATION_ERROR_AT(current, "Range bounds must be int but got " + startType + " and " + endType);
+                    }
+                    forNode->setVariableType("int");
+                }
+                else
+                {
+                    string elementType = arrayElementType(startType);
+                    if (elementType.empty())
+                    {
+                        OPTIMIZATION_ERROR_AT(current, "Cannot iterate over a value of type " + startType);
+                    }
+                    forNode->setVariableType(elementType);
+                }
+                LOG("Type inference: %s -> %s\n", forNode->getVariable().c_str(), forNode->getVariableType().c_str());
+            }
+            break;
             default:
                 continue;
             }
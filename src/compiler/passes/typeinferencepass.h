@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "analysispass.h"
+#include "monomorphizationpass.h"
 #include "ast/ast.h"
 
 namespace analysis
@@ -14,10 +15,14 @@ namespace analysis
     class TypeInferencePass : public Pass
     {
     private:
+        std::shared_ptr<MonomorphizationPass> mMonomorphization;
+
         std::string getTypeForExpression(std::shared_ptr<ast::Expression> expression, SymbolTable<std::string, std::string> &symbols);
+        std::string getTypeForVectorBuiltin(std::shared_ptr<ast::FunctionCallNode> call, SymbolTable<std::string, std::string> &symbols);
+        void checkCondition(std::shared_ptr<ast::Expression> condition, SymbolTable<std::string, std::string> &symbols);
 
     public:
-        TypeInferencePass() = default;
+        TypeInferencePass(std::shared_ptr<MonomorphizationPass> monomorphization);
         virtual ~TypeInferencePass() = default;
 
         virtual void performPass(std::shared_ptr<ast::BlockNode> block, SymbolTable<std::string, std::string> &symbols) override;
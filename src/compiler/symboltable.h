@@ -23,6 +23,19 @@ public:
         mCurrent.insert({name, inst});
     }
 
+    // Defines the name in the outermost context, so it outlives the scope that defined it
+    void putGlobal(key name, value inst)
+    {
+        if (mStack.empty())
+        {
+            mCurrent.insert({name, inst});
+        }
+        else
+        {
+            mStack.front().insert({name, inst});
+        }
+    }
+
     bool tryGet(key name, value &out)
     {
         bool found = false;
@@ -5,65 +5,387 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <algorithm>
 #include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utf8.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
 #define SILVER_EXPORT __declspec(dllexport)
 #else
+#include <unistd.h>
 #define SILVER_EXPORT __attribute__((visibility("default")))
 #endif
 
+// Type descriptor emitted by the compiler for every class and array type ("<ClassName>.typeinfo",
+// "[T].typeinfo"), and defined here for tasks
+struct SilverTypeInfo {
+    const char* name;
+    // Releases the references an object, array or task owns before it is freed: the strings, objects
+    // and arrays in its fields or elements, or a task's result. Null when there are none.
+    void (*destroy)(void* object);
+};
+
 // Object header for reference counting
-// Placed immediately before the object data in memory
+// The compiler emits it as the first members of every class struct and object pointers point at it.
+// The ref count comes last so the compiler can pack a 4 byte field into the padding after it.
 struct SilverObjectHeader {
-    // TODO: should be using different increment/release memory orders but it's only in C++ 23 and later
-    // Could use memory_order_relaxed for increment and memory_order_acquire for release
+    const SilverTypeInfo* type;
+    // Objects can be shared between tasks. Retains only need the count to be atomic, a release
+    // publishes the thread's writes to the object and the thread that frees it acquires them first.
     std::atomic_int refCount;
 };
 
+// String representation
+// A Silver string points at null terminated UTF-8 bytes, so it can be handed to C as a char*,
+// and is preceded by this header. The compiler emits literals as constants with the header
+// filled in and an immortal ref count; strings built at runtime come from silver_string_new.
+// Must match the layout emitted by CodeGen::generateStringLiteral.
+#define SILVER_STRING_IMMORTAL -1
+
+struct SilverStringHeader {
+    std::atomic_int refCount;
+    int32_t byteLength;
+    int32_t codepoints;
+    uint32_t hash;
+};
+
+static SilverStringHeader* stringHeader(const char* s) {
+    return ((SilverStringHeader*)s) - 1;
+}
+
+// FNV-1a, the compiler computes the same hash for literals
+static uint32_t hashBytes(const char* s, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Buffered standard output
+// The print functions append to this buffer, which is written out when full, on flush() and at
+// exit. Setting SILVER_UNBUFFERED=1 in the environment, or running with stdout on a terminal,
+// writes every print immediately instead so interactive programs see their output.
+static const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+struct SilverOutput {
+    std::mutex lock;
+    char data[OUTPUT_BUFFER_SIZE];
+    size_t used = 0;
+    bool unbuffered = false;
+};
+
+extern "C" void silver_flush();
+
+static SilverOutput& output() {
+    static SilverOutput* out = []() {
+        SilverOutput* created = new SilverOutput();
+        const char* env = getenv("SILVER_UNBUFFERED");
+        created->unbuffered = (env != nullptr && env[0] != '\0' && strcmp(env, "0") != 0) || isatty(fileno(stdout));
+        atexit(silver_flush);
+        return created;
+    }();
+    return *out;
+}
+
+// Caller holds out.lock
+static void flushOutputLocked(SilverOutput& out) {
+    if (out.used > 0) {
+        fwrite(out.data, 1, out.used, stdout);
+        out.used = 0;
+    }
+    fflush(stdout);
+}
+
+// Appends text followed by a newline, caller holds out.lock
+static void writeLineLocked(SilverOutput& out, const char* text, size_t length) {
+    if (out.used + length + 1 > OUTPUT_BUFFER_SIZE) {
+        flushOutputLocked(out);
+        if (length + 1 > OUTPUT_BUFFER_SIZE) {
+            fwrite(text, 1, length, stdout);
+            fputc('\n', stdout);
+            length = 0;
+            text = nullptr;
+        }
+    }
+    if (text) {
+        memcpy(out.data + out.used, text, length);
+        out.data[out.used + length] = '\n';
+        out.used += length + 1;
+    }
+    if (out.unbuffered) {
+        flushOutputLocked(out);
+    }
+}
+
+static void writeLine(const char* text, size_t length) {
+    SilverOutput& out = output();
+    std::lock_guard<std::mutex> guard(out.lock);
+    writeLineLocked(out, text, length);
+}
+
+// Formats n in decimal into the end of buffer, two digits at a time, and returns where it starts
+static char* formatInt(int n, char* end) {
+    static const char digitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    uint32_t value = n < 0 ? 0u - (uint32_t)n : (uint32_t)n;
+    char* p = end;
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digitPairs[value * 2 + 1];
+        *--p = digitPairs[value * 2];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    if (n < 0) {
+        *--p = '-';
+    }
+    return p;
+}
+
+// Formats f as the shortest decimal that parses back to the same double and returns its length.
+// Whole numbers get a ".0" so they still read as floats; buffer must hold at least 32 characters.
+static int formatFloat(double f, char* buffer) {
+    char* end = std::to_chars(buffer, buffer + 32, f).ptr;
+    bool needsFraction = true;
+    for (char* p = buffer; p < end; ++p) {
+        if (*p == '.' || *p == 'e' || *p == 'n' || *p == 'i') {
+            needsFraction = false;
+            break;
+        }
+    }
+    if (needsFraction) {
+        *end++ = '.';
+        *end++ = '0';
+    }
+    return (int)(end - buffer);
+}
+
+// Allocation statistics
+// Off by default. Enabled by setting SILVER_ALLOC_STATS=1 in the environment, or for every
+// program by building the runtime with SILVER_ALLOC_STATS defined. The summary is printed
+// to stderr when the program exits.
+struct SilverClassStats {
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t bytes = 0;
+    uint64_t retains = 0;
+    uint64_t releases = 0;
+    int64_t live = 0;
+    int64_t peakLive = 0;
+};
+
+static std::mutex gStatsMutex;
+static std::map<const SilverTypeInfo*, SilverClassStats> gClassStats;
+static int64_t gLiveObjects = 0;
+static int64_t gPeakLiveObjects = 0;
+
+extern "C" void silver_print_alloc_stats();
+
+static bool initAllocStats() {
+#ifdef SILVER_ALLOC_STATS
+    bool enabled = true;
+#else
+    const char* env = getenv("SILVER_ALLOC_STATS");
+    bool enabled = env != nullptr && env[0] != '\0' && strcmp(env, "0") != 0;
+#endif
+    if (enabled) {
+        atexit(silver_print_alloc_stats);
+    }
+    return enabled;
+}
+
+static bool allocStatsEnabled() {
+    static const bool enabled = initAllocStats();
+    return enabled;
+}
+
+static const char* typeName(const SilverTypeInfo* type) {
+    return type && type->name ? type->name : "<unknown>";
+}
+
+static void recordAlloc(const SilverTypeInfo* type, size_t size) {
+    std::lock_guard<std::mutex> lock(gStatsMutex);
+    SilverClassStats& stats = gClassStats[type];
+    stats.allocs++;
+    stats.bytes += size;
+    if (++stats.live > stats.peakLive) {
+        stats.peakLive = stats.live;
+    }
+    if (++gLiveObjects > gPeakLiveObjects) {
+        gPeakLiveObjects = gLiveObjects;
+    }
+}
+
+static void recordRetain(const SilverTypeInfo* type) {
+    std::lock_guard<std::mutex> lock(gStatsMutex);
+    gClassStats[type].retains++;
+}
+
+static void recordRelease(const SilverTypeInfo* type, bool freed) {
+    std::lock_guard<std::mutex> lock(gStatsMutex);
+    SilverClassStats& stats = gClassStats[type];
+    stats.releases++;
+    if (freed) {
+        stats.frees++;
+        stats.live--;
+        gLiveObjects--;
+    }
+}
+
 extern "C" {
 
 // Print a string with newline
 SILVER_EXPORT void silver_print_string(const char* s) {
-    printf("%s\n", s);
+    if (!s) {
+        writeLine("", 0);
+        return;
+    }
+    writeLine(s, stringHeader(s)->byteLength);
 }
 
 // Print an integer with newline
 SILVER_EXPORT void silver_print_int(int n) {
-    printf("%d\n", n);
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* start = formatInt(n, end);
+    writeLine(start, end - start);
 }
 
 // Print a float with newline
 SILVER_EXPORT void silver_print_float(double f) {
-    printf("%f\n", f);
+    char text[40];
+    int length = formatFloat(f, text);
+    writeLine(text, length);
+}
+
+// Write any buffered output to stdout
+SILVER_EXPORT void silver_flush() {
+    SilverOutput& out = output();
+    std::lock_guard<std::mutex> guard(out.lock);
+    flushOutputLocked(out);
 }
 
 // Compare two strings for equality
-// Returns 1 if equal, 0 if not
+// Returns 1 if equal, 0 if not. Strings of different length or hash are rejected without
+// looking at their bytes.
 SILVER_EXPORT int silver_strcmp(const char* a, const char* b) {
-    return strcmp(a, b) == 0 ? 1 : 0;
+    if (a == b) return 1;
+    if (!a || !b) return 0;
+    SilverStringHeader* ha = stringHeader(a);
+    SilverStringHeader* hb = stringHeader(b);
+    if (ha->byteLength != hb->byteLength || ha->hash != hb->hash) return 0;
+    return memcmp(a, b, ha->byteLength) == 0 ? 1 : 0;
+}
+
+// The compiler marks allocations as never returning null, so failing one ends the program
+[[noreturn]] static void outOfMemory() {
+    fputs("out of memory\n", stderr);
+    abort();
 }
 
-// Allocate memory with ref count header (initial ref count = 1)
-SILVER_EXPORT void* silver_alloc(size_t size) {
-    SilverObjectHeader* header = (SilverObjectHeader*)malloc(sizeof(SilverObjectHeader) + size);
-    if (!header) return nullptr;
+// Create a string from length bytes (initial ref count = 1)
+SILVER_EXPORT char* silver_string_new(const char* bytes, int length) {
+    SilverStringHeader* header = (SilverStringHeader*)malloc(sizeof(SilverStringHeader) + length + 1);
+    if (!header) outOfMemory();
+    char* s = (char*)(header + 1);
+    memcpy(s, bytes, length);
+    s[length] = '\0';
     header->refCount = 1;
-    return header + 1;  // Return pointer to data after header
+    header->byteLength = length;
+    header->codepoints = (int32_t)utf8::count(s, length);
+    header->hash = hashBytes(s, length);
+    return s;
+}
+
+// Format a float the way print_float does (initial ref count = 1)
+SILVER_EXPORT char* silver_float_to_string(double f) {
+    char text[40];
+    int length = formatFloat(f, text);
+    return silver_string_new(text, length);
+}
+
+// Increment a string's reference count, literals are immortal
+SILVER_EXPORT void silver_string_retain(const char* s) {
+    if (!s) return;
+    SilverStringHeader* header = stringHeader(s);
+    if (header->refCount.load(std::memory_order_relaxed) != SILVER_STRING_IMMORTAL) {
+        header->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Decrement a string's reference count and free it if zero, literals are immortal
+SILVER_EXPORT void silver_string_release(const char* s) {
+    if (!s) return;
+    SilverStringHeader* header = stringHeader(s);
+    if (header->refCount.load(std::memory_order_relaxed) != SILVER_STRING_IMMORTAL
+        && header->refCount.fetch_sub(1, std::memory_order_release) == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        free(header);
+    }
+}
+
+// Allocate an object, size includes the header (initial ref count = 1)
+SILVER_EXPORT void* silver_alloc(size_t size, const SilverTypeInfo* type) {
+    SilverObjectHeader* header = (SilverObjectHeader*)malloc(size);
+    if (!header) outOfMemory();
+    header->type = type;
+    header->refCount = 1;
+    if (allocStatsEnabled()) {
+        recordAlloc(type, size);
+    }
+    return header;
 }
 
 // Increment reference count
 SILVER_EXPORT void silver_retain(void* ptr) {
     if (!ptr) return;
-    SilverObjectHeader* header = ((SilverObjectHeader*)ptr) - 1;
-    header->refCount++;
+    SilverObjectHeader* header = (SilverObjectHeader*)ptr;
+    header->refCount.fetch_add(1, std::memory_order_relaxed);
+    if (allocStatsEnabled()) {
+        recordRetain(header->type);
+    }
 }
 
 // Decrement reference count and free if zero
 SILVER_EXPORT void silver_release(void* ptr) {
     if (!ptr) return;
-    SilverObjectHeader* header = ((SilverObjectHeader*)ptr) - 1;
-    if (--header->refCount == 0) {
+    SilverObjectHeader* header = (SilverObjectHeader*)ptr;
+    bool freed = header->refCount.fetch_sub(1, std::memory_order_release) == 1;
+    if (allocStatsEnabled()) {
+        recordRelease(header->type, freed);
+    }
+    if (freed) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->type && header->type->destroy) {
+            header->type->destroy(ptr);
+        }
         free(header);
     }
 }
@@ -71,37 +393,446 @@ SILVER_EXPORT void silver_release(void* ptr) {
 // Get current reference count (for debugging)
 SILVER_EXPORT int silver_refcount(void* ptr) {
     if (!ptr) return 0;
-    SilverObjectHeader* header = ((SilverObjectHeader*)ptr) - 1;
+    SilverObjectHeader* header = (SilverObjectHeader*)ptr;
     return header->refCount;
 }
 
 // Legacy free (for non-ref-counted allocations)
 SILVER_EXPORT void silver_free(void* ptr) {
     if (!ptr) return;
-    SilverObjectHeader* header = ((SilverObjectHeader*)ptr) - 1;
+    SilverObjectHeader* header = (SilverObjectHeader*)ptr;
     free(header);
 }
 
+// Array representation
+// The length sits in the padding after the object header and the elements follow it,
+// so retain and release treat arrays like any other object.
+// Must match the layout emitted by CodeGen::generateIndex.
+struct SilverArrayHeader {
+    const SilverTypeInfo* type;
+    std::atomic_int refCount;
+    int32_t length;
+};
+
+// Allocate a zeroed array of length elements (initial ref count = 1)
+SILVER_EXPORT void* silver_array_new(int length, size_t elementSize, const SilverTypeInfo* type) {
+    if (length < 0) {
+        silver_flush();
+        fprintf(stderr, "negative array length %d\n", length);
+        abort();
+    }
+    size_t size = sizeof(SilverArrayHeader) + (size_t)length * elementSize;
+    SilverArrayHeader* header = (SilverArrayHeader*)calloc(1, size);
+    if (!header) outOfMemory();
+    header->type = type;
+    header->refCount = 1;
+    header->length = length;
+    if (allocStatsEnabled()) {
+        recordAlloc(type, size);
+    }
+    return header;
+}
+
+// Called by the bounds check the compiler emits before an array access
+[[noreturn]] SILVER_EXPORT void silver_array_bounds_fail(int index, int length) {
+    silver_flush();
+    fprintf(stderr, "index %d out of bounds for array of length %d\n", index, length);
+    abort();
+}
+
+// Hash map support
+// HashMap in framework/map.sl keeps a control byte per slot in a [u8] array: 0 for an empty slot,
+// 1 for a removed entry and 128 plus 7 bits of the key's hash for a full one. Slots come in groups
+// of 16 whose control bytes are compared at once, so only keys whose 7 hash bits match are looked at.
+#define SILVER_MAP_GROUP_SIZE 16
+
+// Bit i is set when control byte i matches tag, a negative tag matches the free (empty or removed) slots
+static uint32_t matchGroup(const uint8_t* group, int tag) {
+#if defined(_M_X64) || defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    if (tag < 0) {
+        return ~(uint32_t)_mm_movemask_epi8(bytes) & 0xFFFF;
+    }
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t matches = 0;
+    for (int i = 0; i < SILVER_MAP_GROUP_SIZE; i++) {
+        if (tag < 0 ? group[i] < 128 : group[i] == tag) {
+            matches |= 1u << i;
+        }
+    }
+    return matches;
+#endif
+}
+
+static int lowestBit(uint32_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// Find the first slot at or after from in the group starting at slot base whose control byte
+// matches tag. Returns its index in the group, or when there is none 17 if the group has an empty
+// slot (so a lookup can stop) and 16 if it doesn't.
+SILVER_EXPORT int silver_map_probe(const void* ctrl, int base, int tag, int from) {
+    const uint8_t* group = (const uint8_t*)ctrl + sizeof(SilverArrayHeader) + base;
+    uint32_t matches = (matchGroup(group, tag) >> from) << from;
+    if (matches != 0) {
+        return lowestBit(matches);
+    }
+    return matchGroup(group, 0) != 0 ? SILVER_MAP_GROUP_SIZE + 1 : SILVER_MAP_GROUP_SIZE;
+}
+
+// Tasks
+// "spawn f(x)" allocates a task with a frame the compiler lays out as f's result followed by its
+// arguments, stores the arguments in it and queues the task. run calls f on the arguments and
+// stores the result, drop releases a result that is a reference when the task is freed. Tasks are
+// reference counted like objects, the scheduler holds a reference of its own until the task has
+// run, so dropping every handle doesn't cancel a task. Nothing waits for tasks nobody joins when
+// main returns.
+typedef void (*SilverTaskFunction)(void* frame);
+
+struct SilverTask {
+    SilverObjectHeader header;
+    std::atomic_bool done;
+    SilverTaskFunction run;
+    SilverTaskFunction drop;
+};
+
+// The frame follows the task, 16-byte aligned like every allocation
+static const size_t TASK_FRAME_OFFSET = (sizeof(SilverTask) + 15) & ~(size_t)15;
+
+static void* taskFrame(SilverTask* task) {
+    return (char*)task + TASK_FRAME_OFFSET;
+}
+
+static void destroyTask(void* object) {
+    SilverTask* task = (SilverTask*)object;
+    if (task->drop) {
+        task->drop(taskFrame(task));
+    }
+}
+
+static const SilverTypeInfo gTaskTypeInfo = { "task", destroyTask };
+
+// Work-stealing scheduler
+// Every worker thread has a queue of its own: it pushes the tasks it spawns at the back and takes
+// them from there, so it runs the newest task while its data is still in the cache. An idle thread
+// steals from the front of another queue, taking the oldest task, which usually stands for the
+// most work. Threads that aren't workers, like the main thread, share queue 0. A thread waiting in
+// join runs queued tasks instead of blocking as long as there are any. SILVER_THREADS sets how many
+// threads run tasks, counting the main thread, the default is one per core.
+struct alignas(64) SilverTaskQueue {
+    std::mutex lock;
+    std::deque<SilverTask*> tasks;
+};
+
+struct SilverScheduler {
+    std::vector<SilverTaskQueue*> queues;
+    std::atomic_int queued{0};
+    // Threads waiting on wake. A thread counts itself before checking what it waits for, and every
+    // change it could wait for is made before looking at the count, so a wakeup is never lost.
+    std::atomic_int sleepers{0};
+    std::mutex sleepLock;
+    std::condition_variable wake;
+};
+
+static thread_local int tQueue = 0;
+
+static void workerMain(SilverScheduler* scheduler, int queue);
+
+// Started by the first spawn and never torn down, idle workers go away with the process
+static SilverScheduler& scheduler() {
+    static SilverScheduler* created = []() {
+        SilverScheduler* scheduler = new SilverScheduler();
+        const char* env = getenv("SILVER_THREADS");
+        int threads = env != nullptr && atoi(env) > 0 ? atoi(env) : (int)std::thread::hardware_concurrency();
+        if (threads < 1) {
+            threads = 1;
+        }
+        for (int i = 0; i < threads; i++) {
+            scheduler->queues.push_back(new SilverTaskQueue());
+        }
+        for (int i = 1; i < threads; i++) {
+            std::thread(workerMain, scheduler, i).detach();
+        }
+        return scheduler;
+    }();
+    return *created;
+}
+
+// The newest task in the thread's own queue, or else the oldest in the next queue that has one
+static SilverTask* takeTask(SilverScheduler& scheduler, int self) {
+    if (scheduler.queued.load() == 0) {
+        return nullptr;
+    }
+    size_t count = scheduler.queues.size();
+    for (size_t i = 0; i < count; i++) {
+        SilverTaskQueue& queue = *scheduler.queues[(self + i) % count];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (!queue.tasks.empty()) {
+            SilverTask* task;
+            if (i == 0) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            } else {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            scheduler.queued--;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+// Wakes every sleeping thread to check what it waits for
+static void wakeAll(SilverScheduler& scheduler) {
+    if (scheduler.sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(scheduler.sleepLock);
+        scheduler.wake.notify_all();
+    }
+}
+
+static void runTask(SilverScheduler& scheduler, SilverTask* task) {
+    task->run(taskFrame(task));
+    task->done.store(true);
+    wakeAll(scheduler);
+    silver_release(task);
+}
+
+// Blocks until a task is queued, or until done is set when it isn't null
+static void sleepUntilWork(SilverScheduler& scheduler, const std::atomic_bool* done) {
+    std::unique_lock<std::mutex> lock(scheduler.sleepLock);
+    scheduler.sleepers++;
+    scheduler.wake.wait(lock, [&]() {
+        return scheduler.queued.load() > 0 || (done != nullptr && done->load());
+    });
+    scheduler.sleepers--;
+}
+
+static void workerMain(SilverScheduler* scheduler, int queue) {
+    tQueue = queue;
+    for (;;) {
+        SilverTask* task = takeTask(*scheduler, queue);
+        if (task) {
+            runTask(*scheduler, task);
+        } else {
+            sleepUntilWork(*scheduler, nullptr);
+        }
+    }
+}
+
+// Allocate a task with a zeroed frame of frameSize bytes (initial ref count = 1), drop may be null
+SILVER_EXPORT void* silver_task_new(size_t frameSize, SilverTaskFunction run, SilverTaskFunction drop) {
+    size_t size = TASK_FRAME_OFFSET + frameSize;
+    SilverTask* task = (SilverTask*)calloc(1, size);
+    if (!task) outOfMemory();
+    task->header.type = &gTaskTypeInfo;
+    task->header.refCount = 1;
+    task->done = false;
+    task->run = run;
+    task->drop = drop;
+    if (allocStatsEnabled()) {
+        recordAlloc(&gTaskTypeInfo, size);
+    }
+    return task;
+}
+
+// Where the compiler stores the arguments and finds the result
+SILVER_EXPORT void* silver_task_frame(void* task) {
+    return taskFrame((SilverTask*)task);
+}
+
+// Queue a task whose arguments are in its frame
+SILVER_EXPORT void silver_task_spawn(void* ptr) {
+    SilverTask* task = (SilverTask*)ptr;
+    SilverScheduler& s = scheduler();
+    silver_retain(task);
+    {
+        SilverTaskQueue& queue = *s.queues[tQueue];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.push_back(task);
+    }
+    s.queued++;
+    if (s.sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(s.sleepLock);
+        s.wake.notify_one();
+    }
+}
+
+// Wait for a task to finish, running other tasks meanwhile, and return its frame
+SILVER_EXPORT void* silver_task_join(void* ptr) {
+    SilverTask* task = (SilverTask*)ptr;
+    if (!task) {
+        silver_flush();
+        fprintf(stderr, "join of a task that was never spawned\n");
+        abort();
+    }
+    SilverScheduler& s = scheduler();
+    while (!task->done.load()) {
+        SilverTask* other = takeTask(s, tQueue);
+        if (other) {
+            runTask(s, other);
+        } else {
+            sleepUntilWork(s, &task->done);
+        }
+    }
+    return taskFrame(task);
+}
+
+// Parallel loops
+// "parallel for" calls body(context, from, to) for pieces of its range, grain iterations at a time.
+// The range is split lazily: before each piece, a thread working on a part of the range hands the
+// second half of what is left to the thread pool if some thread is idle and nothing else is queued.
+// An idle pool takes the range apart in a few steps, a busy one leaves most of it to the thread that
+// started the loop, and a part that finishes early leaves its thread free to take the next split
+// off a slower one. The grain allows 16 pieces per thread, so splitting is checked often enough to
+// balance uneven iterations while the call per piece costs nothing next to the piece.
+typedef void (*SilverRangeBody)(void* context, int from, int to);
+
+struct SilverLoop {
+    SilverRangeBody body;
+    void* context;
+    int64_t grain;
+    // Parts of the range that are queued or running, the last one to finish sets done
+    std::atomic_int pending;
+    std::atomic_bool done;
+};
+
+struct SilverRangeFrame {
+    SilverLoop* loop;
+    int from;
+    int to;
+};
+
+static void runRangeTask(void* frame);
+
+static void runRange(SilverScheduler& scheduler, SilverLoop* loop, int from, int to) {
+    while (from < to) {
+        int64_t left = (int64_t)to - from;
+        if (left > 2 * loop->grain && scheduler.sleepers.load() > 0 && scheduler.queued.load() == 0) {
+            int middle = (int)(from + left / 2);
+            loop->pending++;
+            SilverTask* task = (SilverTask*)silver_task_new(sizeof(SilverRangeFrame), runRangeTask, nullptr);
+            SilverRangeFrame* range = (SilverRangeFrame*)taskFrame(task);
+            range->loop = loop;
+            range->from = middle;
+            range->to = to;
+            silver_task_spawn(task);
+            silver_release(task);
+            to = middle;
+            continue;
+        }
+
+        int end = left > loop->grain ? (int)(from + loop->grain) : to;
+        loop->body(loop->context, from, end);
+        from = end;
+    }
+
+    // The loop lives on the stack of the thread that started it, which returns once done is set
+    if (loop->pending.fetch_sub(1) == 1) {
+        loop->done.store(true);
+        wakeAll(scheduler);
+    }
+}
+
+static void runRangeTask(void* frame) {
+    SilverRangeFrame* range = (SilverRangeFrame*)frame;
+    runRange(scheduler(), range->loop, range->from, range->to);
+}
+
+// Run body over [start, end) on the thread pool, returns when every piece is done
+SILVER_EXPORT void silver_parallel_for(int start, int end, SilverRangeBody body, void* context) {
+    if (start >= end) {
+        return;
+    }
+    SilverScheduler& s = scheduler();
+    SilverLoop loop;
+    loop.body = body;
+    loop.context = context;
+    loop.grain = std::max<int64_t>(1, ((int64_t)end - start) / ((int64_t)s.queues.size() * 16));
+    loop.pending = 1;
+    loop.done = false;
+
+    runRange(s, &loop, start, end);
+    while (!loop.done.load()) {
+        SilverTask* other = takeTask(s, tQueue);
+        if (other) {
+            runTask(s, other);
+        } else {
+            sleepUntilWork(s, &loop.done);
+        }
+    }
+}
+
+// Print the allocation statistics summary to stderr
+// Registered with atexit when statistics are enabled, can also be called directly
+SILVER_EXPORT void silver_print_alloc_stats() {
+    std::lock_guard<std::mutex> lock(gStatsMutex);
+
+    // By class name, the map is ordered by type info address, which changes between builds
+    std::vector<std::pair<const SilverTypeInfo*, SilverClassStats>> classes(gClassStats.begin(), gClassStats.end());
+    std::stable_sort(classes.begin(), classes.end(), [](const auto& a, const auto& b) {
+        return strcmp(typeName(a.first), typeName(b.first)) < 0;
+    });
+
+    SilverClassStats total;
+    fprintf(stderr, "\nSilver allocation statistics\n");
+    fprintf(stderr, "%-24s %10s %10s %12s %10s %10s %10s %10s\n",
+            "class", "allocs", "frees", "bytes", "peak live", "retains", "releases", "live");
+    for (const auto& entry : classes) {
+        const SilverClassStats& stats = entry.second;
+        fprintf(stderr, "%-24s %10llu %10llu %12llu %10lld %10llu %10llu %10lld\n",
+                typeName(entry.first),
+                (unsigned long long)stats.allocs, (unsigned long long)stats.frees,
+                (unsigned long long)stats.bytes, (long long)stats.peakLive,
+                (unsigned long long)stats.retains, (unsigned long long)stats.releases,
+                (long long)stats.live);
+        total.allocs += stats.allocs;
+        total.frees += stats.frees;
+        total.bytes += stats.bytes;
+        total.retains += stats.retains;
+        total.releases += stats.releases;
+    }
+    fprintf(stderr, "%-24s %10llu %10llu %12llu %10lld %10llu %10llu %10lld\n",
+            "total",
+            (unsigned long long)total.allocs, (unsigned long long)total.frees,
+            (unsigned long long)total.bytes, (long long)gPeakLiveObjects,
+            (unsigned long long)total.retains, (unsigned long long)total.releases,
+            (long long)gLiveObjects);
+
+    // Anything still live at exit was never released
+    for (const auto& entry : classes) {
+        if (entry.second.live > 0) {
+            fprintf(stderr, "leak: %lld %s object(s) still live at exit\n",
+                    (long long)entry.second.live, typeName(entry.first));
+        }
+    }
+}
+
 // Get the length of a UTF-8 string in codepoints (characters)
-// This counts the number of Unicode codepoints, not bytes
+// This counts the number of Unicode codepoints, not bytes, and is cached in the header
 SILVER_EXPORT int silver_strlen_utf8(const char* s) {
     if (!s) return 0;
-    int count = 0;
-    while (*s) {
-        // In UTF-8, continuation bytes start with 10xxxxxx (0x80-0xBF)
-        // We count bytes that are NOT continuation bytes
-        if ((*s & 0xC0) != 0x80) {
-            count++;
-        }
-        s++;
-    }
-    return count;
+    return stringHeader(s)->codepoints;
 }
 
 // Get the length of a string in bytes (not including null terminator)
 SILVER_EXPORT int silver_string_bytes(const char* s) {
     if (!s) return 0;
-    return (int)strlen(s);
+    return stringHeader(s)->byteLength;
+}
+
+// Check that a string holds well formed UTF-8
+// Returns 1 if valid, 0 if not
+SILVER_EXPORT int silver_utf8_valid(const char* s) {
+    if (!s) return 0;
+    return utf8::validate(s, stringHeader(s)->byteLength) ? 1 : 0;
 }
 
 }
@@ -0,0 +1,438 @@
+// UTF-8 kernels used by the Silver runtime
+// Counting is branch free: a byte starts a codepoint unless it is a continuation byte, which as a
+// signed char is anything below -64. Validation follows the lookup table approach of Keiser and
+// Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte"): every byte is classified by
+// the nibbles of itself and the byte before it, three table lookups per block find all errors
+// in two byte windows, and a separate check makes sure 3 and 4 byte sequences have enough
+// continuation bytes. That needs a byte shuffle, so the SSE2 version only skips ASCII blocks. It
+// loses to the scalar one as soon as the text isn't mostly ASCII, so without AVX2 validate() uses
+// the scalar version and the SSE2 one is only there for the benchmark.
+
+#include "utf8.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SILVER_UTF8_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC can emit any instruction set from intrinsics, GCC and Clang need the target per function
+#if defined(SILVER_UTF8_X86) && !defined(_MSC_VER)
+#define SILVER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SILVER_TARGET_AVX2
+#endif
+
+namespace utf8
+{
+    size_t countScalar(const char* s, size_t length)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            count += (signed char)s[i] > -65;
+        }
+        return count;
+    }
+
+    // Validates s[start, length) one sequence at a time, start must be on a codepoint boundary
+    static bool validateScalarFrom(const unsigned char* s, size_t start, size_t length)
+    {
+        size_t i = start;
+        while (i < length)
+        {
+            // Skip ASCII eight bytes at a time
+            if (i + 8 <= length)
+            {
+                uint64_t word;
+                memcpy(&word, s + i, sizeof(word));
+                if ((word & 0x8080808080808080ull) == 0)
+                {
+                    i += 8;
+                    continue;
+                }
+            }
+
+            unsigned char lead = s[i];
+            if (lead < 0x80)
+            {
+                i++;
+                continue;
+            }
+
+            size_t needed;
+            unsigned char min = 0x80;
+            unsigned char max = 0xBF;
+            if (lead >= 0xC2 && lead <= 0xDF)
+            {
+                needed = 1;
+            }
+            else if (lead >= 0xE0 && lead <= 0xEF)
+            {
+                needed = 2;
+                if (lead == 0xE0) min = 0xA0;  // overlong
+                if (lead == 0xED) max = 0x9F;  // surrogates
+            }
+            else if (lead >= 0xF0 && lead <= 0xF4)
+            {
+                needed = 3;
+                if (lead == 0xF0) min = 0x90;  // overlong
+                if (lead == 0xF4) max = 0x8F;  // above U+10FFFF
+            }
+            else
+            {
+                return false;
+            }
+
+            if (i + needed >= length)
+            {
+                return false;
+            }
+
+            // The first continuation byte carries the range restrictions, the rest are plain
+            if (s[i + 1] < min || s[i + 1] > max)
+            {
+                return false;
+            }
+            for (size_t k = 2; k <= needed; k++)
+            {
+                if ((s[i + k] & 0xC0) != 0x80)
+                {
+                    return false;
+                }
+            }
+            i += needed + 1;
+        }
+        return true;
+    }
+
+    bool validateScalar(const char* s, size_t length)
+    {
+        return validateScalarFrom((const unsigned char*)s, 0, length);
+    }
+
+    // Finds the start of the last, possibly incomplete, codepoint before end so a scalar pass can
+    // finish what the block loop started
+    static size_t lastCodepointStart(const unsigned char* s, size_t end)
+    {
+        for (size_t back = 1; back <= 3 && back <= end; back++)
+        {
+            if ((s[end - back] & 0xC0) != 0x80)
+            {
+                return end - back;
+            }
+        }
+        return end;
+    }
+
+#ifdef SILVER_UTF8_X86
+    static void cpuid(int info[4], int leaf)
+    {
+#ifdef _MSC_VER
+        __cpuidex(info, leaf, 0);
+#else
+        __asm__ __volatile__("cpuid" : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3]) : "a"(leaf), "c"(0));
+#endif
+    }
+
+    static uint64_t xgetbv()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((uint64_t)edx << 32) | eax;
+#endif
+    }
+
+    bool hasSse2()
+    {
+        int info[4];
+        cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+    }
+
+    bool hasAvx2()
+    {
+        int info[4];
+        cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        // The OS has to save the YMM registers (OSXSAVE set and XCR0 enabling SSE and AVX state)
+        cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (xgetbv() & 0x6) != 0x6)
+        {
+            return false;
+        }
+
+        cpuid(info, 7);
+        return (info[1] & (1 << 5)) != 0;
+    }
+
+    size_t countSse2(const char* s, size_t length)
+    {
+        const __m128i threshold = _mm_set1_epi8(-65);
+        size_t count = 0;
+        size_t i = 0;
+        while (i + 16 <= length)
+        {
+            // Accumulate per byte lane (each compare adds 0 or -1) for at most 255 blocks,
+            // then sum the lanes with SAD
+            __m128i acc = _mm_setzero_si128();
+            size_t blocks = (length - i) / 16;
+            if (blocks > 255) blocks = 255;
+            for (size_t b = 0; b < blocks; b++, i += 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+                acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, threshold));
+            }
+            __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+            count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+        }
+        return count + countScalar(s + i, length - i);
+    }
+
+    bool validateSse2(const char* s, size_t length)
+    {
+        const unsigned char* bytes = (const unsigned char*)s;
+        size_t i = 0;
+        while (i + 16 <= length)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(bytes + i));
+            if (_mm_movemask_epi8(v) != 0)
+            {
+                // Validate up to the next codepoint boundary past this block, then keep skipping ASCII
+                size_t end = i + 16;
+                while (end < length && (bytes[end] & 0xC0) == 0x80)
+                {
+                    end++;
+                }
+                if (!validateScalarFrom(bytes, i, end))
+                {
+                    return false;
+                }
+                i = end;
+                continue;
+            }
+            i += 16;
+        }
+        return validateScalarFrom(bytes, i, length);
+    }
+
+    SILVER_TARGET_AVX2
+    size_t countAvx2(const char* s, size_t length)
+    {
+        const __m256i threshold = _mm256_set1_epi8(-65);
+        size_t count = 0;
+        size_t i = 0;
+        while (i + 32 <= length)
+        {
+            __m256i acc = _mm256_setzero_si256();
+            size_t blocks = (length - i) / 32;
+            if (blocks > 255) blocks = 255;
+            for (size_t b = 0; b < blocks; b++, i += 32)
+            {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+                acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, threshold));
+            }
+            __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+            count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1)
+                + (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+        }
+        return count + countScalar(s + i, length - i);
+    }
+
+    // Error classes for the lookup tables
+    static const uint8_t TOO_SHORT = 1 << 0;       // lead byte followed by a lead byte or ASCII
+    static const uint8_t TOO_LONG = 1 << 1;        // ASCII followed by a continuation byte
+    static const uint8_t OVERLONG_3 = 1 << 2;      // E0 80..9F
+    static const uint8_t TOO_LARGE = 1 << 3;       // F4 90..BF and F5..FF leads
+    static const uint8_t SURROGATE = 1 << 4;       // ED A0..BF
+    static const uint8_t OVERLONG_2 = 1 << 5;      // C0 and C1 leads
+    static const uint8_t TOO_LARGE_1000 = 1 << 6;  // F5..FF leads followed by 80..8F
+    static const uint8_t OVERLONG_4 = 1 << 6;      // F0 80..8F
+    static const uint8_t TWO_CONTS = 1 << 7;       // two continuation bytes, checked separately
+    static const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    SILVER_TARGET_AVX2
+    static inline __m256i prevBytes(__m256i input, __m256i previous, int n)
+    {
+        // Bytes shifted right by n across the 128-bit lane boundary, taking the start from previous
+        __m256i shifted = _mm256_permute2x128_si256(previous, input, 0x21);
+        switch (n)
+        {
+        case 1: return _mm256_alignr_epi8(input, shifted, 15);
+        case 2: return _mm256_alignr_epi8(input, shifted, 14);
+        default: return _mm256_alignr_epi8(input, shifted, 13);
+        }
+    }
+
+    SILVER_TARGET_AVX2
+    static inline __m256i highNibbles(__m256i v)
+    {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    SILVER_TARGET_AVX2
+    static inline __m256i checkBlock(__m256i input, __m256i previous)
+    {
+        const __m256i byte1HighTable = _mm256_setr_epi8(
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2,
+            TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2,
+            TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+        const __m256i byte1LowTable = _mm256_setr_epi8(
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2,
+            CARRY, CARRY,
+            CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2,
+            CARRY, CARRY,
+            CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+        const __m256i byte2HighTable = _mm256_setr_epi8(
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+        // Errors visible in each (previous byte, byte) pair
+        __m256i prev1 = prevBytes(input, previous, 1);
+        __m256i byte1High = _mm256_shuffle_epi8(byte1HighTable, highNibbles(prev1));
+        __m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+        __m256i byte2High = _mm256_shuffle_epi8(byte2HighTable, highNibbles(input));
+        __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+        // A continuation byte after a continuation byte (TWO_CONTS) is only correct when a 3 or 4 byte
+        // lead sits two or three bytes back, and such a lead requires it
+        __m256i prev2 = prevBytes(input, previous, 2);
+        __m256i prev3 = prevBytes(input, previous, 3);
+        __m256i isThird = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+        __m256i isFourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(isThird, isFourth), _mm256_set1_epi8((char)0x80));
+        return _mm256_xor_si256(must23, special);
+    }
+
+    SILVER_TARGET_AVX2
+    bool validateAvx2(const char* s, size_t length)
+    {
+        const unsigned char* bytes = (const unsigned char*)s;
+        __m256i error = _mm256_setzero_si256();
+        __m256i previous = _mm256_setzero_si256();
+        size_t i = 0;
+        for ( ; i + 32 <= length; i += 32)
+        {
+            __m256i input = _mm256_loadu_si256((const __m256i*)(bytes + i));
+            if (_mm256_movemask_epi8(input) == 0)
+            {
+                // ASCII block, only an unfinished sequence in the previous block can be wrong. That
+                // shows up as a TOO_SHORT when the block is checked against its predecessor.
+                if (_mm256_movemask_epi8(previous) != 0)
+                {
+                    error = _mm256_or_si256(error, checkBlock(input, previous));
+                }
+            }
+            else
+            {
+                error = _mm256_or_si256(error, checkBlock(input, previous));
+            }
+            previous = input;
+        }
+
+        if (!_mm256_testz_si256(error, error))
+        {
+            return false;
+        }
+
+        // The blocks were checked pairwise, finish from the start of the last codepoint they contained
+        return validateScalarFrom(bytes, lastCodepointStart(bytes, i), length);
+    }
+#else
+    bool hasSse2() { return false; }
+    bool hasAvx2() { return false; }
+    size_t countSse2(const char* s, size_t length) { return countScalar(s, length); }
+    bool validateSse2(const char* s, size_t length) { return validateScalar(s, length); }
+    size_t countAvx2(const char* s, size_t length) { return countScalar(s, length); }
+    bool validateAvx2(const char* s, size_t length) { return validateScalar(s, length); }
+#endif
+
+    struct Kernels
+    {
+        size_t (*count)(const char*, size_t);
+        bool (*validate)(const char*, size_t);
+        const char* name;
+    };
+
+    static Kernels selectKernels()
+    {
+        if (hasAvx2())
+        {
+            return { countAvx2, validateAvx2, "avx2" };
+        }
+        if (hasSse2())
+        {
+            return { countSse2, validateScalar, "sse2" };
+        }
+        return { countScalar, validateScalar, "scalar" };
+    }
+
+    static const Kernels& kernels()
+    {
+        static const Kernels selected = selectKernels();
+        return selected;
+    }
+
+    size_t count(const char* s, size_t length)
+    {
+        return kernels().count(s, length);
+    }
+
+    bool validate(const char* s, size_t length)
+    {
+        return kernels().validate(s, length);
+    }
+
+    const char* kernelName()
+    {
+        return kernels().name;
+    }
+}
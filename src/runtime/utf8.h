@@ -0,0 +1,31 @@
+// UTF-8 kernels used by the Silver runtime
+// Each operation has a scalar version and, on x86, SSE2 and AVX2 versions. count() and
+// validate() pick the fastest one the CPU supports the first time they are called.
+
+#pragma once
+
+#include <stddef.h>
+
+namespace utf8
+{
+    // Number of codepoints, i.e. bytes that are not continuation bytes (10xxxxxx)
+    size_t count(const char* s, size_t length);
+
+    // True if the bytes are well formed UTF-8 (no overlong forms, surrogates or values above U+10FFFF)
+    bool validate(const char* s, size_t length);
+
+    // Name of the kernel set count() and validate() dispatch to: "avx2", "sse2" (SSE2 counting and
+    // scalar validation) or "scalar"
+    const char* kernelName();
+
+    // Individual kernels, exposed for benchmarks. The SIMD ones must only be called when
+    // hasSse2() / hasAvx2() return true.
+    size_t countScalar(const char* s, size_t length);
+    bool validateScalar(const char* s, size_t length);
+    bool hasSse2();
+    bool hasAvx2();
+    size_t countSse2(const char* s, size_t length);
+    bool validateSse2(const char* s, size_t length);
+    size_t countAvx2(const char* s, size_t length);
+    bool validateAvx2(const char* s, size_t length);
+}
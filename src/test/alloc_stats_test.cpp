@@ -0,0 +1,130 @@
+// Checks the allocation statistics the runtime prints with SILVER_ALLOC_STATS=1
+// Allocates through the runtime the way compiled programs do: one object that is retained and
+// released until it is freed, one that is freed right away and one that is leaked. The summary has
+// to count them, list the classes in name order and report the leak. Exits with 0 when the report
+// is right, test_runner runs it with the program tests.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Must match SilverTypeInfo in the runtime
+struct SilverTypeInfo
+{
+    const char *name;
+    void (*destroy)(void *object);
+};
+
+extern "C" void *silver_alloc(size_t size, const SilverTypeInfo *type);
+extern "C" void silver_retain(void *ptr);
+extern "C" void silver_release(void *ptr);
+extern "C" void silver_print_alloc_stats();
+
+static const SilverTypeInfo leakedType = { "Leaked", nullptr };
+static const SilverTypeInfo freedType = { "Freed", nullptr };
+static const SilverTypeInfo cachedType = { "Cached", nullptr };
+
+// The counts on the summary line starting with name
+static bool readLine(const std::string &report, const char *name, long long counts[7])
+{
+    std::istringstream lines(report);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        char first[64];
+        if (sscanf(line.c_str(), "%63s %lld %lld %lld %lld %lld %lld %lld", first, &counts[0], &counts[1], &counts[2],
+                   &counts[3], &counts[4], &counts[5], &counts[6]) == 8 && strcmp(first, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool expectLine(const std::string &report, const char *name, const long long expected[7])
+{
+    long long counts[7];
+    if (!readLine(report, name, counts))
+    {
+        fprintf(stdout, "no summary line for %s\n", name);
+        return false;
+    }
+    for (int i = 0; i < 7; i++)
+    {
+        if (counts[i] != expected[i])
+        {
+            fprintf(stdout, "%s: column %d is %lld, expected %lld\n", name, i + 1, counts[i], expected[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    // Read when the runtime allocates for the first time
+#ifdef _WIN32
+    _putenv_s("SILVER_ALLOC_STATS", "1");
+#else
+    setenv("SILVER_ALLOC_STATS", "1", 1);
+#endif
+
+    void *freed = silver_alloc(32, &freedType);
+    silver_retain(freed);
+    silver_release(freed);
+    silver_release(freed);
+    silver_alloc(24, &leakedType);
+    silver_release(silver_alloc(16, &cachedType));
+
+    // The summary goes to stderr, capture it in a file
+    const char *path = "alloc_stats_test.txt";
+    if (freopen(path, "w", stderr) == nullptr)
+    {
+        fprintf(stdout, "cannot redirect stderr\n");
+        return 1;
+    }
+    silver_print_alloc_stats();
+    fflush(stderr);
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    file.close();
+    remove(path);
+    std::string report = contents.str();
+
+    // allocs, frees, bytes, peak live, retains, releases, live
+    const long long freedCounts[7] = { 1, 1, 32, 1, 1, 2, 0 };
+    const long long leakedCounts[7] = { 1, 0, 24, 1, 0, 0, 1 };
+    const long long cachedCounts[7] = { 1, 1, 16, 1, 0, 1, 0 };
+    const long long totalCounts[7] = { 3, 2, 72, 2, 1, 3, 1 };
+    bool ok = expectLine(report, "Freed", freedCounts);
+    ok = expectLine(report, "Cached", cachedCounts) && ok;
+    ok = expectLine(report, "Leaked", leakedCounts) && ok;
+    ok = expectLine(report, "total", totalCounts) && ok;
+    if (report.find("leak: 1 Leaked object(s) still live at exit") == std::string::npos
+        || report.find("leak: 1 Freed") != std::string::npos)
+    {
+        fprintf(stdout, "wrong leak report\n");
+        ok = false;
+    }
+    // Declared in the opposite order, so the report can't follow the addresses of the type infos
+    size_t cachedAt = report.find("\nCached ");
+    size_t freedAt = report.find("\nFreed ");
+    size_t leakedAt = report.find("\nLeaked ");
+    if (!(cachedAt < freedAt && freedAt < leakedAt && leakedAt < report.find("\ntotal ")))
+    {
+        fprintf(stdout, "classes are not in name order\n");
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        fprintf(stdout, "%s", report.c_str());
+        return 1;
+    }
+    fprintf(stdout, "alloc stats ok\n");
+    return 0;
+}
@@ -466,6 +466,20 @@ int main(int argc, char *argv[])
         }
     }
 
+    // The runtime's allocation statistics are checked by a program of their own
+    if (fs::exists("alloc_stats_test.exe"))
+    {
+        TestResult result;
+        result.path = "alloc_stats_test.exe";
+        std::string output;
+        result.passed = runProcess("alloc_stats_test.exe 2>&1", output) == 0;
+        if (!result.passed)
+        {
+            result.failures.push_back({"Allocation statistics report is wrong", output});
+        }
+        results.push_back(result);
+    }
+
     // Sort results by path for consistent output
     std::sort(results.begin(), results.end(), [](const TestResult &a, const TestResult &b)
               { return a.path < b.path; });